@@ -1,24 +1,25 @@
 #!/bin/bash
 
 MEASURMENTS=128
-FACTOR=1.001
+PRECISION=0.001
+MAX_RUNS=4000
 
 RUNS="$(seq 4)"
 VERSIONS="gcc-o2 clang-o2 gcc-o3 clang-o3"
-VARIANTS="arrays" #"simple avx avx2 arrays"
+VARIANTS="arrays" #"simple,avx,avx2,arrays,avx2-recycle,avx2-fma1,avx2-fma2,avx2-fma3,avx2-fma4,avx512-fma1,avx512-fma2,avx512-fma3,simple-d,avx-d,avx2-d,perturb"
+SCENES="default" #"default,full,seahorse,elephant,minibrot,exterior,interior"
 
 mkdir -p res/
 touch res/bench.target
 
 for RUN in ${RUNS}; do
 	for NAME in ${VERSIONS}; do
-		for VAR in ${VARIANTS}; do
-			echo
-			echo
-			echo "==> Running ${VAR} compiled with ${NAME}, run #${RUN}"
-			echo
-			stdbuf -o0 "./build/bench-${NAME}" -g ${VAR} -m ${MEASURMENTS} -v ${FACTOR} \
-				| tee "res/${NAME}.${VAR}.${RUN}.log"
-		done
+		echo
+		echo
+		echo "==> Running ${VARIANTS} on ${SCENES} compiled with ${NAME}, run #${RUN}"
+		echo
+		stdbuf -o0 "./build/bench-${NAME}" -A -b ${NAME} -g ${VARIANTS} -S ${SCENES} \
+			-m ${MEASURMENTS} -e ${PRECISION} -M ${MAX_RUNS} -O "res/${NAME}.${RUN}.csv" \
+			| tee "res/${NAME}.${RUN}.log"
 	done
 done
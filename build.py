@@ -117,8 +117,8 @@ import glob
 
 BUILD_DIR = 'build'
 
-COMMON_CFLAGS = ['-c', '-Wall', '-g', '-mavx2', '-Isrc/']
-COMMON_LDFLAGS = ['-g', '-lSDL2', '-lm']
+COMMON_CFLAGS = ['-c', '-Wall', '-g', '-pthread', '-Isrc/']
+COMMON_LDFLAGS = ['-g', '-pthread', '-lSDL2', '-lm']
 
 CCs = [
 	[ 'gcc-o2', 'gcc', COMMON_CFLAGS + ['-O2'], COMMON_LDFLAGS ],
@@ -127,12 +127,47 @@ CCs = [
 	[ 'clang-o3', 'clang', COMMON_CFLAGS + ['-O3'], COMMON_LDFLAGS ],
 ]
 
-COMMON_SOURCES = glob.glob('src/color/*.c') + glob.glob('src/gen/*.c')
+# Only kernels are compiled for their instruction sets, the rest of
+# the code runs on any x86-64. Generators are picked by what the CPU
+# supports at runtime, see `mb_isa_supported()`.
+ISA_CFLAGS = {
+	'src/gen/avx.c': ['-mavx'],
+	'src/gen/avx_d.c': ['-mavx'],
+	'src/gen/avx2.c': ['-mavx2'],
+	'src/gen/avx2_d.c': ['-mavx2'],
+	'src/gen/avx2_recycle.c': ['-mavx2'],
+	'src/gen/arr.c': ['-mavx2'],
+	'src/gen/perturb.c': ['-mavx2'],
+	'src/gen/avx2_fma.c': ['-mavx2', '-mfma'],
+	'src/gen/avx512.c': ['-mavx512f', '-mfma'],
+}
+
+# Built only by compilers which know the instruction set
+AVX512_SOURCES = ['src/gen/avx512.c']
+
+def compiler_supports(cc_cmd, flags):
+	try:
+		res = subprocess.run(
+				[cc_cmd, *flags, '-x', 'c', '-c', os.devnull, '-o', os.devnull],
+				capture_output=True
+		)
+	except FileNotFoundError:
+		return False
+	return res.returncode == 0
+
+COMMON_SOURCES = glob.glob('src/color/*.c') + glob.glob('src/gen/*.c') \
+		+ glob.glob('src/render/*.c')
 BENCH_SOURCES = glob.glob('src/benchmark/*.c')
 VIEWER_SOURCES = glob.glob('src/viewer/*.c')
+TILES_SOURCES = glob.glob('src/tiles/*.c')
+RENDER_SOURCES = glob.glob('src/image/*.c')
+ANIM_SOURCES = glob.glob('src/anim/*.c')
+SERVER_SOURCES = glob.glob('src/server/*.c')
+LOADGEN_SOURCES = glob.glob('src/loadgen/*.c')
 HEADERS = glob.glob('src/**/*.h', recursive=True)
 
-ALL_SOURCES = COMMON_SOURCES + BENCH_SOURCES + VIEWER_SOURCES
+ALL_SOURCES = COMMON_SOURCES + BENCH_SOURCES + VIEWER_SOURCES + TILES_SOURCES \
+		+ RENDER_SOURCES + ANIM_SOURCES + SERVER_SOURCES + LOADGEN_SOURCES
 
 os.makedirs(BUILD_DIR, exist_ok=True)
 
@@ -148,19 +183,36 @@ to_clean = []
 for cc in CCs:
 	(name, cc_cmd, cflags, ldflags) = cc
 
+	common_sources = COMMON_SOURCES
+	if compiler_supports(cc_cmd, ['-mavx512f']):
+		cflags = cflags + ['-DMB_HAVE_AVX512']
+	else:
+		common_sources = [ c for c in COMMON_SOURCES if c not in AVX512_SOURCES ]
+
 	get_obj_name = lambda c_file : sourcename_to_objname(c_file, name)
-	common_objs = list(map(get_obj_name, COMMON_SOURCES))
+	common_objs = list(map(get_obj_name, common_sources))
 	bench_objs = list(map(get_obj_name, BENCH_SOURCES))
 	viewer_objs = list(map(get_obj_name, VIEWER_SOURCES))
-
-	to_clean += common_objs + bench_objs + viewer_objs
+	tiles_objs = list(map(get_obj_name, TILES_SOURCES))
+	render_objs = list(map(get_obj_name, RENDER_SOURCES))
+	# Image files are written by the same code as in `render`
+	anim_objs = list(map(get_obj_name, ANIM_SOURCES)) \
+			+ [ get_obj_name('src/image/writer.c') ]
+	server_objs = list(map(get_obj_name, SERVER_SOURCES)) \
+			+ [ get_obj_name('src/image/writer.c') ]
+	loadgen_objs = list(map(get_obj_name, LOADGEN_SOURCES))
+
+	to_clean += common_objs + bench_objs + viewer_objs + tiles_objs + render_objs \
+			+ anim_objs + server_objs + loadgen_objs
 
 	for c_file in ALL_SOURCES:
+		if c_file not in common_sources and c_file in COMMON_SOURCES:
+			continue
 		obj_file = get_obj_name(c_file)
 		step(
 			out = obj_file,
 			deps = [c_file] + HEADERS,
-			cmd = [ cc_cmd, *cflags, c_file, '-o', obj_file ]
+			cmd = [ cc_cmd, *cflags, *ISA_CFLAGS.get(c_file, []), c_file, '-o', obj_file ]
 		)
 
 	viewer_exec = os.path.join(BUILD_DIR, f'viewer-{name}')
@@ -179,6 +231,46 @@ for cc in CCs:
 		cmd = [ cc_cmd, *ldflags, *common_objs, *bench_objs, '-o', bench_exec ]
 	)
 
+	tiles_exec = os.path.join(BUILD_DIR, f'tiles-{name}')
+	to_clean.append(tiles_exec)
+	step(
+		out = tiles_exec,
+		deps = common_objs + tiles_objs,
+		cmd = [ cc_cmd, *ldflags, *common_objs, *tiles_objs, '-o', tiles_exec ]
+	)
+
+	render_exec = os.path.join(BUILD_DIR, f'render-{name}')
+	to_clean.append(render_exec)
+	step(
+		out = render_exec,
+		deps = common_objs + render_objs,
+		cmd = [ cc_cmd, *ldflags, *common_objs, *render_objs, '-o', render_exec ]
+	)
+
+	anim_exec = os.path.join(BUILD_DIR, f'anim-{name}')
+	to_clean.append(anim_exec)
+	step(
+		out = anim_exec,
+		deps = common_objs + anim_objs,
+		cmd = [ cc_cmd, *ldflags, *common_objs, *anim_objs, '-o', anim_exec ]
+	)
+
+	server_exec = os.path.join(BUILD_DIR, f'server-{name}')
+	to_clean.append(server_exec)
+	step(
+		out = server_exec,
+		deps = common_objs + server_objs,
+		cmd = [ cc_cmd, *ldflags, *common_objs, *server_objs, '-o', server_exec ]
+	)
+
+	loadgen_exec = os.path.join(BUILD_DIR, f'loadgen-{name}')
+	to_clean.append(loadgen_exec)
+	step(
+		out = loadgen_exec,
+		deps = loadgen_objs,
+		cmd = [ cc_cmd, *ldflags, *loadgen_objs, '-o', loadgen_exec ]
+	)
+
 
 step(
 	'clean',
@@ -1,83 +1,107 @@
 import os
-import re
+import csv
+import json
 from dataclasses import dataclass
 import matplotlib.pyplot as plt
 import numpy as np
 
 RESULTS_DIR = 'res'
-RESULT_TIME_RE = re.compile(r'\(68% probability\) time is (\d+(?:\.\d+)?)\s+±\s+(\d+(?:\.\d+))\s+ms')
 
 @dataclass
 class Result:
 	runs : int = 0
 	sum_times : float = 0
 	sum_dev_squared : float = 0
+	sum_iter_per_s : float = 0
 
-results = {}
-
-for name in os.listdir(RESULTS_DIR):
-	path = os.path.join(RESULTS_DIR, name)
-
-	(build_name, method, run_number, _) = name.split('.')
-	time = 0
-	omega = 0
+def read_rows(path):
 	with open(path, 'r') as f:
-		time_match = RESULT_TIME_RE.search(f.read())
-		if time_match is None:
-			raise ValueError(f'Could not find run time in file `{path}`')
-		time = float(time_match.group(1))
-		omega = float(time_match.group(2))
-	
+		if path.endswith('.json'):
+			return json.load(f)
+		return list(csv.DictReader(f))
 
-	key = (build_name, method)
+results = {}
 
-	if key not in results:
-		results[key] = Result()
+for name in sorted(os.listdir(RESULTS_DIR)):
+	if not (name.endswith('.csv') or name.endswith('.json')):
+		continue
+	path = os.path.join(RESULTS_DIR, name)
 
-	res = results[key]
-	res.runs += 1
-	res.sum_times += time
-	res.sum_dev_squared += omega * omega
+	for row in read_rows(path):
+		# Points of a thread sweep are separate methods
+		method = row['generator']
+		if int(row.get('threads', 1)) != 1:
+			method += f' x{row["threads"]}'
+		if row.get('placement', 'none') != 'none':
+			method += f' {row["placement"]}'
+		key = (row['build'], method, row['scene'])
+
+		if key not in results:
+			results[key] = Result()
+
+		res = results[key]
+		res.runs += 1
+		# Files from before medians were measured have only average
+		if row.get('median_ms') not in (None, ''):
+			res.sum_times += float(row['median_ms'])
+			res.sum_dev_squared += (float(row['mad_ms']) * 1.4826) ** 2
+		else:
+			res.sum_times += float(row['avg_ms'])
+			res.sum_dev_squared += float(row['dev_ms']) ** 2
+		res.sum_iter_per_s += float(row['iterations_per_s'])
+
+if not results:
+	raise ValueError(f'No `.csv` or `.json` results in `{RESULTS_DIR}`')
 
 
 COMPILERS = ['gcc-o2', 'gcc-o3', 'clang-o2', 'clang-o3']
 NAMES = [ 'GCC -O2', 'GCC -O3', 'Clang -O2', 'Clang -O3' ]
-COLORS = ['#00cec9', '#0984e3', '#fdcb6e', '#e17055']
+COLORS = ['#00cec9', '#0984e3', '#fdcb6e', '#e17055', '#55efc4', '#74b9ff', '#ffeaa7']
 
 print('Table:')
 print()
-print(f'| {"Build":10} | {"Method":10} | {"Avg. time":10} | {"Omega":10} |')
-print(('|' + '-'*12) * 4 + '|')
+print(f'| {"Build":10} | {"Method":12} | {"Scene":10} | {"Time":10} | {"Omega":10} | {"Giter/s":10} |')
+print(('|' + '-'*12) + '|' + '-'*14 + ('|' + '-'*12) * 4 + '|')
 
-by_method = {}
-for (build_name, method), result in results.items():
+builds = [b for b in COMPILERS if any(k[0] == b for k in results)]
+builds += sorted({k[0] for k in results} - set(builds))
+names = [NAMES[COMPILERS.index(b)] if b in COMPILERS else (b or '?') for b in builds]
+
+# scene -> method -> time for every build
+by_scene = {}
+for (build_name, method, scene), result in sorted(results.items()):
 	avg = result.sum_times / result.runs
 	omega = result.sum_dev_squared ** 0.5 / result.runs
+	speed = result.sum_iter_per_s / result.runs / 1e9
 
+	by_method = by_scene.setdefault(scene, {})
 	if method not in by_method:
-		by_method[method] = [0] * len(COMPILERS)
-	by_method[method][COMPILERS.index(build_name)] = avg
-
-	print(f'| {build_name:10} | {method:10} | {avg:10.5f} | {omega:10.5f} |')
+		by_method[method] = [0] * len(builds)
+	by_method[method][builds.index(build_name)] = avg
 
+	print(f'| {build_name:10} | {method:12} | {scene:10} | {avg:10.5f} | {omega:10.5f} | {speed:10.5f} |')
 
-BAR_WIDTH = 0.2 # 1/5
 
+fig, axes = plt.subplots(
+	len(by_scene), 1, layout='constrained',
+	figsize=(8, 6 * len(by_scene)), squeeze=False
+)
+x = np.arange(len(builds))
 
-fig, ax = plt.subplots(layout='constrained', figsize=(8,6))
-multiplier = 0
-x = np.arange(len(NAMES))
+for ax, (scene, by_method) in zip(axes[:, 0], by_scene.items()):
+	bar_width = 0.8 / (len(by_method) + 1)
+	multiplier = 0
 
-for (method, measurement), color in zip(by_method.items(), COLORS):
-	offset = BAR_WIDTH * multiplier
-	rects = ax.bar(x + offset, measurement, BAR_WIDTH, label=method, color=color)
-	ax.bar_label(rects, padding=10, rotation=90)
-	multiplier += 1
+	for (method, measurement), color in zip(by_method.items(), COLORS * len(by_method)):
+		offset = bar_width * multiplier
+		rects = ax.bar(x + offset, measurement, bar_width, label=method, color=color)
+		ax.bar_label(rects, padding=10, rotation=90, fmt='%.2f')
+		multiplier += 1
 
-ax.set_ylabel('Time per frame, ms')
-ax.set_title('Speed comparsion')
-ax.legend()
-ax.set_xticks(x + BAR_WIDTH * (len(by_method) - 1)/2, NAMES)
-ax.set_ylim((0, ax.get_ylim()[1] * 1.2)) # so labels will fit, not the best solution
+	ax.set_ylabel('Time per frame, ms')
+	ax.set_title(f'Speed comparsion, scene `{scene}`')
+	ax.legend()
+	ax.set_xticks(x + bar_width * (len(by_method) - 1)/2, names)
+	ax.set_ylim((0, ax.get_ylim()[1] * 1.2)) # so labels will fit, not the best solution
 
 fig.savefig('plot.svg')
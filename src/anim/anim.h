@@ -0,0 +1,53 @@
+///
+/// Zoom animation renderer: keyframes and the queues
+/// between stages of the pipeline
+///
+#ifndef I_ANIM
+#define I_ANIM
+
+#include "gen/api.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+/// Point of the camera path, frames in between are interpolated
+struct Anim_Keyframe {
+	double time;            // seconds
+	struct Mb_Big xc, yc;
+	double swidth;
+	int max_steps;
+};
+
+/// Reads lines of `time x y width max_steps`, with `#` comments.
+/// Returns number of keyframes, or -1 with the message in `err`.
+int anim_load_keyframes(FILE *f, struct Anim_Keyframe **out, char *err, size_t err_size);
+
+/// View at time `t`, between the first and the last keyframe
+void anim_interpolate(
+		const struct Anim_Keyframe *keys, int count, double t,
+		struct Anim_Keyframe *out
+);
+
+/// Bounded blocking queue of pointers
+struct Anim_Queue {
+	void **items;
+	int cap, head, count;
+	bool closed;
+	pthread_mutex_t mutex;
+	pthread_cond_t not_empty, not_full;
+};
+
+void anim_queue_init(struct Anim_Queue *q, int cap);
+void anim_queue_destroy(struct Anim_Queue *q);
+
+/// Waits for a free place, adds time spent waiting to `*wait_ms`
+void anim_queue_push(struct Anim_Queue *q, void *item, double *wait_ms);
+
+/// Waits for an item, adds time spent waiting to `*wait_ms`.
+/// Returns NULL when the queue is closed and empty.
+void *anim_queue_pop(struct Anim_Queue *q, double *wait_ms);
+
+/// No more items will be pushed, wakes up everyone waiting
+void anim_queue_close(struct Anim_Queue *q);
+
+#endif
@@ -0,0 +1,493 @@
+///
+/// Renders zoom animations along a keyframe path.
+///
+/// Frames go through a pipeline of three stages connected by bounded
+/// queues: generator threads compute whole frames (one frame per thread,
+/// so there is no synchronisation inside a frame), colorizer threads
+/// color them, and the main thread encodes them in order. A fixed set of
+/// frame buffers circulates through the stages, which bounds memory.
+///
+#include "common.h"
+#include "anim/anim.h"
+#include "color/api.h"
+#include "gen/api.h"
+#include "image/image.h"
+#include "render/api.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define DEFAULT_FPS 30
+
+struct Frame {
+	int index;
+	struct Anim_Keyframe view;
+	void *steps;
+	ARGB *colors;
+};
+
+/// Times summed over all threads of a stage
+struct StageStats {
+	double busy_ms;
+	double starved_ms;      // waiting for input
+	double blocked_ms;      // waiting for a place in the next queue
+};
+
+struct Anim {
+	const struct Anim_Keyframe *keys;
+	int nkeys;
+	int frames;
+	double fps;
+
+	int width, height;
+	enum Mb_StepsFormat format;
+	unsigned options;
+	int gen_idx, colorizer;
+
+	struct Anim_Queue free_frames, to_color, to_encode;
+
+	pthread_mutex_t mutex;
+	int next_index;
+	int generators_left, colorizers_left;
+};
+
+struct Worker {
+	pthread_t thread;
+	struct Anim *anim;
+	struct StageStats stats;
+};
+
+static void *generate_main(struct Worker *w)
+{
+	struct Anim *a = w->anim;
+	double unused = 0;
+
+	while (true) {
+		struct Frame *f = anim_queue_pop(&a->free_frames, &w->stats.starved_ms);
+
+		// Index is taken after the buffer, so the earliest frame which
+		// is not encoded yet always has one and the encoder never waits
+		// for a frame no one can compute
+		pthread_mutex_lock(&a->mutex);
+		int index = a->next_index < a->frames ? a->next_index++ : -1;
+		pthread_mutex_unlock(&a->mutex);
+
+		if (index < 0) {
+			anim_queue_push(&a->free_frames, f, &unused);
+			break;
+		}
+
+		double begin = wall_time_ms();
+		f->index = index;
+		anim_interpolate(a->keys, a->nkeys, a->keys[0].time + index / a->fps, &f->view);
+
+		struct Mb_GeneratorData gdata = {
+			.exit_steps = f->steps,
+			.format = a->format,
+			.bwidth = a->width,
+			.bheight = a->height,
+			.max_steps = f->view.max_steps,
+			.xc = mb_big_to_double(&f->view.xc),
+			.yc = mb_big_to_double(&f->view.yc),
+			.swidth = f->view.swidth,
+			.xc_hp = f->view.xc,
+			.yc_hp = f->view.yc,
+			.has_hp_center = true,
+			.options = a->options,
+			.stats = NULL,
+		};
+		gdata.rect = mb_full_rect(&gdata);
+		generators[mb_pick_generator(a->gen_idx, &gdata)].mandelbrot(&gdata);
+		w->stats.busy_ms += wall_time_ms() - begin;
+
+		anim_queue_push(&a->to_color, f, &w->stats.blocked_ms);
+	}
+
+	pthread_mutex_lock(&a->mutex);
+	if (--a->generators_left == 0)
+		anim_queue_close(&a->to_color);
+	pthread_mutex_unlock(&a->mutex);
+	return NULL;
+}
+
+static void *color_main(struct Worker *w)
+{
+	struct Anim *a = w->anim;
+	struct Mb_Palette palette = { 0 };
+	struct Frame *f;
+
+	while ((f = anim_queue_pop(&a->to_color, &w->stats.starved_ms))) {
+		double begin = wall_time_ms();
+		color_palette_update(&palette, &colorizers[a->colorizer], f->view.max_steps);
+		color_fill(&palette, f->colors, f->steps, a->format, (size_t) a->width * a->height);
+		w->stats.busy_ms += wall_time_ms() - begin;
+
+		anim_queue_push(&a->to_encode, f, &w->stats.blocked_ms);
+	}
+
+	color_palette_free(&palette);
+
+	pthread_mutex_lock(&a->mutex);
+	if (--a->colorizers_left == 0)
+		anim_queue_close(&a->to_encode);
+	pthread_mutex_unlock(&a->mutex);
+	return NULL;
+}
+
+/// Limited range BT.601, what players assume for Y4M
+static bool write_y4m(const struct Anim *a, const struct Frame *f, uint8_t *planes)
+{
+	size_t n = (size_t) a->width * a->height;
+	for (size_t i = 0; i < n; ++i) {
+		int r = f->colors[i].r, g = f->colors[i].g, b = f->colors[i].b;
+		planes[i] = ((66*r + 129*g + 25*b + 128) >> 8) + 16;
+		planes[n + i] = ((-38*r - 74*g + 112*b + 128) >> 8) + 128;
+		planes[2*n + i] = ((112*r - 94*g - 18*b + 128) >> 8) + 128;
+	}
+	return fputs("FRAME\n", stdout) != EOF && fwrite(planes, 1, 3 * n, stdout) == 3 * n;
+}
+
+static bool write_image(
+		const struct Anim *a, const struct Frame *f,
+		const char *pattern, enum Img_Format format
+)
+{
+	char path[4096];
+	snprintf(path, sizeof(path), pattern, f->index);
+
+	struct Img_Writer writer = {
+		.fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644),
+		.format = format,
+		.width = a->width,
+		.height = a->height,
+		.steps_format = a->format,
+	};
+	if (writer.fd < 0)
+		return false;
+
+	bool ok = img_begin(&writer)
+		&& img_write_rows(&writer, f->colors, f->steps, a->height)
+		&& img_finish(&writer);
+	return close(writer.fd) == 0 && ok;
+}
+
+/// Generators take no more frames, the ones being computed still
+/// go through the pipeline
+static void stop_producers(struct Anim *a)
+{
+	pthread_mutex_lock(&a->mutex);
+	a->next_index = a->frames;
+	pthread_mutex_unlock(&a->mutex);
+}
+
+/// Pattern must have exactly one `%d` conversion, maybe with a width
+static bool valid_pattern(const char *pattern)
+{
+	int conversions = 0;
+	for (const char *p = strchr(pattern, '%'); p; p = strchr(p, '%')) {
+		p++;
+		while (*p >= '0' && *p <= '9')
+			p++;
+		if (*p != 'd')
+			return false;
+		conversions++;
+	}
+	return conversions == 1;
+}
+
+static int find_colorizer(const char *name)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(colorizers); ++i)
+		if (strcmp(colorizers[i].name, name) == 0)
+			return i;
+	return -1;
+}
+
+static void print_stage(FILE *out, const char *name, const struct Worker *workers, int count)
+{
+	struct StageStats sum = { 0 };
+	for (int i = 0; i < count; ++i) {
+		sum.busy_ms += workers[i].stats.busy_ms;
+		sum.starved_ms += workers[i].stats.starved_ms;
+		sum.blocked_ms += workers[i].stats.blocked_ms;
+	}
+	fprintf(
+		out, "%-10s %7d %9.2f %11.2f %11.2f\n", name, count,
+		sum.busy_ms / 1000, sum.starved_ms / 1000, sum.blocked_ms / 1000
+	);
+}
+
+static void print_usage(const char *name)
+{
+	printf(
+			"Usage: %s -k FILE -o OUTPUT [-W WIDTH] [-H HEIGHT] [-r FPS] [-g GENERATOR_NAME]\n"
+			"       [-c COLORIZER] [-t THREADS] [-C THREADS] [-q FRAMES] [-i] [-h]\n", name
+	);
+	printf(
+			"  -h                 Prints this help message\n"
+			"  -k FILE            Keyframes, lines of `time x y width max_steps`,\n"
+			"                     time in seconds\n"
+			"  -o OUTPUT          `-` for Y4M on stdout, otherwise pattern of image\n"
+			"                     files with one `%%d`, like `frames/%%05d.png`; png,\n"
+			"                     ppm or raw is taken from the extension\n"
+			"  -W, -H PIXELS      Size of frames, %dx%d by default, width\n"
+			"                     must be a multiple of 8\n"
+			"  -r FPS             Frames per second, %d by default\n"
+			"  -g GENERATOR_NAME  Generator to compute with, `%s` by default,\n"
+			"                     a more precise one is taken if needed\n"
+			"  -c COLORIZER       Colorizer, `%s` by default\n"
+			"  -t THREADS         Generator threads, all CPUs by default\n"
+			"  -C THREADS         Colorizer threads, 1 by default\n"
+			"  -q FRAMES          Frames in flight, twice the threads by default\n"
+			"  -i                 Enable interior checks\n",
+			WIN_WIDTH, WIN_HEIGHT, DEFAULT_FPS,
+			generators[DEFAULT_GENERATOR].name, colorizers[DEFAULT_COLORIZER].name
+	);
+}
+
+int main(int argc, char **argv)
+{
+	const char *key_path = NULL, *output = NULL;
+	const char *gen_name = generators[DEFAULT_GENERATOR].name;
+	const char *color_name = colorizers[DEFAULT_COLORIZER].name;
+	int width = WIN_WIDTH, height = WIN_HEIGHT;
+	double fps = DEFAULT_FPS;
+	int gen_threads = mb_cpu_count(), color_threads = 1;
+	int in_flight = 0;
+	unsigned options = 0;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "k:o:W:H:r:g:c:t:C:q:ih")) != -1) {
+		switch (opt) {
+		case 'h':
+			print_usage(argv[0]);
+			return 0;
+		case 'k':
+			key_path = optarg;
+			break;
+		case 'o':
+			output = optarg;
+			break;
+		case 'W':
+			width = atoi(optarg);
+			break;
+		case 'H':
+			height = atoi(optarg);
+			break;
+		case 'r':
+			fps = atof(optarg);
+			break;
+		case 'g':
+			gen_name = optarg;
+			break;
+		case 'c':
+			color_name = optarg;
+			break;
+		case 't':
+			gen_threads = atoi(optarg);
+			break;
+		case 'C':
+			color_threads = atoi(optarg);
+			break;
+		case 'q':
+			in_flight = atoi(optarg);
+			break;
+		case 'i':
+			options = MB_OPT_CARDIOID | MB_OPT_PERIODICITY;
+			break;
+		default:
+			print_usage(argv[0]);
+			return -1;
+		}
+	}
+
+	if (!key_path || !output) {
+		printf("Error: keyframes and output must be given\n");
+		return -1;
+	}
+
+	bool y4m = strcmp(output, "-") == 0;
+	FILE *log = y4m ? stderr : stdout;
+	int format = IMG_PNG;
+	if (!y4m) {
+		const char *ext = strrchr(output, '.');
+		format = -1;
+		for (size_t i = 0; ext && i < ARRAY_SIZE(img_formats); ++i)
+			if (strcmp(img_formats[i].name, ext + 1) == 0)
+				format = img_formats[i].format;
+		if (format < 0 || !valid_pattern(output)) {
+			fprintf(log, "Error: output must be `-` or a pattern like `frames/%%05d.png`\n");
+			return -1;
+		}
+	}
+
+	int gen_idx = mb_find_generator(gen_name);
+	if (gen_idx < 0) {
+		fprintf(log, "Error: unknown generator `%s` or the CPU does not support it\n", gen_name);
+		return -1;
+	}
+
+	int color_idx = find_colorizer(color_name);
+	if (color_idx < 0) {
+		fprintf(log, "Error: unknown colorizer `%s`\n", color_name);
+		return -1;
+	}
+
+	if (width < 8 || width % 8 != 0 || height < 1 || !(fps > 0)
+			|| gen_threads < 1 || color_threads < 1 || in_flight < 0) {
+		fprintf(log, "Error: invalid numeric argument\n");
+		return -1;
+	}
+	if (!in_flight)
+		in_flight = 2 * (gen_threads + color_threads);
+
+	FILE *key_file = fopen(key_path, "r");
+	if (!key_file) {
+		fprintf(log, "Error: failed to open `%s`: %s\n", key_path, strerror(errno));
+		return -1;
+	}
+	struct Anim_Keyframe *keys;
+	char err[256];
+	int nkeys = anim_load_keyframes(key_file, &keys, err, sizeof(err));
+	fclose(key_file);
+	if (nkeys < 0) {
+		fprintf(log, "Error: %s: %s\n", key_path, err);
+		return -1;
+	}
+
+	int max_steps = 0;
+	for (int i = 0; i < nkeys; ++i)
+		if (keys[i].max_steps > max_steps)
+			max_steps = keys[i].max_steps;
+
+	struct Anim a = {
+		.keys = keys,
+		.nkeys = nkeys,
+		.frames = (int) floor((keys[nkeys - 1].time - keys[0].time) * fps + 1e-9) + 1,
+		.fps = fps,
+		.width = width,
+		.height = height,
+		.format = mb_compact_format(max_steps),
+		.options = options,
+		.gen_idx = gen_idx,
+		.colorizer = color_idx,
+		.next_index = 0,
+		.generators_left = gen_threads,
+		.colorizers_left = color_threads,
+	};
+	pthread_mutex_init(&a.mutex, NULL);
+
+	// Queues between stages hold a couple of frames per thread of the
+	// next stage, so a slow stage shows up as blocked time of the one
+	// before it. Encoder keeps out of order frames aside, so it never
+	// blocks the queue it reads.
+	anim_queue_init(&a.free_frames, in_flight);
+	anim_queue_init(&a.to_color, 2 * color_threads);
+	anim_queue_init(&a.to_encode, 2);
+
+	size_t pixels = (size_t) width * height;
+	struct Frame *frames = calloc(in_flight, sizeof(*frames));
+	double unused = 0;
+	for (int i = 0; i < in_flight; ++i) {
+		frames[i].steps = aligned_alloc(32, (pixels * mb_steps_size(a.format) + 31) / 32 * 32);
+		frames[i].colors = malloc(pixels * sizeof(ARGB));
+		anim_queue_push(&a.free_frames, &frames[i], &unused);
+	}
+
+	fprintf(
+		log, "Rendering %d frames of %dx%d, %d generator and %d colorizer threads\n",
+		a.frames, width, height, gen_threads, color_threads
+	);
+	if (y4m)
+		printf("YUV4MPEG2 W%d H%d F%ld:1000 Ip A1:1 C444\n", width, height, lround(fps * 1000));
+
+	double begin = wall_time_ms();
+
+	struct Worker *gen_workers = calloc(gen_threads, sizeof(*gen_workers));
+	struct Worker *color_workers = calloc(color_threads, sizeof(*color_workers));
+	for (int i = 0; i < gen_threads; ++i) {
+		gen_workers[i].anim = &a;
+		pthread_create(&gen_workers[i].thread, NULL, (void*(*)(void*)) generate_main, &gen_workers[i]);
+	}
+	for (int i = 0; i < color_threads; ++i) {
+		color_workers[i].anim = &a;
+		pthread_create(&color_workers[i].thread, NULL, (void*(*)(void*)) color_main, &color_workers[i]);
+	}
+
+	// Encoding, frames come out of order and wait here for
+	// earlier ones. At most `in_flight` frames are after
+	// `next` at once, so their places do not collide.
+	struct Worker encoder = { .anim = &a };
+	struct Frame **pending = calloc(in_flight, sizeof(*pending));
+	uint8_t *planes = y4m ? malloc(3 * pixels) : NULL;
+	int next = 0;
+	bool failed = false;
+	struct Frame *f;
+
+	while ((f = anim_queue_pop(&a.to_encode, &encoder.stats.starved_ms))) {
+		// After a failure frames still in flight are only given back,
+		// so generators waiting for a buffer can see there is no more work
+		if (failed) {
+			anim_queue_push(&a.free_frames, f, &encoder.stats.blocked_ms);
+			continue;
+		}
+		pending[f->index % in_flight] = f;
+
+		while ((f = pending[next % in_flight]) && f->index == next) {
+			pending[next % in_flight] = NULL;
+
+			double write_begin = wall_time_ms();
+			bool ok = y4m ? write_y4m(&a, f, planes) : write_image(&a, f, output, format);
+			encoder.stats.busy_ms += wall_time_ms() - write_begin;
+			anim_queue_push(&a.free_frames, f, &encoder.stats.blocked_ms);
+
+			if (!ok) {
+				fprintf(log, "Error: failed to write frame %d: %s\n", next, strerror(errno));
+				failed = true;
+				stop_producers(&a);
+				for (int i = 0; i < in_flight; ++i)
+					if (pending[i])
+						anim_queue_push(&a.free_frames, pending[i], &encoder.stats.blocked_ms);
+				break;
+			}
+			next++;
+		}
+	}
+	if (y4m && !failed && fflush(stdout) != 0) {
+		fprintf(log, "Error: failed to write frames: %s\n", strerror(errno));
+		failed = true;
+	}
+
+	for (int i = 0; i < gen_threads; ++i)
+		pthread_join(gen_workers[i].thread, NULL);
+	for (int i = 0; i < color_threads; ++i)
+		pthread_join(color_workers[i].thread, NULL);
+
+	double seconds = (wall_time_ms() - begin) / 1000;
+	fprintf(log, "%d frames in %.2f s, %.2f fps\n", next, seconds, next / seconds);
+	fprintf(log, "Stage      Threads   Busy, s  Starved, s  Blocked, s\n");
+	print_stage(log, "generate", gen_workers, gen_threads);
+	print_stage(log, "color", color_workers, color_threads);
+	print_stage(log, "encode", &encoder, 1);
+
+	for (int i = 0; i < in_flight; ++i) {
+		free(frames[i].steps);
+		free(frames[i].colors);
+	}
+	free(frames);
+	free(pending);
+	free(planes);
+	free(gen_workers);
+	free(color_workers);
+	free(keys);
+	anim_queue_destroy(&a.free_frames);
+	anim_queue_destroy(&a.to_color);
+	anim_queue_destroy(&a.to_encode);
+	pthread_mutex_destroy(&a.mutex);
+	return failed ? -1 : 0;
+}
@@ -0,0 +1,91 @@
+#include "anim/anim.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+int anim_load_keyframes(FILE *f, struct Anim_Keyframe **out, char *err, size_t err_size)
+{
+	struct Anim_Keyframe *keys = NULL;
+	int count = 0, cap = 0;
+	char line[512];
+
+	for (int lineno = 1; fgets(line, sizeof(line), f); ++lineno) {
+		char *comment = strchr(line, '#');
+		if (comment)
+			*comment = '\0';
+
+		char x[200], y[200];
+		struct Anim_Keyframe key;
+		int n = sscanf(line, "%lf %199s %199s %lf %d",
+				&key.time, x, y, &key.swidth, &key.max_steps);
+		if (n <= 0)
+			continue;
+
+		if (n != 5 || !mb_big_from_str(&key.xc, x) || !mb_big_from_str(&key.yc, y)) {
+			snprintf(err, err_size, "line %d: expected `time x y width max_steps`", lineno);
+			goto fail;
+		}
+		if (!(key.swidth > 0) || key.max_steps < 1) {
+			snprintf(err, err_size, "line %d: width and max_steps must be positive", lineno);
+			goto fail;
+		}
+		if (count && !(key.time > keys[count - 1].time)) {
+			snprintf(err, err_size, "line %d: keyframe times must grow", lineno);
+			goto fail;
+		}
+
+		if (count == cap) {
+			cap = cap ? cap * 2 : 16;
+			keys = realloc(keys, cap * sizeof(*keys));
+		}
+		keys[count++] = key;
+	}
+
+	if (!count) {
+		snprintf(err, err_size, "no keyframes");
+		goto fail;
+	}
+
+	*out = keys;
+	return count;
+
+fail:
+	free(keys);
+	return -1;
+}
+
+void anim_interpolate(
+		const struct Anim_Keyframe *keys, int count, double t,
+		struct Anim_Keyframe *out
+)
+{
+	int k = 0;
+	while (k + 2 < count && t > keys[k + 1].time)
+		k++;
+
+	if (count == 1 || t <= keys[0].time) {
+		*out = keys[0];
+		return;
+	}
+
+	const struct Anim_Keyframe *a = &keys[k], *b = &keys[k + 1];
+	double u = fmin((t - a->time) / (b->time - a->time), 1);
+
+	// Zoom speed is constant on the screen
+	out->time = t;
+	out->swidth = a->swidth * pow(b->swidth / a->swidth, u);
+	out->max_steps = lround(a->max_steps + (b->max_steps - a->max_steps) * u);
+
+	// Center moves as the view shrinks, so the point zoomed
+	// into stays in place instead of sliding across the screen
+	double s = a->swidth != b->swidth
+		? (a->swidth - out->swidth) / (a->swidth - b->swidth)
+		: u;
+	struct Mb_Big big_s = mb_big_from_double(s);
+	struct Mb_Big dx = mb_big_sub(&b->xc, &a->xc);
+	struct Mb_Big dy = mb_big_sub(&b->yc, &a->yc);
+	dx = mb_big_mul(&dx, &big_s);
+	dy = mb_big_mul(&dy, &big_s);
+	out->xc = mb_big_add(&a->xc, &dx);
+	out->yc = mb_big_add(&a->yc, &dy);
+}
@@ -0,0 +1,67 @@
+#include "anim/anim.h"
+#include "common.h"
+#include <stdlib.h>
+
+void anim_queue_init(struct Anim_Queue *q, int cap)
+{
+	q->items = calloc(cap, sizeof(*q->items));
+	q->cap = cap;
+	q->head = q->count = 0;
+	q->closed = false;
+	pthread_mutex_init(&q->mutex, NULL);
+	pthread_cond_init(&q->not_empty, NULL);
+	pthread_cond_init(&q->not_full, NULL);
+}
+
+void anim_queue_destroy(struct Anim_Queue *q)
+{
+	free(q->items);
+	pthread_mutex_destroy(&q->mutex);
+	pthread_cond_destroy(&q->not_empty);
+	pthread_cond_destroy(&q->not_full);
+}
+
+void anim_queue_push(struct Anim_Queue *q, void *item, double *wait_ms)
+{
+	pthread_mutex_lock(&q->mutex);
+	if (q->count == q->cap) {
+		double begin = wall_time_ms();
+		while (q->count == q->cap)
+			pthread_cond_wait(&q->not_full, &q->mutex);
+		*wait_ms += wall_time_ms() - begin;
+	}
+
+	q->items[(q->head + q->count) % q->cap] = item;
+	q->count++;
+	pthread_cond_signal(&q->not_empty);
+	pthread_mutex_unlock(&q->mutex);
+}
+
+void *anim_queue_pop(struct Anim_Queue *q, double *wait_ms)
+{
+	pthread_mutex_lock(&q->mutex);
+	if (q->count == 0 && !q->closed) {
+		double begin = wall_time_ms();
+		while (q->count == 0 && !q->closed)
+			pthread_cond_wait(&q->not_empty, &q->mutex);
+		*wait_ms += wall_time_ms() - begin;
+	}
+
+	void *item = NULL;
+	if (q->count) {
+		item = q->items[q->head];
+		q->head = (q->head + 1) % q->cap;
+		q->count--;
+		pthread_cond_signal(&q->not_full);
+	}
+	pthread_mutex_unlock(&q->mutex);
+	return item;
+}
+
+void anim_queue_close(struct Anim_Queue *q)
+{
+	pthread_mutex_lock(&q->mutex);
+	q->closed = true;
+	pthread_cond_broadcast(&q->not_empty);
+	pthread_mutex_unlock(&q->mutex);
+}
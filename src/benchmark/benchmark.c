@@ -2,6 +2,14 @@
 
 #include "common.h"
 #include "gen/api.h"
+#include "render/api.h"
+#include "benchmark/scenes.h"
+#include "benchmark/counters.h"
+#include "benchmark/topology.h"
+#include "benchmark/stats.h"
+#include "benchmark/compare.h"
+#include "benchmark/verify.h"
+#include <errno.h>
 #include <string.h>
 #include <math.h>
 #include <stdbool.h>
@@ -13,26 +21,473 @@
 #define PLOT_WIDTH 4 // 4 omega
 #define SPLIT 16
 
+/// Longest thread count list of the sweep, and most CPUs to pin to
+#define MAX_SWEEP 256
+#define MAX_CPUS 1024
+
 #define PLOT_ROWS 7
 #define PLOT_COLS (PLOT_WIDTH * SPLIT * 2 + 1)
 
+/// Runs which are not counted, caches and branch predictors warm up
+#define WARMUP_RUNS 3
+
+/// Bootstrap resamples while deciding if to stop, and for the result
+#define CHECK_RESAMPLES 200
+#define RESULT_RESAMPLES 2000
+
+/// When measurement is good enough
+struct StopRule {
+	int min_samples;
+	int max_runs;
+	float max_variation;    // old rule: last `min_samples` have max <= min * this
+	float precision;        // otherwise: CI of median within median * (1 ± this)
+};
+
+struct Measurement {
+	int runs;               // with warmup ones
+	int first;              // samples are runs [first, runs)
+	int samples;
+	bool converged;         // else stopped by `max_runs`
+	// Every run, `max_runs` of them: wall time of frames,
+	// and CPU time and TSC ticks of all threads
+	float *times;
+	float *cpu_times;
+	uint64_t *cycles;
+	double *counter_runs;   // BENCH_COUNTERS per run, if counters are on
+	float *imbalance;       // busiest thread time / average thread time
+
+	float avg, dev, min;
+	float median, mad, ci_low, ci_high;
+	double avg_cpu, avg_cycles;
+	double counters[BENCH_COUNTERS];    // averages, NAN if not measured
+	float avg_imbalance;
+	uint64_t iterations;    // per frame, all frames are the same
+	uint64_t lane_slots;
+};
+
+/// Where results go, if anywhere
+struct Output {
+	FILE *file;
+	bool json;
+	int rows;
+};
+
 static void init_gdata(struct Mb_GeneratorData *gdata)
 {
 	gdata->xc = gdata->yc = 0;
+	gdata->has_hp_center = false;
+	gdata->stats = NULL;
+	gdata->cancel = NULL;
 	gdata->swidth = 2;
 	gdata->bwidth = WIN_WIDTH;
 	gdata->bheight = WIN_HEIGHT;
-	gdata->exit_steps = aligned_alloc(
-			32, gdata->bwidth * gdata->bheight * sizeof(*gdata->exit_steps)
-	);
+	gdata->exit_steps = NULL;
+	gdata->format = MB_STEPS_I32;
 	gdata->max_steps = 255;
+	gdata->options = 0;
+	gdata->rect = mb_full_rect(gdata);
+}
+
+static void apply_scene(struct Mb_GeneratorData *gdata, const struct Bench_Scene *scene)
+{
+	gdata->xc = scene->xc;
+	gdata->yc = scene->yc;
+	gdata->swidth = scene->swidth;
+	gdata->max_steps = scene->max_steps;
+}
+
+static int find_scene(const char *name)
+{
+	for (int i = 0; i < ARRAY_SIZE(scenes); ++i)
+		if (strcmp(scenes[i].name, name) == 0)
+			return i;
+	return -1;
+}
+
+/// Parses comma-separated list of names into indices, `find`
+/// gives index of a name. Returns number of them, -1 if some
+/// name is unknown, it is then put in `bad`.
+static int parse_list(
+		const char *str, int (*find)(const char *name),
+		int *out, int max, char *bad, size_t bad_size
+)
+{
+	int count = 0;
+	while (*str && count < max) {
+		size_t len = strcspn(str, ",");
+		snprintf(bad, bad_size, "%.*s", (int) len, str);
+		int idx = find(bad);
+		if (idx < 0)
+			return -1;
+		out[count++] = idx;
+		str += len;
+		if (*str == ',')
+			++str;
+	}
+	return count;
+}
+
+/// Parses comma-separated list of non-negative numbers and ranges
+/// like `1,2,4-8`. Returns number of them, -1 if list is malformed.
+static int parse_ranges(const char *str, int *out, int max)
+{
+	int count = 0;
+	while (*str) {
+		char *end;
+		long from = strtol(str, &end, 10), to = from;
+		if (end == str || from < 0)
+			return -1;
+		if (*end == '-') {
+			str = end + 1;
+			to = strtol(str, &end, 10);
+			if (end == str || to < from)
+				return -1;
+		}
+		for (long i = from; i <= to; ++i) {
+			if (count == max)
+				return -1;
+			out[count++] = i;
+		}
+		str = end;
+		if (*str == ',')
+			++str;
+		else if (*str)
+			return -1;
+	}
+	return count;
+}
+
+// How much longer the busiest thread worked than an average one
+static float thread_imbalance(
+		const struct Mb_PoolTimes *begin, const struct Mb_PoolTimes *end, int n
+)
+{
+	double max = 0, sum = 0;
+	for (int i = 0; i < n; ++i) {
+		double busy = end[i].tsc_cycles - begin[i].tsc_cycles;
+		max = fmax(max, busy);
+		sum += busy;
+	}
+	return sum > 0 ? max / (sum / n) : 1;
+}
+
+// Tells if samples [first, runs) are good enough, verbose report of it
+static bool is_stable(
+		const struct Measurement *m, const struct StopRule *rule,
+		int first, int runs, char *report, size_t report_size
+)
+{
+	const float *x = m->times + first;
+	int n = runs - first;
+
+	if (rule->max_variation) {
+		float minv = INFINITY, maxv = -INFINITY;
+		for (int i = 0; i < n; ++i) {
+			minv = fminf(minv, x[i]);
+			maxv = fmaxf(maxv, x[i]);
+		}
+		snprintf(
+			report, report_size, "In last %-4d runs -- min %-8.2f, max %-8.2f -- var %-5.4f",
+			n, minv, maxv, maxv / minv
+		);
+		return n >= rule->min_samples && minv * rule->max_variation >= maxv;
+	}
+
+	if (n < rule->min_samples) {
+		snprintf(report, report_size, "%d of %d samples", n, rule->min_samples);
+		return false;
+	}
+
+	float median = bench_median(x, n), low, high;
+	bench_median_ci(x, n, CHECK_RESAMPLES, &low, &high);
+	float precision = fmaxf(median - low, high - median) / median;
+	snprintf(
+		report, report_size, "%-4d samples -- median %-8.3f, CI ±%.2f%%",
+		n, median, precision * 100
+	);
+	return precision <= rule->precision;
+}
+
+static void measure(
+		struct Measurement *m,
+		struct Mb_Pool *pool,
+		const struct Mb_Renderer *renderer,
+		const struct Mb_Generator *generator,
+		struct Mb_GeneratorData *gdata,
+		const struct Bench_Counters *counters,
+		const struct StopRule *rule,
+		bool verbose
+)
+{
+	double counters_begin[BENCH_COUNTERS], counters_end[BENCH_COUNTERS];
+	int nthreads = mb_pool_threads(pool);
+	struct Mb_PoolTimes workers_begin[nthreads], workers_end[nthreads];
+
+	struct Mb_GenStats stats;
+	gdata->stats = &stats;
+	gdata->rect = mb_full_rect(gdata);
+
+	bool ok = false;
+	int runs = 0, first = WARMUP_RUNS;
+	char report[128] = "warmup";
+
+	// Bootstrap is much slower than small frames, so CI is checked every few runs
+	int check_every = rule->max_variation ? 1 : rule->min_samples / 4 + 1;
+
+	for (; !ok && runs < rule->max_runs; ++runs) {
+		stats.lane_slots = 0;
+		if (counters)
+			bench_counters_read(counters, counters_begin);
+		struct Mb_PoolTimes pool_begin = mb_pool_times(pool);
+		mb_pool_worker_times(pool, workers_begin);
+		double begin = wall_time_ms();
+		renderer->render(pool, generator, gdata);
+		float this_time = wall_time_ms() - begin;
+		struct Mb_PoolTimes pool_end = mb_pool_times(pool);
+		mb_pool_worker_times(pool, workers_end);
+		if (counters) {
+			bench_counters_read(counters, counters_end);
+			for (int k = 0; k < BENCH_COUNTERS; ++k)
+				m->counter_runs[runs * BENCH_COUNTERS + k] = counters_end[k] - counters_begin[k];
+		}
+
+		m->times[runs] = this_time;
+		m->cpu_times[runs] = pool_end.cpu_ms - pool_begin.cpu_ms;
+		m->cycles[runs] = pool_end.tsc_cycles - pool_begin.tsc_cycles;
+		m->imbalance[runs] = thread_imbalance(workers_begin, workers_end, nthreads);
+
+		// The old rule looks only at the last runs
+		if (rule->max_variation && runs + 1 - rule->min_samples > first)
+			first = runs + 1 - rule->min_samples;
+
+		// Until there are enough samples, is_stable only counts them,
+		// so the report is refreshed every run
+		int n = runs + 1 - first;
+		if (n > 0 && (n % check_every == 0 || n < rule->min_samples))
+			ok = is_stable(m, rule, first, runs + 1, report, sizeof(report));
+
+		if (verbose)
+			printf(
+					"Run %-4d -- time is %-8.4f, cpu %-8.2f. %s\n",
+					runs, this_time, m->cpu_times[runs], report
+			);
+		if (ok && verbose)
+			printf("The thing is stable enough\n");
+	}
+	gdata->stats = NULL;
+
+	// With too few runs for warmup, everything is counted
+	if (first >= runs)
+		first = 0;
+
+	m->runs = runs;
+	m->first = first;
+	m->samples = runs - first;
+	m->converged = ok;
+
+	const float *x = m->times + first;
+	int n = m->samples;
+	m->median = bench_median(x, n);
+	m->mad = bench_mad(x, n, m->median);
+	bench_median_ci(x, n, RESULT_RESAMPLES, &m->ci_low, &m->ci_high);
+
+	m->avg = m->dev = 0;
+	m->min = INFINITY;
+	m->avg_cpu = m->avg_cycles = 0;
+	m->avg_imbalance = 0;
+	for (int i = first; i < runs; ++i) {
+		m->avg += m->times[i];
+		m->min = fminf(m->min, m->times[i]);
+		m->avg_cpu += m->cpu_times[i];
+		m->avg_cycles += m->cycles[i];
+		m->avg_imbalance += m->imbalance[i];
+	}
+	m->avg /= n;
+	m->avg_imbalance /= n;
+	m->avg_cpu /= n;
+	m->avg_cycles /= n;
+
+	for (int k = 0; k < BENCH_COUNTERS; ++k) {
+		m->counters[k] = counters ? 0 : NAN;
+		for (int i = first; counters && i < runs; ++i)
+			m->counters[k] += m->counter_runs[i * BENCH_COUNTERS + k] / n;
+	}
+
+	for (int i = first; i < runs; ++i)
+		m->dev += powf(m->times[i] - m->avg, 2);
+	m->dev /= n;
+	m->dev = sqrtf(m->dev);
+
+	// Work of the frame, so views with different amount
+	// of iterations can be compared
+	m->iterations = 0;
+	for (int i = 0; i < gdata->bwidth * gdata->bheight; ++i)
+		m->iterations += mb_steps_get(gdata->exit_steps, gdata->format, i);
+	m->lane_slots = stats.lane_slots;
+}
+
+static void output_begin(struct Output *out)
+{
+	if (out->json) {
+		fprintf(out->file, "[\n");
+		return;
+	}
+	fprintf(
+		out->file,
+		"build,generator,scene,x,y,width,max_steps,frame_width,frame_height,"
+		"threads,placement,renderer,format,options,runs,samples,converged,"
+		"median_ms,mad_ms,ci_low_ms,ci_high_ms,avg_ms,dev_ms,min_ms,cpu_ms,"
+		"tsc_cycles,iterations,iterations_per_s,cycles_per_iteration,imbalance,ipc"
+	);
+	for (int k = 0; k < BENCH_COUNTERS; ++k)
+		fprintf(out->file, ",%s", bench_counter_names[k]);
+	fprintf(out->file, "\n");
+}
+
+// Counters which were not measured are empty in CSV and null in JSON
+static void output_counter(struct Output *out, const char *name, double value)
+{
+	if (out->json && isnan(value))
+		fprintf(out->file, ", \"%s\": null", name);
+	else if (out->json)
+		fprintf(out->file, ", \"%s\": %.17g", name, value);
+	else if (isnan(value))
+		fprintf(out->file, ",");
+	else
+		fprintf(out->file, ",%.17g", value);
+}
+
+static void output_row(
+		struct Output *out, const char *build,
+		const char *generator, const char *scene,
+		const struct Mb_GeneratorData *gdata,
+		int threads, const char *placement, const char *renderer, const char *format,
+		const struct Measurement *m
+)
+{
+	// Options are joined with `+`, commas would split CSV fields
+	char options[128] = "";
+	for (int i = 0; i < ARRAY_SIZE(gen_options); ++i)
+		if (gdata->options & gen_options[i].flag)
+			snprintf(
+				options + strlen(options), sizeof(options) - strlen(options),
+				"%s%s", options[0] ? "+" : "", gen_options[i].name
+			);
+
+	double iter_per_s = m->iterations / (m->median / 1000);
+	double cycles_per_iter = m->avg_cycles / m->iterations;
+
+	if (out->json) {
+		fprintf(
+			out->file,
+			"%s  {\"build\": \"%s\", \"generator\": \"%s\", \"scene\": \"%s\", "
+			"\"x\": %.17g, \"y\": %.17g, \"width\": %.17g, \"max_steps\": %d, "
+			"\"frame_width\": %d, \"frame_height\": %d, \"threads\": %d, "
+			"\"placement\": \"%s\", \"renderer\": \"%s\", \"format\": \"%s\", \"options\": \"%s\", "
+			"\"runs\": %d, \"samples\": %d, \"converged\": %s, "
+			"\"median_ms\": %f, \"mad_ms\": %f, \"ci_low_ms\": %f, \"ci_high_ms\": %f, "
+			"\"avg_ms\": %f, \"dev_ms\": %f, \"min_ms\": %f, "
+			"\"cpu_ms\": %f, \"tsc_cycles\": %.0f, \"iterations\": %lu, "
+			"\"iterations_per_s\": %.0f, \"cycles_per_iteration\": %f, \"imbalance\": %f",
+			out->rows ? ",\n" : "", build, generator, scene,
+			gdata->xc, gdata->yc, gdata->swidth, gdata->max_steps,
+			gdata->bwidth, gdata->bheight, threads, placement, renderer, format, options,
+			m->runs, m->samples, m->converged ? "true" : "false",
+			m->median, m->mad, m->ci_low, m->ci_high,
+			m->avg, m->dev, m->min, m->avg_cpu, m->avg_cycles,
+			(unsigned long) m->iterations, iter_per_s, cycles_per_iter, m->avg_imbalance
+		);
+	} else {
+		fprintf(
+			out->file,
+			"%s,%s,%s,%.17g,%.17g,%.17g,%d,%d,%d,%d,%s,%s,%s,%s,%d,%d,%s,%f,%f,%f,%f,%f,%f,%f,%f,%.0f,%lu,%.0f,%f,%f",
+			build, generator, scene,
+			gdata->xc, gdata->yc, gdata->swidth, gdata->max_steps,
+			gdata->bwidth, gdata->bheight, threads, placement, renderer, format, options,
+			m->runs, m->samples, m->converged ? "true" : "false",
+			m->median, m->mad, m->ci_low, m->ci_high,
+			m->avg, m->dev, m->min, m->avg_cpu, m->avg_cycles,
+			(unsigned long) m->iterations, iter_per_s, cycles_per_iter, m->avg_imbalance
+		);
+	}
+
+	output_counter(out, "ipc", m->counters[BENCH_INSTRUCTIONS] / m->counters[BENCH_CYCLES]);
+	for (int k = 0; k < BENCH_COUNTERS; ++k)
+		output_counter(out, bench_counter_names[k], m->counters[k]);
+	fprintf(out->file, out->json ? "}" : "\n");
+
+	out->rows++;
+	fflush(out->file);
+}
+
+static void output_end(struct Output *out)
+{
+	if (out->json)
+		fprintf(out->file, "%s]\n", out->rows ? "\n" : "");
+	fclose(out->file);
+}
+
+/// Parses comma-separated list of generator option names
+static bool parse_options(const char *str, unsigned *options)
+{
+	*options = 0;
+	while (*str) {
+		size_t len = strcspn(str, ",");
+		bool found = false;
+		for (int i = 0; i < ARRAY_SIZE(gen_options); ++i) {
+			if (strlen(gen_options[i].name) == len
+					&& strncmp(gen_options[i].name, str, len) == 0) {
+				*options |= gen_options[i].flag;
+				found = true;
+			}
+		}
+		if (!found)
+			return false;
+		str += len;
+		if (*str == ',')
+			++str;
+	}
+	return true;
+}
+
+/// Creates pool, pins it to first `threads` of `cpus` if they are given,
+/// and opens counters on its threads if they are on. If counters can not
+/// be opened, they are turned off.
+static struct Mb_Pool *start_pool(
+		int threads, const int *cpus,
+		struct Bench_Counters *counters, bool *use_counters
+)
+{
+	struct Mb_Pool *pool = mb_pool_create(threads);
+	if (cpus && !mb_pool_pin(pool, cpus)) {
+		printf("Failed to pin threads to CPUs\n");
+		mb_pool_destroy(pool);
+		return NULL;
+	}
+
+	if (*use_counters) {
+		int tids[threads];
+		char err[128];
+		mb_pool_thread_ids(pool, tids);
+		if (!bench_counters_open(counters, tids, threads, err, sizeof(err))) {
+			printf("Performance counters are not available: %s\n", err);
+			*use_counters = false;
+		}
+	}
+	return pool;
 }
 
 void print_usage(const char *name)
 {
 	printf(
-			"Usage: %s -g GENERATOR_NAME [-m MEASURE_WIN_W]"
-			" [-v MAX_VARIATION] [-h]\n", name
+			"Usage: %s -g GENERATOR_NAME [-S SCENE] [-m MEASURE_WIN_W]"
+			" [-v MAX_VARIATION] [-t THREADS] [-r RENDERER] [-o OPTIONS]\n"
+			"       [-f FORMAT] [-W PIXELS] [-H PIXELS] [-x X] [-y Y] [-w WIDTH]\n"
+			"       [-s MAX_STEPS] [-O FILE] [-b BUILD] [-P] [-T THREAD_COUNTS]\n"
+			"       [-p PLACEMENT] [-c CPUS] [-h]\n"
+			"       %s -A [-g GENERATORS] [-S SCENES] [OTHER OPTIONS]\n"
+			"       %s -V [-g GENERATORS] [-S SCENES] [OTHER OPTIONS]\n"
+			"       %s -C OLD_RESULTS NEW_RESULTS [-R THRESHOLD]\n", name, name, name, name
 	);
 	printf(
 			"  -h                 Prints this help message\n"
@@ -40,36 +495,209 @@ void print_usage(const char *name)
 			"                     Currently availiable: "
 	);
 	for (int i = 0; i < ARRAY_SIZE(generators); ++i)
-		printf("%s ", generators[i].name);
+		if (mb_generator_supported(i))
+			printf("%s ", generators[i].name);
 	printf(
 			"\n"
-			"  -m MEASURE_WIN_W   Number of measurements to average in the result\n"
-			"  -v MAX_VARIATION   Maximum relative difference in time between min\n"
-			"                     and max time to say what measuremenets are stable\n"
+			"  -S SCENE           View to measure, `%s` by default: ", scenes[DEFAULT_SCENE].name
+	);
+	for (int i = 0; i < ARRAY_SIZE(scenes); ++i)
+		printf("%s ", scenes[i].name);
+	printf(
+			"\n"
+			"  -A                 Measure every generator on every scene, or the\n"
+			"                     comma-separated ones given in `-g` and `-S`\n"
+			"  -V                 Instead of measuring, check that `mariani-silver`\n"
+			"                     gives the same frames as generators called for the\n"
+			"                     whole frame, and that deepening frames of avx2-fma*\n"
+			"                     and avx512-fma* from the scene's limit to 4 times it\n"
+			"                     gives their direct frames. Same lists as with `-A`,\n"
+			"                     `simple` if no `-g`. Exits with 1 if some pixels differ\n"
+			"  -m MEASURE_WIN_W   Least number of measurements in the result, 32 by default\n"
+			"  -e PRECISION       Measure until 95%% confidence interval of the median\n"
+			"                     is within median * (1 ± PRECISION), 0.01 by default\n"
+			"  -M MAX_RUNS        Stop after this many runs even if results are not\n"
+			"                     precise enough, 1000 by default\n"
+			"  -v MAX_VARIATION   Instead of `-e`, stop when in last MEASURE_WIN_W runs\n"
+			"                     max time <= min time * MAX_VARIATION\n"
+			"  -t THREADS         Number of threads to render with, 1 by default,\n"
+			"                     0 for all CPUs\n"
+			"  -r RENDERER        How to split the frame between generator calls,\n"
+			"                     `%s` by default. Availiable: ", renderers[DEFAULT_RENDERER].name
+	);
+	for (int i = 0; i < ARRAY_SIZE(renderers); ++i)
+		printf("%s ", renderers[i].name);
+	printf(
+			"\n"
+			"  -o OPTIONS         Comma-separated generator options: "
+	);
+	for (int i = 0; i < ARRAY_SIZE(gen_options); ++i)
+		printf("%s ", gen_options[i].name);
+	printf(
+			"\n"
+			"  -f FORMAT          Type of step counts, `i32` by default: "
+	);
+	for (int i = 0; i < ARRAY_SIZE(steps_formats); ++i)
+		printf("%s ", steps_formats[i].name);
+	printf(
+			"\n"
+			"  -W PIXELS          Width of the frame, %d by default\n"
+			"  -H PIXELS          Height of the frame, %d by default\n"
+			"  -x X, -y Y         Center of the view, overrides the scene\n"
+			"  -w WIDTH           Width of the view, overrides the scene\n"
+			"  -s MAX_STEPS       Iteration limit, overrides the scene\n"
+			"  -O FILE            Also write results to FILE, as JSON if it ends\n"
+			"                     with `.json`, as CSV otherwise\n"
+			"  -b BUILD           Name of this build for the results, like `gcc-o2`\n"
+			"  -P                 Also measure hardware performance counters\n"
+			"  -T THREAD_COUNTS   Measure with each of these numbers of threads,\n"
+			"                     like `1,2,4` or `1-8`, `all` for 1 to all CPUs\n"
+			"  -p PLACEMENT       Pin threads to CPUs: `none` (by default), `compact`\n"
+			"                     fills hyperthreads of a core first, `spread` takes\n"
+			"                     one thread per core first\n"
+			"  -c CPUS            Pin threads to these CPUs in this order, like `0,2,4-7`\n"
+			"  -C OLD_RESULTS     Compare files written by `-O`, exits with 1 if new\n"
+			"                     results have regressions\n"
+			"  -R THRESHOLD       Relative slowdown which is a regression, 0.02 by default\n",
+			WIN_WIDTH, WIN_HEIGHT
 	);
 }
 
 int main(int argc, char **argv)
 {
 
-	int measure_window = 32;
-	float acceptable_var = 1.05;
-	const char *gen_name = NULL;
+	struct StopRule rule = {
+		.min_samples = 32,
+		.max_runs = 1000,
+		.max_variation = 0,
+		.precision = 0.01,
+	};
+	const char *compare = NULL;
+	float regression = 0.02;
+	const char *gen_names = NULL;
+	const char *scene_names = NULL;
+	bool suite = false;
+	bool verify = false;
+	bool use_counters = false;
+	const char *sweep = NULL;
+	enum Bench_Placement placement = BENCH_UNPINNED;
+	const char *cpu_list = NULL;
+	int threads = 1;
+	unsigned options = 0;
+	const char *renderer_name = renderers[DEFAULT_RENDERER].name;
+	const char *format_name = "i32";
+	const char *out_path = NULL;
+	const char *build = "";
+	double x = NAN, y = NAN, swidth = NAN;
+	int max_steps = 0;
+	struct Mb_GeneratorData gdata;
+	init_gdata(&gdata);
 
 	int opt;
-	while ((opt = getopt(argc, argv, "g:m:v:h")) != -1) {
+	while ((opt = getopt(argc, argv, "g:S:AVm:v:e:M:C:R:t:r:o:f:W:H:x:y:w:s:O:b:PT:p:c:h")) != -1) {
 		switch (opt) {
 		case 'h':
 			print_usage(argv[0]);
 			return 0;
 		case 'g':
-			gen_name = optarg;
+			gen_names = optarg;
+			break;
+		case 'S':
+			scene_names = optarg;
+			break;
+		case 'A':
+			suite = true;
+			break;
+		case 'V':
+			verify = true;
 			break;
 		case 'm':
-			measure_window = atoi(optarg);
+			rule.min_samples = atoi(optarg);
 			break;
 		case 'v':
-			acceptable_var = atof(optarg);
+			rule.max_variation = atof(optarg);
+			if (isnan(rule.max_variation) || isinf(rule.max_variation) || rule.max_variation < 1) {
+				printf("Acceptable variation must be float number which is > 1\n");
+				return -1;
+			}
+			break;
+		case 'e':
+			rule.precision = atof(optarg);
+			if (!(rule.precision > 0)) {
+				printf("`-e` expects a positive number\n");
+				return -1;
+			}
+			break;
+		case 'M':
+			rule.max_runs = atoi(optarg);
+			break;
+		case 'C':
+			compare = optarg;
+			break;
+		case 'R':
+			regression = atof(optarg);
+			break;
+		case 't':
+			threads = atoi(optarg);
+			break;
+		case 'r':
+			renderer_name = optarg;
+			break;
+		case 'o':
+			if (!parse_options(optarg, &options)) {
+				printf("Unknown generator option in `%s`\n", optarg);
+				return -1;
+			}
+			break;
+		case 'f':
+			format_name = optarg;
+			break;
+		case 'W':
+			gdata.bwidth = atoi(optarg);
+			break;
+		case 'H':
+			gdata.bheight = atoi(optarg);
+			break;
+		case 'x':
+			x = atof(optarg);
+			break;
+		case 'y':
+			y = atof(optarg);
+			break;
+		case 'w':
+			swidth = atof(optarg);
+			break;
+		case 's':
+			max_steps = atoi(optarg);
+			if (max_steps <= 0) {
+				printf("Iteration limit must be positive\n");
+				return -1;
+			}
+			break;
+		case 'O':
+			out_path = optarg;
+			break;
+		case 'b':
+			build = optarg;
+			break;
+		case 'P':
+			use_counters = true;
+			break;
+		case 'T':
+			sweep = optarg;
+			break;
+		case 'p':
+			placement = BENCH_PLACEMENTS;
+			for (int i = 0; i < BENCH_CPU_LIST; ++i)
+				if (strcmp(bench_placement_names[i], optarg) == 0)
+					placement = i;
+			if (placement == BENCH_PLACEMENTS) {
+				printf("There is no placement named `%s`\n", optarg);
+				return -1;
+			}
+			break;
+		case 'c':
+			cpu_list = optarg;
 			break;
 		default:
 			printf("Unknown option `%c`\n", opt);
@@ -77,96 +705,426 @@ int main(int argc, char **argv)
 		}
 	}
 
-	if (!gen_name) {
+	if (compare) {
+		if (optind != argc - 1) {
+			printf("`-C` expects old and new results files\n");
+			return -1;
+		}
+		int regressions = bench_compare(compare, argv[optind], regression);
+		return regressions == 0 ? 0 : 1;
+	}
+
+	int gen_list[ARRAY_SIZE(generators)];
+	int ngens = ARRAY_SIZE(generators);
+	char bad[64];
+	if (!gen_names && !suite && !verify) {
 		printf("Please chose a generator name, you can see list of them in `-h`\n");
 		return -1;
 	}
+	if (gen_names) {
+		ngens = parse_list(gen_names, mb_find_generator, gen_list, ARRAY_SIZE(gen_list), bad, sizeof(bad));
+		if (ngens < 0) {
+			printf("There is no generator named `%s` or the CPU does not support it\n", bad);
+			return -1;
+		}
+	} else if (verify) {
+		ngens = 1;
+		gen_list[0] = mb_find_generator("simple");
+	} else {
+		ngens = 0;
+		for (int i = 0; i < ARRAY_SIZE(generators); ++i)
+			if (mb_generator_supported(i))
+				gen_list[ngens++] = i;
+	}
 
-	void (*mandelbrot)(struct Mb_GeneratorData *gdata) = NULL;
-	for (int i = 0; i < ARRAY_SIZE(generators); ++i)
-		if (strcmp(generators[i].name, gen_name) == 0)
-			mandelbrot = generators[i].mandelbrot;
+	int scene_list[ARRAY_SIZE(scenes)];
+	int nscenes = 1;
+	scene_list[0] = DEFAULT_SCENE;
+	if (scene_names) {
+		nscenes = parse_list(scene_names, find_scene, scene_list, ARRAY_SIZE(scene_list), bad, sizeof(bad));
+		if (nscenes < 0) {
+			printf("There is no scene named `%s`\n", bad);
+			return -1;
+		}
+	} else if (suite || verify) {
+		nscenes = ARRAY_SIZE(scenes);
+		for (int i = 0; i < nscenes; ++i)
+			scene_list[i] = i;
+	}
+
+	if (!suite && !verify && (ngens != 1 || nscenes != 1)) {
+		printf("Several generators or scenes can be measured only with `-A`\n");
+		return -1;
+	}
 
-	if (!mandelbrot) {
-		printf("There is no generator named `%s`\n", gen_name);
+	int renderer = -1;
+	for (int i = 0; i < ARRAY_SIZE(renderers); ++i)
+		if (strcmp(renderers[i].name, renderer_name) == 0)
+			renderer = i;
+	if (renderer < 0) {
+		printf("There is no renderer named `%s`\n", renderer_name);
 		return -1;
 	}
 
-	if (measure_window <= 1) {
+	if (rule.min_samples <= 1) {
 		printf("`-m` expects a positive integer number\n");
 		return -1;
 	}
 
-	if (isnan(acceptable_var) || isinf(acceptable_var) || acceptable_var < 1) {
-		printf("Acceptable variation must be float number which is > 1\n");
+	if (rule.max_runs < rule.min_samples + WARMUP_RUNS) {
+		printf("`-M` must be at least `-m` plus %d warmup runs\n", WARMUP_RUNS);
 		return -1;
 	}
 
-	struct Mb_GeneratorData gdata;
-	init_gdata(&gdata);
+	if (threads < 0) {
+		printf("`-t` expects a non-negative integer number\n");
+		return -1;
+	}
+	if (threads == 0)
+		threads = mb_cpu_count();
 
-	float *times = calloc(measure_window, sizeof(*times));
+	int thread_counts[MAX_SWEEP] = { threads };
+	int nthread_counts = 1;
+	if (sweep && strcmp(sweep, "all") == 0) {
+		nthread_counts = mb_cpu_count() < MAX_SWEEP ? mb_cpu_count() : MAX_SWEEP;
+		for (int i = 0; i < nthread_counts; ++i)
+			thread_counts[i] = i + 1;
+	} else if (sweep) {
+		nthread_counts = parse_ranges(sweep, thread_counts, MAX_SWEEP);
+		for (int i = 0; i < nthread_counts; ++i)
+			if (thread_counts[i] == 0)
+				nthread_counts = -1;
+		if (nthread_counts <= 0) {
+			printf("`-T` expects a list of positive numbers like `1,2,4-8`\n");
+			return -1;
+		}
+	}
 
-	printf("## Starting benchmark\n\n");
-	printf("Acceptable variation: %f\n", acceptable_var);
-	printf("Measure window width: %d\n", measure_window);
-	printf("Algorithm: %s\n", gen_name);
+	int cpus[MAX_CPUS];
+	int ncpus = 0;
+	if (cpu_list) {
+		placement = BENCH_CPU_LIST;
+		ncpus = parse_ranges(cpu_list, cpus, MAX_CPUS);
+		if (ncpus <= 0) {
+			printf("`-c` expects a list of CPUs like `0,2,4-7`\n");
+			return -1;
+		}
+	} else if (placement != BENCH_UNPINNED) {
+		ncpus = bench_cpu_order(placement, cpus, MAX_CPUS);
+	}
+	for (int i = 0; i < nthread_counts && placement != BENCH_UNPINNED; ++i) {
+		if (thread_counts[i] > ncpus) {
+			printf("Can not pin %d threads to %d CPUs\n", thread_counts[i], ncpus);
+			return -1;
+		}
+	}
 
-	printf("## Running benchmark\n\n");
+	if (swidth <= 0) {
+		printf("View width must be positive\n");
+		return -1;
+	}
+	gdata.options = options;
 
-	bool ok = false;
-	int runs = 0;
+	int format = -1;
+	for (int i = 0; i < ARRAY_SIZE(steps_formats); ++i)
+		if (strcmp(steps_formats[i].name, format_name) == 0)
+			format = i;
+	if (format < 0) {
+		printf("There is no step format named `%s`\n", format_name);
+		return -1;
+	}
+	gdata.format = steps_formats[format].format;
 
-	for (; runs < measure_window || !ok; ++runs) {
-		clock_t begin = clock();
-		mandelbrot(&gdata);
-		float this_time = (clock() - begin) * 1.0f / CLOCKS_PER_SEC * 1000;
-		times[runs % measure_window] = this_time;
+	// Scenes have their own limits, check all of them before starting
+	for (int i = 0; i < nscenes; ++i) {
+		int steps = max_steps ? max_steps : scenes[scene_list[i]].max_steps;
+		if (steps > mb_steps_max(gdata.format)) {
+			printf("`%s` can not hold %d steps\n", format_name, steps);
+			return -1;
+		}
+	}
 
-		float minv = INFINITY, maxv = -INFINITY;
-		for (int j = 0; j < measure_window; ++j) {
-			if (times[j] < minv) minv = times[j];
-			if (times[j] > maxv) maxv = times[j];
+	// Generators process up to 8 pixels at once
+	if (gdata.bwidth <= 0 || gdata.bwidth % 8 != 0 || gdata.bheight <= 0) {
+		printf("Frame width must be a positive multiple of 8, height must be positive\n");
+		return -1;
+	}
+	size_t frame_bytes = (size_t) gdata.bwidth * gdata.bheight * mb_steps_size(gdata.format);
+	gdata.exit_steps = aligned_alloc(32, (frame_bytes + 31) / 32 * 32);
+
+	if (verify) {
+		struct Mb_Pool *pool = mb_pool_create(threads);
+		if (placement != BENCH_UNPINNED && !mb_pool_pin(pool, cpus)) {
+			printf("Failed to pin threads to CPUs\n");
+			return -1;
 		}
 
-		printf(
-				"Run %-4d -- time is %-8.4f. In last %-4d runs -- min %-8.2f, max %-8.2f -- var %-5.4f\n",
-				runs, this_time, measure_window, minv, maxv, maxv / minv
-		);
-		ok = minv * acceptable_var >= maxv;
-		if (ok)
-			printf("The thing is stable enough\n");
+		int failed = 0;
+		for (int si = 0; si < nscenes; ++si) {
+			const struct Bench_Scene *scene = &scenes[scene_list[si]];
+			apply_scene(&gdata, scene);
+			if (!isnan(x)) gdata.xc = x;
+			if (!isnan(y)) gdata.yc = y;
+			if (!isnan(swidth)) gdata.swidth = swidth;
+			if (max_steps) gdata.max_steps = max_steps;
+
+			for (int gi = 0; gi < ngens; ++gi) {
+				const struct Mb_Generator *generator = &generators[gen_list[gi]];
+				long diffs = bench_verify_mariani(pool, generator, &gdata);
+				printf("%-10s %-14s %-16s ", scene->name, generator->name, "mariani-silver");
+				if (diffs)
+					printf("%ld pixels differ\n", diffs);
+				else
+					printf("ok\n");
+				failed += diffs != 0;
+
+				// Two doublings, like the viewer's first passes
+				int deep_steps = gdata.max_steps * 4 + 3;
+				if (!mb_deepens_exactly(generator) || deep_steps > mb_steps_max(gdata.format))
+					continue;
+				diffs = bench_verify_deepen(pool, generator, &gdata, deep_steps);
+				printf("%-10s %-14s %-16s ", scene->name, generator->name, "deepen");
+				if (diffs)
+					printf("%ld pixels differ\n", diffs);
+				else
+					printf("ok\n");
+				failed += diffs != 0;
+			}
+		}
+
+		mb_pool_destroy(pool);
+		free(gdata.exit_steps);
+		return failed ? 1 : 0;
 	}
-	printf("\n\n");
 
-	float avg = 0;
-	for (int i = 0; i < measure_window; ++i)
-		avg += times[i];
-	avg /= measure_window;
+	struct Output out = { 0 };
+	if (out_path) {
+		size_t len = strlen(out_path);
+		out.json = len >= 5 && strcmp(out_path + len - 5, ".json") == 0;
+		out.file = fopen(out_path, "w");
+		if (!out.file) {
+			printf("Failed to open `%s`: %s\n", out_path, strerror(errno));
+			return -1;
+		}
+		output_begin(&out);
+	}
+
+	struct Measurement m = { 0 };
+	m.times = calloc(rule.max_runs, sizeof(*m.times));
+	m.cpu_times = calloc(rule.max_runs, sizeof(*m.cpu_times));
+	m.cycles = calloc(rule.max_runs, sizeof(*m.cycles));
+	m.counter_runs = calloc(rule.max_runs * BENCH_COUNTERS, sizeof(*m.counter_runs));
+	m.imbalance = calloc(rule.max_runs, sizeof(*m.imbalance));
+
+	struct Bench_Counters counters;
+	const char *placement_name = bench_placement_names[placement];
+
+	if (suite || nthread_counts > 1) {
+		bool sweeping = nthread_counts > 1;
+		printf("## Running suite: %d generators, %d scenes, %dx%d, threads:",
+				ngens, nscenes, gdata.bwidth, gdata.bheight);
+		for (int i = 0; i < nthread_counts; ++i)
+			printf(" %d", thread_counts[i]);
+		printf(", placement %s\n\n", placement_name);
+		printf("%-10s %-14s %s%12s %10s %10s %12s%s%s\n",
+				"Scene", "Generator", sweeping ? "Threads " : "",
+				"Median, ms", "MAD, ms", "Giter/s", "Cycles/iter",
+				sweeping ? " Speedup  Eff.  Imbal." : "",
+				use_counters ? "    IPC  Br.miss/iter" : "");
 
-	float dev = 0;
-	for (int i = 0; i < measure_window; ++i)
-		dev += powf(times[i] - avg, 2);
-	dev /= measure_window;
-	dev = sqrtf(dev);
+		// Speedup is relative to the first thread count
+		float *base_time = calloc(nscenes * ngens, sizeof(*base_time));
+
+		for (int ti = 0; ti < nthread_counts; ++ti) {
+			int nthreads = thread_counts[ti];
+			struct Mb_Pool *pool = start_pool(
+				nthreads, placement != BENCH_UNPINNED ? cpus : NULL,
+				&counters, &use_counters
+			);
+			if (!pool)
+				return -1;
+
+			for (int si = 0; si < nscenes; ++si) {
+				const struct Bench_Scene *scene = &scenes[scene_list[si]];
+				apply_scene(&gdata, scene);
+				if (!isnan(x)) gdata.xc = x;
+				if (!isnan(y)) gdata.yc = y;
+				if (!isnan(swidth)) gdata.swidth = swidth;
+				if (max_steps) gdata.max_steps = max_steps;
+
+				for (int gi = 0; gi < ngens; ++gi) {
+					const struct Mb_Generator *generator = &generators[gen_list[gi]];
+					measure(
+						&m, pool, &renderers[renderer], generator, &gdata,
+						use_counters ? &counters : NULL, &rule, false
+					);
+					printf("%-10s %-14s ", scene->name, generator->name);
+					if (sweeping)
+						printf("%7d ", nthreads);
+					printf("%12.3f %10.3f %10.3f %12.3f",
+							m.median, m.mad, m.iterations / (m.median * 1e6),
+							m.avg_cycles / m.iterations);
+
+					float *base = &base_time[si * ngens + gi];
+					if (ti == 0)
+						*base = m.median;
+					if (sweeping)
+						printf(" %7.2f %5.2f %7.2f",
+								*base / m.median,
+								*base / m.median * thread_counts[0] / nthreads,
+								m.avg_imbalance);
+					if (use_counters)
+						printf(" %6.2f %13.5f",
+								m.counters[BENCH_INSTRUCTIONS] / m.counters[BENCH_CYCLES],
+								m.counters[BENCH_BRANCH_MISSES] / m.iterations);
+					printf("%s\n", m.converged ? "" : "  (not stable)");
+					if (out.file)
+						output_row(&out, build, generator->name, scene->name, &gdata,
+								nthreads, placement_name, renderer_name, format_name, &m);
+				}
+			}
+
+			if (use_counters)
+				bench_counters_close(&counters);
+			mb_pool_destroy(pool);
+		}
+
+		if (out.file)
+			output_end(&out);
+		free(base_time);
+		free(gdata.exit_steps);
+		free(m.times);
+		free(m.cpu_times);
+		free(m.cycles);
+		free(m.counter_runs);
+		free(m.imbalance);
+		return 0;
+	}
+
+	threads = thread_counts[0];
+	struct Mb_Pool *pool = start_pool(
+		threads, placement != BENCH_UNPINNED ? cpus : NULL,
+		&counters, &use_counters
+	);
+	if (!pool)
+		return -1;
+
+	const struct Bench_Scene *scene = &scenes[scene_list[0]];
+	apply_scene(&gdata, scene);
+	if (!isnan(x)) gdata.xc = x;
+	if (!isnan(y)) gdata.yc = y;
+	if (!isnan(swidth)) gdata.swidth = swidth;
+	if (max_steps) gdata.max_steps = max_steps;
+
+	int gen_idx = gen_list[0];
+	const struct Mb_Generator *generator = &generators[gen_idx];
+
+	printf("## Starting benchmark\n\n");
+	if (rule.max_variation)
+		printf("Acceptable variation: %f\n", rule.max_variation);
+	else
+		printf("Acceptable CI of median: ±%.2f%%\n", rule.precision * 100);
+	printf("Samples: at least %d, at most %d runs\n", rule.min_samples, rule.max_runs);
+	printf("Algorithm: %s\n", generator->name);
+	printf("Precision: %s\n", precision_names[generator->precision]);
+	for (int i = 0; i < ARRAY_SIZE(isa_names); ++i)
+		if (isa_names[i].isa == generator->isa)
+			printf("Instruction set: %s\n", isa_names[i].name);
+	printf("Threads: %d\n", threads);
+	printf("Placement: %s\n", placement_name);
+	printf("Renderer: %s\n", renderer_name);
+	printf("Scene: %s\n", scene->name);
+	printf("View: center (%g, %g), width %g, %d steps\n", gdata.xc, gdata.yc, gdata.swidth, gdata.max_steps);
+	printf("Frame: %dx%d, %s steps, %.2f MiB\n", gdata.bwidth, gdata.bheight, format_name, frame_bytes / 1048576.0);
+	printf("Options:");
+	for (int i = 0; i < ARRAY_SIZE(gen_options); ++i)
+		if (options & gen_options[i].flag)
+			printf(" %s", gen_options[i].name);
+	printf("\n");
+
+	printf("## Running benchmark\n\n");
+
+	measure(
+		&m, pool, &renderers[renderer], generator, &gdata,
+		use_counters ? &counters : NULL, &rule, true
+	);
+	printf("\n\n");
+
+	const float *times = m.times + m.first;
+	int samples = m.samples;
+	float median = m.median;
+	// Outliers do not blow it up as std. dev.
+	// Half of times may be exactly the same though.
+	float sigma = m.mad * MAD_TO_SIGMA;
+	if (sigma == 0)
+		sigma = m.dev > 0 ? m.dev : median * 1e-3f;
 
 	printf("## Benchmark results:\n\n");
 	printf(
 			"Done %d warmup runs and %d measurment runs\n",
-			runs - measure_window, measure_window
+			m.first, samples
+	);
+	if (!m.converged)
+		printf("Warn: not stable after %d runs, results are less precise than asked\n", m.runs);
+	printf("Time median %f ms, MAD %f ms\n", median, m.mad);
+	printf(
+			"With 95%% confidence median is in [%f, %f] ms (%+.2f%% %+.2f%%)\n",
+			m.ci_low, m.ci_high,
+			(m.ci_low / median - 1) * 100, (m.ci_high / median - 1) * 100
 	);
-	printf("Time avg %f ms, std dev %f ms\n", avg, dev);
-	printf("With 𝜎 (68%% probability) time is %f ± %f ms\n", avg, dev);
-	printf("With 3𝜎 (99.73%% probability) time is %f ± %f ms\n", avg, dev*3);
+	printf("Time avg %f ms, std dev %f ms, min %f ms\n", m.avg, m.dev, m.min);
+	printf(
+			"Throughput %f Mpix/s\n",
+			gdata.bwidth * gdata.bheight / (median * 1000)
+	);
+	printf("Output bandwidth %f GB/s\n", frame_bytes / (median * 1e6));
+	printf("CPU time avg %f ms over all threads, %0.2f threads busy\n", m.avg_cpu, m.avg_cpu / m.avg);
+	printf("TSC avg %f Mcycles over all threads\n", m.avg_cycles / 1e6);
+	printf("Iterations per frame %lu\n", (unsigned long) m.iterations);
+	printf("Iterations per second %f G\n", m.iterations / (median * 1e6));
+	printf("TSC cycles per iteration %f\n", m.avg_cycles / m.iterations);
+	if (threads > 1)
+		printf("Thread imbalance %f (busiest thread time / average one)\n", m.avg_imbalance);
+
+	if (use_counters) {
+		printf("\nPerformance counters, per frame and per iteration:\n");
+		for (int k = 0; k < BENCH_COUNTERS; ++k)
+			if (!isnan(m.counters[k]))
+				printf("  %-18s %16.0f %12.5f\n", bench_counter_names[k],
+						m.counters[k], m.counters[k] / m.iterations);
+		if (!isnan(m.counters[BENCH_INSTRUCTIONS] / m.counters[BENCH_CYCLES]))
+			printf(
+					"IPC %f, core cycles per iteration %f\n",
+					m.counters[BENCH_INSTRUCTIONS] / m.counters[BENCH_CYCLES],
+					m.counters[BENCH_CYCLES] / m.iterations
+			);
+	}
+
+	// Stats are from the last run, but all of them are the same.
+	// Interior checks fill in steps which were never iterated,
+	// so then exit_steps tell nothing about lanes.
+	if (m.lane_slots && !options) {
+		printf(
+				"Lane utilization %0.2f%% (%lu useful iterations of %lu lane slots)\n",
+				m.iterations * 100.0 / m.lane_slots,
+				(unsigned long) m.iterations, (unsigned long) m.lane_slots
+		);
+	}
+
+	if (out.file) {
+		output_row(&out, build, generator->name, scene->name, &gdata, threads,
+				placement_name, renderer_name, format_name, &m);
+		output_end(&out);
+	}
 
 	//------------------------------------------------------
-	// Check for runs which are out of 3 std. dev.
-	// from average
-	
+	// Check for runs which are out of 3 robust std. dev.
+	// from median
+
 	float max_err = 0, max_outlier = 0;
 	int num_outliers = 0;
-	for (int i = 0; i < measure_window; ++i) {
-		float rel_err = fabs(times[i] - avg) / dev;
+	for (int i = 0; i < samples; ++i) {
+		float rel_err = fabs(times[i] - median) / sigma;
 		if (rel_err > 3) {
 			printf("Warn: Run %d has distance to center %f𝜎\n", i+1, rel_err);
 			max_outlier = fmax(rel_err, max_outlier);
@@ -183,7 +1141,7 @@ int main(int argc, char **argv)
 
 	if (num_outliers == 0)
 		{}
-	else if (num_outliers <= measure_window / 20)
+	else if (num_outliers <= samples / 20)
 		printf("Warn: Some values are out 3𝜎, but there are a few of them\n");
 	else
 		printf("Err: > 5%% of values are out of 3𝜎, measurement failed\n");
@@ -192,14 +1150,14 @@ int main(int argc, char **argv)
 	// The plot
 
 	printf("\nDistribution plot:\n");
-	printf("One tick = one std. dev = %f ms\n\n", dev);
+	printf("One tick = one robust std. dev (%.4f MAD) = %f ms\n\n", MAD_TO_SIGMA, sigma);
 
 	int cols[PLOT_COLS] = {0};
 
-	const float col_w = dev / SPLIT;
+	const float col_w = sigma / SPLIT;
 
-	for (int i = 0; i < measure_window; ++i) {
-		float base = times[i] - (avg - PLOT_COLS * col_w / 2);
+	for (int i = 0; i < samples; ++i) {
+		float base = times[i] - (median - PLOT_COLS * col_w / 2);
 		int at = floorf(base / col_w);
 		if (at < 0 || at >= PLOT_COLS) // out of the plot
 			continue;
@@ -229,13 +1187,20 @@ int main(int argc, char **argv)
 			printf("-");
 	}
 	printf("+-> time\n");
-	printf("%*s| avg = %f ms", 1 + SPLIT * PLOT_WIDTH, "", avg);
+	printf("%*s| median = %f ms\n", 1 + SPLIT * PLOT_WIDTH, "", median);
 
 
 	//------------------------------------------------------
 	// Cleanup
 
+	mb_pool_destroy(pool);
 	free(gdata.exit_steps);
-	free(times);
+	free(m.times);
+	free(m.cpu_times);
+	free(m.cycles);
+	free(m.counter_runs);
+	free(m.imbalance);
+	if (use_counters)
+		bench_counters_close(&counters);
 	return 0;
 }
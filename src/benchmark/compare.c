@@ -0,0 +1,254 @@
+#include "benchmark/compare.h"
+#include "common.h"
+#include <errno.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/// Longest field of a row, longest header
+#define MAX_FIELD 128
+#define MAX_COLUMNS 64
+
+struct Row {
+	char build[MAX_FIELD], generator[MAX_FIELD], scene[MAX_FIELD];
+	char renderer[MAX_FIELD], format[MAX_FIELD], options[MAX_FIELD], placement[MAX_FIELD];
+	double x, y, width;
+	double max_steps, frame_width, frame_height, threads;
+	double median, ci_low, ci_high;
+	double avg, dev;
+};
+
+struct Rows {
+	struct Row *rows;
+	int count, cap;
+};
+
+enum FieldType { STRING, NUMBER };
+
+static const struct {
+	const char *name;
+	enum FieldType type;
+	size_t offset;
+} fields[] = {
+	{ "build",        STRING, offsetof(struct Row, build) },
+	{ "generator",    STRING, offsetof(struct Row, generator) },
+	{ "scene",        STRING, offsetof(struct Row, scene) },
+	{ "renderer",     STRING, offsetof(struct Row, renderer) },
+	{ "format",       STRING, offsetof(struct Row, format) },
+	{ "options",      STRING, offsetof(struct Row, options) },
+	{ "placement",    STRING, offsetof(struct Row, placement) },
+	{ "x",            NUMBER, offsetof(struct Row, x) },
+	{ "y",            NUMBER, offsetof(struct Row, y) },
+	{ "width",        NUMBER, offsetof(struct Row, width) },
+	{ "max_steps",    NUMBER, offsetof(struct Row, max_steps) },
+	{ "frame_width",  NUMBER, offsetof(struct Row, frame_width) },
+	{ "frame_height", NUMBER, offsetof(struct Row, frame_height) },
+	{ "threads",      NUMBER, offsetof(struct Row, threads) },
+	{ "median_ms",    NUMBER, offsetof(struct Row, median) },
+	{ "ci_low_ms",    NUMBER, offsetof(struct Row, ci_low) },
+	{ "ci_high_ms",   NUMBER, offsetof(struct Row, ci_high) },
+	{ "avg_ms",       NUMBER, offsetof(struct Row, avg) },
+	{ "dev_ms",       NUMBER, offsetof(struct Row, dev) },
+};
+
+static void set_field(struct Row *row, const char *name, const char *value, size_t len)
+{
+	for (int i = 0; i < ARRAY_SIZE(fields); ++i) {
+		if (strcmp(fields[i].name, name) != 0)
+			continue;
+		char *at = (char*) row + fields[i].offset;
+		if (fields[i].type == STRING)
+			snprintf(at, MAX_FIELD, "%.*s", (int) len, value);
+		else
+			*(double*) at = len ? strtod(value, NULL) : NAN;
+	}
+}
+
+static struct Row *add_row(struct Rows *rows)
+{
+	if (rows->count == rows->cap) {
+		rows->cap = rows->cap ? rows->cap * 2 : 64;
+		rows->rows = realloc(rows->rows, rows->cap * sizeof(*rows->rows));
+	}
+	struct Row *row = &rows->rows[rows->count++];
+	memset(row, 0, sizeof(*row));
+	strcpy(row->placement, "none");
+	row->threads = 1;
+	row->median = row->ci_low = row->ci_high = NAN;
+	return row;
+}
+
+// Files from before medians were measured have only average
+static void finish_row(struct Row *row)
+{
+	if (isnan(row->median)) {
+		row->median = row->avg;
+		row->ci_low = row->avg - row->dev;
+		row->ci_high = row->avg + row->dev;
+	}
+}
+
+// Both formats are the way `-O` writes them: no quotes in CSV,
+// one flat object per line in JSON
+static bool parse_csv(char *text, struct Rows *rows)
+{
+	char *header[MAX_COLUMNS];
+	int ncolumns = 0;
+
+	char *line = strtok(text, "\n");
+	if (!line)
+		return false;
+	for (char *at = line; ncolumns < MAX_COLUMNS; ) {
+		header[ncolumns++] = at;
+		at = strchr(at, ',');
+		if (!at)
+			break;
+		*at++ = '\0';
+	}
+
+	while ((line = strtok(NULL, "\n"))) {
+		struct Row *row = add_row(rows);
+		const char *at = line;
+		for (int i = 0; i < ncolumns; ++i) {
+			size_t len = strcspn(at, ",");
+			set_field(row, header[i], at, len);
+			at += len;
+			if (*at != ',')
+				break;
+			++at;
+		}
+		finish_row(row);
+	}
+	return true;
+}
+
+static bool parse_json(char *text, struct Rows *rows)
+{
+	char *at = text;
+	while ((at = strchr(at, '{'))) {
+		struct Row *row = add_row(rows);
+		char *end = strchr(at, '}');
+		if (!end)
+			return false;
+		*end = '\0';
+
+		// "key": value, ...
+		while ((at = strchr(at, '"'))) {
+			char *key = at + 1;
+			char *key_end = strchr(key, '"');
+			if (!key_end)
+				return false;
+			*key_end = '\0';
+			char *value = key_end + 1 + strspn(key_end + 1, ": ");
+
+			size_t len;
+			if (*value == '"') {
+				++value;
+				len = strcspn(value, "\"");
+				at = value + len + (value[len] == '"');
+			} else {
+				len = strcspn(value, ", ");
+				at = value + len;
+			}
+			if (strncmp(value, "null", 4) == 0)
+				len = 0;
+			char saved = value[len];
+			value[len] = '\0';
+			set_field(row, key, value, len);
+			value[len] = saved;
+		}
+		finish_row(row);
+		at = end + 1;
+	}
+	return true;
+}
+
+static bool read_rows(const char *path, struct Rows *rows)
+{
+	FILE *f = fopen(path, "r");
+	if (!f) {
+		printf("Failed to open `%s`: %s\n", path, strerror(errno));
+		return false;
+	}
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	char *text = malloc(size + 1);
+	text[fread(text, 1, size, f)] = '\0';
+	fclose(f);
+
+	char *start = text + strspn(text, " \t\r\n");
+	bool ok = *start == '[' ? parse_json(start, rows) : parse_csv(start, rows);
+	free(text);
+	if (!ok)
+		printf("`%s` is not a results file\n", path);
+	return ok;
+}
+
+static bool same_setup(const struct Row *a, const struct Row *b)
+{
+	return strcmp(a->generator, b->generator) == 0
+		&& strcmp(a->scene, b->scene) == 0
+		&& strcmp(a->renderer, b->renderer) == 0
+		&& strcmp(a->format, b->format) == 0
+		&& strcmp(a->options, b->options) == 0
+		&& strcmp(a->placement, b->placement) == 0
+		&& a->x == b->x && a->y == b->y && a->width == b->width
+		&& a->max_steps == b->max_steps && a->threads == b->threads
+		&& a->frame_width == b->frame_width && a->frame_height == b->frame_height;
+}
+
+int bench_compare(const char *old_path, const char *new_path, float threshold)
+{
+	struct Rows old = { 0 }, new = { 0 };
+	if (!read_rows(old_path, &old) || !read_rows(new_path, &new)) {
+		free(old.rows);
+		free(new.rows);
+		return -1;
+	}
+
+	printf("## Comparing `%s` (old) with `%s` (new)\n\n", old_path, new_path);
+	printf("%-10s %-14s %7s %10s %10s %8s %17s  %s\n",
+			"Scene", "Generator", "Threads", "Old, ms", "New, ms",
+			"Speedup", "95% CI", "Verdict");
+
+	int regressions = 0, matched = 0;
+	for (int i = 0; i < new.count; ++i) {
+		const struct Row *b = &new.rows[i], *a = NULL;
+		for (int j = 0; j < old.count && !a; ++j)
+			if (same_setup(&old.rows[j], b))
+				a = &old.rows[j];
+		if (!a)
+			continue;
+		matched++;
+
+		// Conservative: ends of both intervals at once
+		double speedup = a->median / b->median;
+		double low = a->ci_low / b->ci_high;
+		double high = a->ci_high / b->ci_low;
+		bool significant = low > 1 || high < 1;
+
+		const char *verdict = "same";
+		if (significant && speedup > 1)
+			verdict = "faster";
+		else if (significant && speedup < 1 / (1 + threshold)) {
+			verdict = "REGRESSION";
+			regressions++;
+		} else if (significant)
+			verdict = "slower";
+
+		printf("%-10s %-14s %7.0f %10.3f %10.3f %8.3f   [%6.3f, %6.3f]  %s\n",
+				b->scene, b->generator, b->threads, a->median, b->median,
+				speedup, low, high, verdict);
+	}
+
+	printf("\n%d of %d new results have a pair in old ones, ", matched, new.count);
+	printf("%d regressions (slower by more than %.1f%%)\n", regressions, threshold * 100);
+
+	free(old.rows);
+	free(new.rows);
+	return regressions;
+}
@@ -0,0 +1,14 @@
+///
+/// A/B comparison of two results files written by `-O`,
+/// like two builds or code before and after a change
+///
+#ifndef I_BENCH_COMPARE
+#define I_BENCH_COMPARE
+
+/// Matches rows measured with same generator, scene and settings,
+/// prints speedup of the new ones and if it is significant. Rows which
+/// are significantly slower by more than `threshold` (relative) are
+/// regressions. Returns number of regressions, -1 if files can not be read.
+int bench_compare(const char *old_path, const char *new_path, float threshold);
+
+#endif
@@ -0,0 +1,165 @@
+#define _GNU_SOURCE
+
+#include "benchmark/counters.h"
+#include <cpuid.h>
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+struct Event {
+	uint32_t type;
+	uint64_t config;
+	bool fp_arith;      // raw Intel event, see `has_fp_arith`
+};
+
+#define CACHE_MISS(cache) \
+	((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static const struct Event events[BENCH_COUNTERS] = {
+	[BENCH_CYCLES]           = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+	[BENCH_INSTRUCTIONS]     = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+	[BENCH_BRANCH_MISSES]    = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+	[BENCH_L1D_MISSES]       = { PERF_TYPE_HW_CACHE, CACHE_MISS(PERF_COUNT_HW_CACHE_L1D) },
+	[BENCH_LLC_MISSES]       = { PERF_TYPE_HW_CACHE, CACHE_MISS(PERF_COUNT_HW_CACHE_LL) },
+	// FP_ARITH_INST_RETIRED, event 0xC7 with umask per width
+	[BENCH_FP_SCALAR_SINGLE] = { PERF_TYPE_RAW, 0x02c7, true },
+	[BENCH_FP_SCALAR_DOUBLE] = { PERF_TYPE_RAW, 0x01c7, true },
+	[BENCH_FP_256_SINGLE]    = { PERF_TYPE_RAW, 0x20c7, true },
+	[BENCH_FP_256_DOUBLE]    = { PERF_TYPE_RAW, 0x10c7, true },
+};
+
+/// Family 6 models of Intel cores from Broadwell on, which have
+/// FP_ARITH_INST_RETIRED. Older ones, Atoms and Xeon Phi do not, and
+/// there 0xC7 counts something else or nothing.
+static const unsigned char fp_arith_models[] = {
+	0x3d, 0x47, 0x4f, 0x56,                     // Broadwell
+	0x4e, 0x5e, 0x55, 0x8e, 0x9e, 0xa5, 0xa6,   // Skylake to Comet Lake
+	0x66, 0x7d, 0x7e, 0x6a, 0x6c, 0x8a,         // Cannon Lake, Ice Lake, Lakefield
+	0x8c, 0x8d, 0xa7,                           // Tiger Lake, Rocket Lake
+	0x97, 0x9a, 0xb7, 0xba, 0xbf,               // Alder Lake, Raptor Lake
+	0x8f, 0xcf, 0xad, 0xae,                     // Sapphire, Emerald, Granite Rapids
+	0xaa, 0xac, 0xbd, 0xc5, 0xc6,               // Meteor, Lunar, Arrow Lake
+};
+
+// Raw event numbers mean different things on other vendors and models
+static bool has_fp_arith(void)
+{
+	unsigned eax, ebx, ecx, edx;
+	if (!__get_cpuid(0, &eax, &ebx, &ecx, &edx))
+		return false;
+	if (ebx != 0x756e6547 || edx != 0x49656e69 || ecx != 0x6c65746e) // "GenuineIntel"
+		return false;
+	__get_cpuid(1, &eax, &ebx, &ecx, &edx);
+	if (((eax >> 8) & 0xf) != 6)
+		return false;
+
+	unsigned model = ((eax >> 4) & 0xf) | ((eax >> 12) & 0xf0);
+	for (size_t i = 0; i < sizeof(fp_arith_models); ++i)
+		if (fp_arith_models[i] == model)
+			return true;
+	return false;
+}
+
+static void close_counter(struct Bench_Counters *c, int k)
+{
+	for (int t = 0; t < c->nthreads; ++t) {
+		int *fd = &c->fds[t * BENCH_COUNTERS + k];
+		if (*fd >= 0)
+			close(*fd);
+		*fd = -1;
+	}
+	c->opened[k] = false;
+}
+
+bool bench_counters_open(
+		struct Bench_Counters *c, const int *tids, int nthreads,
+		char *err, size_t err_size
+)
+{
+	bool fp_arith = has_fp_arith();
+	int first_errno = 0;
+	bool any = false;
+
+	c->nthreads = nthreads;
+	c->fds = malloc(nthreads * BENCH_COUNTERS * sizeof(*c->fds));
+	for (int i = 0; i < nthreads * BENCH_COUNTERS; ++i)
+		c->fds[i] = -1;
+
+	for (int k = 0; k < BENCH_COUNTERS; ++k) {
+		c->opened[k] = !events[k].fp_arith || fp_arith;
+
+		struct perf_event_attr attr = {
+			.size = sizeof(attr),
+			.type = events[k].type,
+			.config = events[k].config,
+			.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING,
+			.exclude_kernel = 1,
+			.exclude_hv = 1,
+		};
+
+		// A counter is used only if it works on all threads,
+		// partial sums would look like a smaller count
+		for (int t = 0; t < nthreads && c->opened[k]; ++t) {
+			int fd = syscall(SYS_perf_event_open, &attr, tids[t], -1, -1, PERF_FLAG_FD_CLOEXEC);
+			if (fd < 0) {
+				if (!first_errno)
+					first_errno = errno;
+				close_counter(c, k);
+				break;
+			}
+			c->fds[t * BENCH_COUNTERS + k] = fd;
+		}
+		any |= c->opened[k];
+	}
+
+	if (any)
+		return true;
+
+	free(c->fds);
+	c->fds = NULL;
+	if (first_errno == EACCES || first_errno == EPERM)
+		snprintf(
+			err, err_size, "%s, see /proc/sys/kernel/perf_event_paranoid",
+			strerror(first_errno)
+		);
+	else if (first_errno == ENOENT || first_errno == ENODEV || first_errno == EOPNOTSUPP)
+		snprintf(
+			err, err_size, "%s, the CPU or virtual machine has no such events",
+			strerror(first_errno)
+		);
+	else
+		snprintf(err, err_size, "%s", strerror(first_errno));
+	return false;
+}
+
+void bench_counters_read(const struct Bench_Counters *c, double values[BENCH_COUNTERS])
+{
+	for (int k = 0; k < BENCH_COUNTERS; ++k) {
+		values[k] = c->opened[k] ? 0 : NAN;
+
+		for (int t = 0; t < c->nthreads && c->opened[k]; ++t) {
+			// value, time enabled, time running
+			uint64_t data[3];
+			int fd = c->fds[t * BENCH_COUNTERS + k];
+			if (read(fd, data, sizeof(data)) != sizeof(data) || data[2] == 0)
+				continue;
+
+			// Counters are multiplexed if there are more than the PMU has
+			values[k] += data[0] * ((double) data[1] / data[2]);
+		}
+	}
+}
+
+void bench_counters_close(struct Bench_Counters *c)
+{
+	for (int k = 0; k < BENCH_COUNTERS; ++k)
+		close_counter(c, k);
+	free(c->fds);
+	c->fds = NULL;
+}
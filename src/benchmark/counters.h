@@ -0,0 +1,51 @@
+///
+/// Hardware performance counters of given threads, through Linux
+/// `perf_event_open`. Readings are summed over the threads.
+///
+#ifndef I_BENCH_COUNTERS
+#define I_BENCH_COUNTERS
+
+#include <stdbool.h>
+#include <stddef.h>
+
+enum Bench_Counter {
+	BENCH_CYCLES,
+	BENCH_INSTRUCTIONS,
+	BENCH_BRANCH_MISSES,
+	BENCH_L1D_MISSES,
+	BENCH_LLC_MISSES,
+	// Intel only, FP_ARITH_INST_RETIRED
+	BENCH_FP_SCALAR_SINGLE,
+	BENCH_FP_SCALAR_DOUBLE,
+	BENCH_FP_256_SINGLE,
+	BENCH_FP_256_DOUBLE,
+	BENCH_COUNTERS
+};
+
+/// Names for reports and column names
+static const char *const bench_counter_names[BENCH_COUNTERS] = {
+	"cycles", "instructions", "branch_misses", "l1d_misses", "llc_misses",
+	"fp_scalar_single", "fp_scalar_double", "fp_256_single", "fp_256_double",
+};
+
+struct Bench_Counters {
+	int nthreads;
+	int *fds;       // BENCH_COUNTERS per thread, -1 if not opened
+	bool opened[BENCH_COUNTERS];
+};
+
+/// Opens all counters the CPU and the kernel allow on every thread
+/// of `tids`. Returns false if none of them could be opened, with
+/// the reason in `err`.
+bool bench_counters_open(
+		struct Bench_Counters *c, const int *tids, int nthreads,
+		char *err, size_t err_size
+);
+
+/// Current values since opening, scaled if the kernel had to multiplex
+/// counters. NAN for counters which are not opened.
+void bench_counters_read(const struct Bench_Counters *c, double values[BENCH_COUNTERS]);
+
+void bench_counters_close(struct Bench_Counters *c);
+
+#endif
@@ -0,0 +1,26 @@
+///
+/// Views the benchmark measures. Kernels rank differently depending on
+/// how much of the frame is boundary, interior or quickly escaping.
+///
+#ifndef I_BENCH_SCENES
+#define I_BENCH_SCENES
+
+struct Bench_Scene {
+	const char *name;
+	double xc, yc, swidth;
+	int max_steps;
+};
+
+static const struct Bench_Scene scenes[] = {
+	{ "default",   0,             0,       2,     255  },  // the original one
+	{ "full",      -0.5,          0,       3,     255  },
+	{ "seahorse",  -0.7436,       0.1318,  0.01,  1000 },
+	{ "elephant",  0.2825,        0.01,    0.02,  1000 },
+	{ "minibrot",  -1.7548776662, 0,       0.04,  1000 },
+	{ "exterior",  1.5,           1.5,     1,     255  },
+	{ "interior",  -0.15,         0,       0.3,   255  },
+};
+
+#define DEFAULT_SCENE 0
+
+#endif
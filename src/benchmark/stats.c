@@ -0,0 +1,98 @@
+#include "benchmark/stats.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void swap(float *a, float *b)
+{
+	float t = *a;
+	*a = *b;
+	*b = t;
+}
+
+// k-th smallest value, reorders `x`
+static float select_kth(float *x, int n, int k)
+{
+	int lo = 0, hi = n - 1;
+	while (lo < hi) {
+		float pivot = x[(lo + hi) / 2];
+		int i = lo, j = hi;
+		while (i <= j) {
+			while (x[i] < pivot) ++i;
+			while (x[j] > pivot) --j;
+			if (i <= j)
+				swap(&x[i++], &x[j--]);
+		}
+		if (k <= j)
+			hi = j;
+		else if (k >= i)
+			lo = i;
+		else
+			break;
+	}
+	return x[k];
+}
+
+// Median of scratch values, reorders them
+static float median_inplace(float *x, int n)
+{
+	float upper = select_kth(x, n, n / 2);
+	if (n % 2)
+		return upper;
+	// Lower half is left of the upper median after selection
+	float lower = x[0];
+	for (int i = 1; i < n / 2; ++i)
+		lower = fmaxf(lower, x[i]);
+	return (lower + upper) / 2;
+}
+
+float bench_median(const float *x, int n)
+{
+	float *tmp = malloc(n * sizeof(*tmp));
+	memcpy(tmp, x, n * sizeof(*tmp));
+	float median = median_inplace(tmp, n);
+	free(tmp);
+	return median;
+}
+
+float bench_mad(const float *x, int n, float median)
+{
+	float *tmp = malloc(n * sizeof(*tmp));
+	for (int i = 0; i < n; ++i)
+		tmp[i] = fabsf(x[i] - median);
+	float mad = median_inplace(tmp, n);
+	free(tmp);
+	return mad;
+}
+
+static int cmp_float(const void *pa, const void *pb)
+{
+	float a = *(const float*) pa, b = *(const float*) pb;
+	return (a > b) - (a < b);
+}
+
+void bench_median_ci(const float *x, int n, int resamples, float *low, float *high)
+{
+	float *sample = malloc(n * sizeof(*sample));
+	float *medians = malloc(resamples * sizeof(*medians));
+
+	// xorshift64, fixed seed so reports are reproducible
+	uint64_t state = 0x9e3779b97f4a7c15ull;
+	for (int r = 0; r < resamples; ++r) {
+		for (int i = 0; i < n; ++i) {
+			state ^= state << 13;
+			state ^= state >> 7;
+			state ^= state << 17;
+			sample[i] = x[state % n];
+		}
+		medians[r] = median_inplace(sample, n);
+	}
+
+	qsort(medians, resamples, sizeof(*medians), cmp_float);
+	*low = medians[(int) (resamples * 0.025)];
+	*high = medians[(int) (resamples * 0.975)];
+
+	free(sample);
+	free(medians);
+}
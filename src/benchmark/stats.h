@@ -0,0 +1,20 @@
+///
+/// Statistics which do not break on outliers: median, median absolute
+/// deviation and bootstrap confidence interval of the median
+///
+#ifndef I_BENCH_STATS
+#define I_BENCH_STATS
+
+/// MAD times this estimates standard deviation for normal distribution
+#define MAD_TO_SIGMA 1.4826f
+
+float bench_median(const float *x, int n);
+
+/// Median of |x - median|
+float bench_mad(const float *x, int n, float median);
+
+/// 95% confidence interval of the median by percentile bootstrap with
+/// `resamples` resamples. Same values give same interval.
+void bench_median_ci(const float *x, int n, int resamples, float *low, float *high);
+
+#endif
@@ -0,0 +1,87 @@
+#define _GNU_SOURCE
+
+#include "benchmark/topology.h"
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+struct Cpu {
+	int cpu;
+	int package, core;
+	int rank;           // among hyperthreads of its core
+	int core_rank;      // among cores of its package
+};
+
+static int read_topology(int cpu, const char *name)
+{
+	char path[128];
+	snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/%s", cpu, name);
+
+	// Without sysfs every CPU looks like a separate core
+	FILE *f = fopen(path, "r");
+	if (!f)
+		return name[0] == 'c' ? cpu : 0;
+	int value = 0;
+	if (fscanf(f, "%d", &value) != 1)
+		value = 0;
+	fclose(f);
+	return value;
+}
+
+static int cmp_compact(const void *pa, const void *pb)
+{
+	const struct Cpu *a = pa, *b = pb;
+	if (a->package != b->package) return a->package - b->package;
+	if (a->core != b->core) return a->core - b->core;
+	return a->cpu - b->cpu;
+}
+
+static int cmp_spread(const void *pa, const void *pb)
+{
+	const struct Cpu *a = pa, *b = pb;
+	if (a->rank != b->rank) return a->rank - b->rank;
+	if (a->core_rank != b->core_rank) return a->core_rank - b->core_rank;
+	if (a->package != b->package) return a->package - b->package;
+	return a->cpu - b->cpu;
+}
+
+int bench_cpu_order(enum Bench_Placement placement, int *cpus, int max)
+{
+	cpu_set_t allowed;
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+		return 0;
+
+	struct Cpu *list = malloc(CPU_SETSIZE * sizeof(*list));
+	int n = 0;
+	for (int i = 0; i < CPU_SETSIZE; ++i) {
+		if (!CPU_ISSET(i, &allowed))
+			continue;
+		list[n++] = (struct Cpu) {
+			.cpu = i,
+			.package = read_topology(i, "physical_package_id"),
+			.core = read_topology(i, "core_id"),
+		};
+	}
+
+	// Compact order groups hyperthreads of a core and cores of a package,
+	// so ranks are just positions inside these groups
+	qsort(list, n, sizeof(*list), cmp_compact);
+	for (int i = 0; i < n; ++i) {
+		bool same_package = i > 0 && list[i].package == list[i-1].package;
+		bool same_core = same_package && list[i].core == list[i-1].core;
+		list[i].rank = same_core ? list[i-1].rank + 1 : 0;
+		list[i].core_rank = !same_package ? 0
+			: same_core ? list[i-1].core_rank : list[i-1].core_rank + 1;
+	}
+
+	if (placement == BENCH_SPREAD)
+		qsort(list, n, sizeof(*list), cmp_spread);
+
+	if (n > max)
+		n = max;
+	for (int i = 0; i < n; ++i)
+		cpus[i] = list[i].cpu;
+	free(list);
+	return n;
+}
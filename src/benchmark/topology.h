@@ -0,0 +1,24 @@
+///
+/// Orders in which threads are placed on CPUs for the scaling sweep
+///
+#ifndef I_BENCH_TOPOLOGY
+#define I_BENCH_TOPOLOGY
+
+enum Bench_Placement {
+	BENCH_UNPINNED,     // scheduler decides
+	BENCH_COMPACT,      // fill hyperthreads of a core before the next core
+	BENCH_SPREAD,       // one thread per core first, then second hyperthreads
+	BENCH_CPU_LIST,     // CPUs given by user, in their order
+	BENCH_PLACEMENTS
+};
+
+static const char *const bench_placement_names[BENCH_PLACEMENTS] = {
+	"none", "compact", "spread", "list",
+};
+
+/// Fills `cpus` with CPUs this process may run on, in order threads
+/// should take them for `placement` (compact or spread).
+/// Returns number of CPUs written.
+int bench_cpu_order(enum Bench_Placement placement, int *cpus, int max);
+
+#endif
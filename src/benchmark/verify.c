@@ -0,0 +1,73 @@
+#include "benchmark/verify.h"
+#include <stdlib.h>
+#include <string.h>
+
+static void *alloc_frame(const struct Mb_GeneratorData *gen)
+{
+	size_t bytes = (size_t) gen->bwidth * gen->bheight * mb_steps_size(gen->format);
+	return aligned_alloc(32, (bytes + 31) / 32 * 32);
+}
+
+static long count_diffs(const struct Mb_GeneratorData *gen, const void *expected)
+{
+	long diffs = 0;
+	for (int i = 0; i < gen->bwidth * gen->bheight; ++i)
+		diffs += mb_steps_get(gen->exit_steps, gen->format, i)
+			!= mb_steps_get(expected, gen->format, i);
+	return diffs;
+}
+
+long bench_verify_mariani(
+		struct Mb_Pool *pool,
+		const struct Mb_Generator *generator,
+		struct Mb_GeneratorData *gen
+)
+{
+	void *frame = gen->exit_steps;
+	void *expected = alloc_frame(gen);
+
+	gen->rect = mb_full_rect(gen);
+	gen->exit_steps = expected;
+	generator->mandelbrot(gen);
+
+	gen->exit_steps = frame;
+	memset(frame, 0, (size_t) gen->bwidth * gen->bheight * mb_steps_size(gen->format));
+	mb_render_mariani(pool, generator, gen);
+
+	long diffs = count_diffs(gen, expected);
+	free(expected);
+	return diffs;
+}
+
+long bench_verify_deepen(
+		struct Mb_Pool *pool,
+		const struct Mb_Generator *generator,
+		struct Mb_GeneratorData *gen,
+		int max_steps
+)
+{
+	void *frame = gen->exit_steps;
+	void *expected = alloc_frame(gen);
+	int base_steps = gen->max_steps;
+
+	gen->rect = mb_full_rect(gen);
+	gen->exit_steps = expected;
+	gen->max_steps = max_steps;
+	mb_render_tiled(pool, generator, gen);
+
+	gen->exit_steps = frame;
+	gen->max_steps = base_steps;
+	mb_render_tiled(pool, generator, gen);
+
+	struct Mb_Orbits orbits = { .steps = -1 };
+	while (gen->max_steps < max_steps) {
+		int steps = gen->max_steps * 2 + 1 < max_steps ? gen->max_steps * 2 + 1 : max_steps;
+		mb_render_deepen(pool, gen, &orbits, steps);
+	}
+	mb_orbits_free(&orbits);
+	gen->max_steps = base_steps;
+
+	long diffs = count_diffs(gen, expected);
+	free(expected);
+	return diffs;
+}
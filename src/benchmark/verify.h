@@ -0,0 +1,31 @@
+///
+/// Checks that renderers which are meant to give exactly the frame
+/// of the generator they run really do, instead of measuring them
+///
+#ifndef I_BENCH_VERIFY
+#define I_BENCH_VERIFY
+
+#include "gen/api.h"
+#include "render/api.h"
+
+/// Computes the frame of `gen` with one call of `generator` for all of it,
+/// then again through `mb_render_mariani`, and compares step counts.
+/// Returns number of pixels which differ, the frame is left in `gen`.
+long bench_verify_mariani(
+		struct Mb_Pool *pool,
+		const struct Mb_Generator *generator,
+		struct Mb_GeneratorData *gen
+);
+
+/// Computes the frame of `gen` with `generator` directly with `max_steps`,
+/// then with `gen->max_steps` and raises the limit to `max_steps` with
+/// `mb_render_deepen`, doubling it like the viewer. Returns number of
+/// pixels which differ, the deepened frame is left in `gen`.
+long bench_verify_deepen(
+		struct Mb_Pool *pool,
+		const struct Mb_Generator *generator,
+		struct Mb_GeneratorData *gen,
+		int max_steps
+);
+
+#endif
@@ -1,6 +1,7 @@
 #ifndef I_COLOR_API
 #define I_COLOR_API
 
+#include "gen/api.h"
 #include <stdint.h>
 
 struct __attribute__((packed)) ARGB {
@@ -20,7 +21,7 @@ ARGB color_grayscale(int steps, int max_steps);
 ARGB color_red_yellow(int steps, int max_steps);
 ARGB color_blue(int steps, int max_steps);
 
-static struct Mb_Colorizer colorizers[] = {
+static const struct Mb_Colorizer colorizers[] = {
 	{ color_grayscale, "grayscale" },
 	{ color_red_yellow, "red-yellow" },
 	{ color_blue, "blue" },
@@ -28,4 +29,26 @@ static struct Mb_Colorizer colorizers[] = {
 
 #define DEFAULT_COLORIZER 0
 
+/// Colors of every step count of a colorizer, zero initialized
+/// one is empty
+struct Mb_Palette {
+	ARGB *lut;      // max_steps + 1 colors
+	const struct Mb_Colorizer *colorizer;
+	int max_steps;
+};
+
+/// Rebuilds the table if the colorizer or `max_steps` has changed
+void color_palette_update(
+		struct Mb_Palette *pal,
+		const struct Mb_Colorizer *colorizer,
+		int max_steps
+);
+void color_palette_free(struct Mb_Palette *pal);
+
+/// Colors `n` step counts into `out`
+void color_fill(
+		const struct Mb_Palette *pal, ARGB *out,
+		const void *steps, enum Mb_StepsFormat format, size_t n
+);
+
 #endif
@@ -0,0 +1,91 @@
+///
+/// Colorizers are slow (powf, sqrtf), but there are only
+/// `max_steps + 1` different inputs, so they are computed once
+/// into a table and the frame is colored by lookups in it
+///
+#include "color/api.h"
+#include <x86intrin.h>
+#include <stdlib.h>
+
+void color_palette_update(
+		struct Mb_Palette *pal,
+		const struct Mb_Colorizer *colorizer,
+		int max_steps
+)
+{
+	if (pal->lut && pal->colorizer == colorizer && pal->max_steps == max_steps)
+		return;
+
+	free(pal->lut);
+	pal->lut = malloc((max_steps + 1) * sizeof(*pal->lut));
+	for (int i = 0; i <= max_steps; ++i)
+		pal->lut[i] = colorizer->color(i, max_steps);
+
+	pal->colorizer = colorizer;
+	pal->max_steps = max_steps;
+}
+
+void color_palette_free(struct Mb_Palette *pal)
+{
+	free(pal->lut);
+	pal->lut = NULL;
+	pal->colorizer = NULL;
+}
+
+// Loads 8 step counts as ints
+__attribute__((target("avx2")))
+static inline __m256i load_steps8(const void *steps, enum Mb_StepsFormat format, size_t i)
+{
+	switch (format) {
+	case MB_STEPS_U8:
+		return _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*) ((const uint8_t*) steps + i)));
+	case MB_STEPS_U16:
+		return _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*) ((const uint16_t*) steps + i)));
+	default:
+		return _mm256_loadu_si256((const __m256i*) ((const int*) steps + i));
+	}
+}
+
+static void fill_scalar(
+		const struct Mb_Palette *pal, ARGB *out,
+		const void *steps, enum Mb_StepsFormat format, size_t i, size_t n
+)
+{
+	for (; i < n; ++i) {
+		int s = mb_steps_get(steps, format, i);
+		s = s < 0 ? 0 : s > pal->max_steps ? pal->max_steps : s;
+		out[i] = pal->lut[s];
+	}
+}
+
+__attribute__((target("avx2")))
+static void fill_avx2(
+		const struct Mb_Palette *pal, ARGB *out,
+		const void *steps, enum Mb_StepsFormat format, size_t n
+)
+{
+	// Counts above the limit would read past the table
+	__m256i Max = _mm256_set1_epi32(pal->max_steps);
+	__m256i Zero = _mm256_setzero_si256();
+
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256i idx = load_steps8(steps, format, i);
+		idx = _mm256_max_epi32(_mm256_min_epi32(idx, Max), Zero);
+		__m256i colors = _mm256_i32gather_epi32((const int*) pal->lut, idx, sizeof(ARGB));
+		_mm256_storeu_si256((__m256i*) (out + i), colors);
+	}
+
+	fill_scalar(pal, out, steps, format, i, n);
+}
+
+void color_fill(
+		const struct Mb_Palette *pal, ARGB *out,
+		const void *steps, enum Mb_StepsFormat format, size_t n
+)
+{
+	if (mb_isa_supported(MB_ISA_AVX2))
+		fill_avx2(pal, out, steps, format, n);
+	else
+		fill_scalar(pal, out, steps, format, 0, n);
+}
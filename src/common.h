@@ -1,6 +1,8 @@
 #ifndef I_COMMON_H
 #define I_COMMON_H
 
+#include <time.h>
+
 #define WIN_WIDTH      1024
 #define WIN_HEIGHT     768
 
@@ -8,6 +10,11 @@
 #define INITIAL_POS_Y  0
 #define INITIAL_SCALE  2
 
+// Tiles stored by the `tiles` tool are found by the viewer
+// only if it uses the same widths and iteration limit
+#define VIEWER_MAX_STEPS 255
+#define SCALE_STEP       1.5
+
 #define DIE(fmt, ...) \
 	do {\
 		fprintf(stderr, "Error: " fmt "\n" __VA_OPT__(,) __VA_ARGS__);\
@@ -18,4 +25,13 @@
 
 #define ARRAY_SIZE(arr) ((sizeof(arr)) / (sizeof(arr[0])))
 
+/// Wall clock time in milliseconds. Unlike `clock()` this
+/// is not summed over all threads of the process.
+static inline double wall_time_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
 #endif
@@ -5,37 +5,387 @@
 #ifndef I_GEN_API
 #define I_GEN_API
 
+#include "gen/bignum.h"
+#include <float.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <stdint.h>
+#include <string.h>
 
 #define EXIT_RADIUS 10
 
+/// Generator is considered too imprecise, when pixel is
+/// less than this many epsilons of the coordinates
+#define PRECISION_MARGIN 4
+
+/// Rectangle of pixels in the buffer
+struct Mb_Rect {
+	int x, y, w, h;
+};
+
+/// Skip pixels of the main cardioid and period-2 bulb, they are
+/// known to be inside
+#define MB_OPT_CARDIOID     (1u << 0)
+/// Retire lanes whose orbit came back to a point it visited
+/// before (Brent's cycle detection), they are inside too
+#define MB_OPT_PERIODICITY  (1u << 1)
+
+/// MB_OPT_CARDIOID test of one point, with the same operations
+/// as the vector ones in `gen/interior.h`
+static inline bool mb_interior(float Re, float Im)
+{
+	float Y2 = Im * Im;
+	float Xq = Re - 0.25f;
+	float Q = Xq * Xq + Y2;
+	float Xb = Re + 1;
+	return Q * (Q + Xq) <= Y2 * 0.25f || Xb * Xb + Y2 <= 1.0f / 16;
+}
+
+/// Orbit is considered periodic, when it comes this
+/// many pixels close to the saved point
+#define PERIODICITY_EPS 1e-3
+
+struct Mb_Option {
+	unsigned flag;
+	const char *name;
+};
+
+/// Options which can be set in `Mb_GeneratorData::options`.
+/// Generators which do not support some of them just ignore them.
+static const struct Mb_Option gen_options[] = {
+	{ MB_OPT_CARDIOID, "cardioid" },
+	{ MB_OPT_PERIODICITY, "periodicity" },
+};
+
+/// Counters generators may fill
+struct Mb_GenStats {
+	/// Lanes times iterations of vector loops executed. Compared to
+	/// sum of exit_steps, it shows how many lanes were idle.
+	_Atomic uint64_t lane_slots;
+};
+
+/// Element type of `Mb_GeneratorData::exit_steps`. Smaller ones
+/// take less memory bandwidth, but can hold only so many steps.
+enum Mb_StepsFormat {
+	MB_STEPS_I32,
+	MB_STEPS_U16,   // max_steps must be below 65536
+	MB_STEPS_U8,    // max_steps must be below 256
+};
+
+struct Mb_StepsFormatName {
+	enum Mb_StepsFormat format;
+	const char *name;
+};
+
+static const struct Mb_StepsFormatName steps_formats[] = {
+	{ MB_STEPS_I32, "i32" },
+	{ MB_STEPS_U16, "u16" },
+	{ MB_STEPS_U8, "u8" },
+};
+
+static inline size_t mb_steps_size(enum Mb_StepsFormat format)
+{
+	return format == MB_STEPS_I32 ? 4 : format == MB_STEPS_U16 ? 2 : 1;
+}
+
+/// Largest step count the format holds
+static inline int mb_steps_max(enum Mb_StepsFormat format)
+{
+	return format == MB_STEPS_U8 ? 255 : format == MB_STEPS_U16 ? 65535 : INT32_MAX;
+}
+
+/// Smallest format which holds `max_steps`
+static inline enum Mb_StepsFormat mb_compact_format(int max_steps)
+{
+	return max_steps < 256 ? MB_STEPS_U8 : max_steps < 65536 ? MB_STEPS_U16 : MB_STEPS_I32;
+}
+
+static inline int mb_steps_get(const void *steps, enum Mb_StepsFormat format, size_t i)
+{
+	switch (format) {
+	case MB_STEPS_U8:  return ((const uint8_t*) steps)[i];
+	case MB_STEPS_U16: return ((const uint16_t*) steps)[i];
+	default:           return ((const int*) steps)[i];
+	}
+}
+
+static inline void mb_steps_set(void *steps, enum Mb_StepsFormat format, size_t i, int value)
+{
+	switch (format) {
+	case MB_STEPS_U8:  ((uint8_t*) steps)[i] = value; break;
+	case MB_STEPS_U16: ((uint16_t*) steps)[i] = value; break;
+	default:           ((int*) steps)[i] = value; break;
+	}
+}
+
 struct Mb_GeneratorData {
 
-	int *exit_steps;
+	/// Step counts, row by row, of type given by `format`
+	void *exit_steps;
+	enum Mb_StepsFormat format;
 	int bwidth, bheight;
 	int max_steps;
 
-	float xc, yc;
-	float swidth;
+	double xc, yc;
+	double swidth;
+
+	/// Same center with more digits, used by deep zoom generators
+	/// if `has_hp_center` is set. Others only look at `xc` and `yc`.
+	struct Mb_Big xc_hp, yc_hp;
+	bool has_hp_center;
+
+	/// Part of the buffer generator shall compute. Other pixels are
+	/// left untouched. Coordinates of pixels do not depend on it,
+	/// so a frame rendered by parts is identical to a whole one.
+	struct Mb_Rect rect;
+
+	/// MB_OPT_* flags
+	unsigned options;
+
+	/// Where to add statistics to, NULL if nobody is interested
+	struct Mb_GenStats *stats;
+
+	/// Frame is abandoned as soon as `*cancel` is not `epoch` anymore:
+	/// generators stop between rows, renderers between tiles, and the
+	/// rest of the rect is left as it was. NULL if nobody cancels it.
+	const _Atomic unsigned *cancel;
+	unsigned epoch;
 };
 
+/// Checks if whoever asked for the frame does not need it anymore
+static inline bool mb_cancelled(const struct Mb_GeneratorData *gen)
+{
+	return gen->cancel && atomic_load_explicit(gen->cancel, memory_order_relaxed) != gen->epoch;
+}
+
+/// Center as a high precision number, whichever way it was given
+static inline void mb_hp_center(
+		const struct Mb_GeneratorData *gen,
+		struct Mb_Big *xc, struct Mb_Big *yc
+)
+{
+	*xc = gen->has_hp_center ? gen->xc_hp : mb_big_from_double(gen->xc);
+	*yc = gen->has_hp_center ? gen->yc_hp : mb_big_from_double(gen->yc);
+}
+
+static inline struct Mb_Rect mb_full_rect(const struct Mb_GeneratorData *gen)
+{
+	return (struct Mb_Rect) { 0, 0, gen->bwidth, gen->bheight };
+}
+
+enum Mb_Precision {
+	MB_FLOAT,
+	MB_DOUBLE,
+	MB_BIGNUM,
+	MB_PRECISIONS
+};
+
+static const char *const precision_names[MB_PRECISIONS] = {
+	"float", "double", "bignum",
+};
+
+/// Pixels of a frame which have not escaped yet, with the point of
+/// the orbit where they stopped, so iterating them can be continued
+/// instead of starting from z0 again. Float precision only.
+struct Mb_Orbits {
+	int *pixel;         // index in `exit_steps`
+	float *re, *im;     // z after `steps` iterations
+	int steps;          // all of them were iterated this many times,
+	                    // -1 if they are not collected
+	int count, cap;
+	int *inside;        // pixels known to be inside (MB_OPT_CARDIOID),
+	int ninside;        // they are not iterated, only get every new limit
+};
+
+/// Continues orbits [from, to) up to `gen->max_steps` iterations and
+/// writes their step counts. Iteration is the one of `avx2-fma*`, see
+/// `mb_deepens_exactly` for frames it matches. Ones which are still inside are moved to
+/// the start of the range, their number is returned. If the frame is
+/// cancelled, it stops and the orbits are left broken.
+int mb_deepen(struct Mb_GeneratorData *gen, struct Mb_Orbits *orbits, int from, int to);
+
+/// Takes pixels of the frame which reached `gen->max_steps`
+/// as orbits, or as `inside` ones. Frames keep only step counts
+/// (and may come from caches or be shifted), so z where generators
+/// stopped is not known: orbits start at z = c, iterated 0 times,
+/// and the first `mb_deepen` repeats the steps of the frame.
+void mb_orbits_collect(const struct Mb_GeneratorData *gen, struct Mb_Orbits *orbits);
+
+void mb_orbits_free(struct Mb_Orbits *orbits);
+
+/// Instruction set a generator is compiled for. Each kernel is built
+/// with flags of its own set only, the rest of the program runs on
+/// plain x86-64 (SSE2), so one binary works on any CPU.
+enum Mb_Isa {
+	MB_ISA_SSE2,
+	MB_ISA_AVX,
+	MB_ISA_AVX2,
+	MB_ISA_AVX2_FMA,
+	MB_ISA_AVX512,
+};
+
+struct Mb_IsaName {
+	enum Mb_Isa isa;
+	const char *name;
+};
+
+static const struct Mb_IsaName isa_names[] = {
+	{ MB_ISA_SSE2, "sse2" },
+	{ MB_ISA_AVX, "avx" },
+	{ MB_ISA_AVX2, "avx2" },
+	{ MB_ISA_AVX2_FMA, "avx2+fma" },
+	{ MB_ISA_AVX512, "avx512f" },
+};
+
+/// Checks if the CPU (and the OS, which must save wide registers)
+/// supports the set. CPUID is read once, by libgcc at startup.
+static inline bool mb_isa_supported(enum Mb_Isa isa)
+{
+	switch (isa) {
+	case MB_ISA_SSE2:     return true;
+	case MB_ISA_AVX:      return __builtin_cpu_supports("avx");
+	case MB_ISA_AVX2:     return __builtin_cpu_supports("avx2");
+	case MB_ISA_AVX2_FMA: return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+	case MB_ISA_AVX512:   return __builtin_cpu_supports("avx512f");
+	}
+	return false;
+}
+
 struct Mb_Generator {
 	void (*mandelbrot)(struct Mb_GeneratorData *gen);
 	const char *name;
+	enum Mb_Precision precision;
+	/// Name of the generator to switch to when this one
+	/// is not precise enough, NULL if there is none
+	const char *deeper;
+	/// `rect.x` and `rect.w` must be multiples of this
+	int align;
+	enum Mb_Isa isa;
 };
 
 void mandelbrot_simple(struct Mb_GeneratorData *gen);
 void mandelbrot_avx2(struct Mb_GeneratorData *gen);
 void mandelbrot_avx(struct Mb_GeneratorData *gen);
 void mandelbrot_arrays(struct Mb_GeneratorData *gen);
+void mandelbrot_avx2_recycle(struct Mb_GeneratorData *gen);
+
+// Same kernel, iterating 1 to 4 groups of 8 pixels at once
+void mandelbrot_avx2_fma1(struct Mb_GeneratorData *gen);
+void mandelbrot_avx2_fma2(struct Mb_GeneratorData *gen);
+void mandelbrot_avx2_fma3(struct Mb_GeneratorData *gen);
+void mandelbrot_avx2_fma4(struct Mb_GeneratorData *gen);
+
+void mandelbrot_simple_d(struct Mb_GeneratorData *gen);
+void mandelbrot_avx_d(struct Mb_GeneratorData *gen);
+void mandelbrot_avx2_d(struct Mb_GeneratorData *gen);
+
+void mandelbrot_perturb(struct Mb_GeneratorData *gen);
+
+#ifdef MB_HAVE_AVX512
+// Same with 16 pixels per vector, 1 to 3 vectors at once
+void mandelbrot_avx512_fma1(struct Mb_GeneratorData *gen);
+void mandelbrot_avx512_fma2(struct Mb_GeneratorData *gen);
+void mandelbrot_avx512_fma3(struct Mb_GeneratorData *gen);
+#endif
 
 static const struct Mb_Generator generators[] = {
-	{ mandelbrot_simple, "simple" },
-	{ mandelbrot_avx, "avx" },
-	{ mandelbrot_avx2, "avx2" },
-	{ mandelbrot_arrays, "arrays" }
+	{ mandelbrot_simple, "simple", MB_FLOAT, "simple-d", 1, MB_ISA_SSE2 },
+	{ mandelbrot_avx, "avx", MB_FLOAT, "avx-d", 4, MB_ISA_AVX },
+	{ mandelbrot_avx2, "avx2", MB_FLOAT, "avx2-d", 8, MB_ISA_AVX2 },
+	{ mandelbrot_arrays, "arrays", MB_FLOAT, "avx2-d", 8, MB_ISA_AVX2 },
+	{ mandelbrot_avx2_recycle, "avx2-recycle", MB_FLOAT, "avx2-d", 1, MB_ISA_AVX2 },
+	{ mandelbrot_avx2_fma1, "avx2-fma1", MB_FLOAT, "avx2-d", 8, MB_ISA_AVX2_FMA },
+	{ mandelbrot_avx2_fma2, "avx2-fma2", MB_FLOAT, "avx2-d", 8, MB_ISA_AVX2_FMA },
+	{ mandelbrot_avx2_fma3, "avx2-fma3", MB_FLOAT, "avx2-d", 8, MB_ISA_AVX2_FMA },
+	{ mandelbrot_avx2_fma4, "avx2-fma4", MB_FLOAT, "avx2-d", 8, MB_ISA_AVX2_FMA },
+#ifdef MB_HAVE_AVX512
+	{ mandelbrot_avx512_fma1, "avx512-fma1", MB_FLOAT, "avx2-d", 8, MB_ISA_AVX512 },
+	{ mandelbrot_avx512_fma2, "avx512-fma2", MB_FLOAT, "avx2-d", 8, MB_ISA_AVX512 },
+	{ mandelbrot_avx512_fma3, "avx512-fma3", MB_FLOAT, "avx2-d", 8, MB_ISA_AVX512 },
+#endif
+	{ mandelbrot_simple_d, "simple-d", MB_DOUBLE, "perturb", 1, MB_ISA_SSE2 },
+	{ mandelbrot_avx_d, "avx-d", MB_DOUBLE, "perturb", 4, MB_ISA_AVX },
+	{ mandelbrot_avx2_d, "avx2-d", MB_DOUBLE, "perturb", 4, MB_ISA_AVX2 },
+	{ mandelbrot_perturb, "perturb", MB_BIGNUM, NULL, 4, MB_ISA_AVX2 },
+};
+
+/// Generators to use by default, fastest first.
+/// The first one CPU supports is taken.
+static const char *const preferred_generators[] = {
+#ifdef MB_HAVE_AVX512
+	"avx512-fma2",
+#endif
+	"avx2-fma3",
+	"avx2",
+	"avx",
+	"simple",
 };
 
-#define DEFAULT_GENERATOR 2
+#define DEFAULT_GENERATOR mb_default_generator()
+
+static inline bool mb_generator_supported(int idx)
+{
+	return mb_isa_supported(generators[idx].isa);
+}
+
+/// Index of generator with given name, -1 if there is
+/// none or the CPU does not support its instruction set
+static inline int mb_find_generator(const char *name)
+{
+	for (int i = 0; i < (int) (sizeof(generators) / sizeof(generators[0])); ++i)
+		if (strcmp(generators[i].name, name) == 0)
+			return mb_generator_supported(i) ? i : -1;
+	return -1;
+}
+
+/// Fastest generator this CPU can run
+static inline int mb_default_generator(void)
+{
+	for (int i = 0; i < (int) (sizeof(preferred_generators) / sizeof(preferred_generators[0])); ++i) {
+		int idx = mb_find_generator(preferred_generators[i]);
+		if (idx >= 0)
+			return idx;
+	}
+	return 0;
+}
+
+/// Checks if pixels of the frame are distinguishable with given
+/// precision. Orbits travel up to |z| ~ 2, so coordinates are never
+/// considered to be smaller than that.
+static inline bool mb_precision_enough(
+		enum Mb_Precision prec,
+		const struct Mb_GeneratorData *gen
+)
+{
+	double eps = prec == MB_FLOAT  ? FLT_EPSILON
+	           : prec == MB_DOUBLE ? DBL_EPSILON
+	           : ldexp(1, -MB_BIG_FRAC_BITS);
+	double extent = fmax(fmax(fabs(gen->xc), fabs(gen->yc)), 2);
+	return gen->swidth / gen->bwidth > extent * eps * PRECISION_MARGIN;
+}
+
+/// Follows `deeper` links from generator `gen_idx` until it finds
+/// one precise enough for the frame (or the last one CPU supports)
+static inline int mb_pick_generator(int gen_idx, const struct Mb_GeneratorData *gen)
+{
+	while (!mb_precision_enough(generators[gen_idx].precision, gen)) {
+		int next = generators[gen_idx].deeper ? mb_find_generator(generators[gen_idx].deeper) : -1;
+		if (next < 0)
+			break;
+		gen_idx = next;
+	}
+	return gen_idx;
+}
+
+/// Frames of the generator are continued by `mb_deepen` exactly as it
+/// would compute them with the higher limit: same coordinates and same
+/// FMA iteration. Others round differently, so pixels near the boundary
+/// would get other step counts than in their own direct frame.
+static inline bool mb_deepens_exactly(const struct Mb_Generator *generator)
+{
+	return generator->precision == MB_FLOAT
+		&& (generator->isa == MB_ISA_AVX2_FMA || generator->isa == MB_ISA_AVX512);
+}
 
 #endif
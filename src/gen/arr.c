@@ -52,7 +52,7 @@ void mandelbrot_arrays(struct Mb_GeneratorData *gen)
 	float sheight = gen->swidth / gen->bwidth * gen->bheight;
 
 	assert(gen->bwidth % 8 == 0);
-	assert(__builtin_cpu_supports("avx2"));
+	assert(gen->rect.x % 8 == 0 && gen->rect.w % 8 == 0);
 
 	float DeltaRe0 = 1.0f / gen->bwidth * gen->swidth;
 	fblk_t DeltaRe = { 0 };
@@ -61,11 +61,11 @@ void mandelbrot_arrays(struct Mb_GeneratorData *gen)
 
 	float Radius2 = EXIT_RADIUS*EXIT_RADIUS;
 
-	for (int iy = 0; iy < gen->bheight; ++iy) {
+	for (int iy = gen->rect.y; iy < gen->rect.y + gen->rect.h && !mb_cancelled(gen); ++iy) {
 		float Im0_Val = (iy * 1.0f / gen->bheight - 0.5f) * sheight + gen->yc;
 		fblk_t Im0 = fblk_set(Im0_Val);
 
-		for (int ix = 0; ix < gen->bwidth; ix += 8) {
+		for (int ix = gen->rect.x; ix < gen->rect.x + gen->rect.w; ix += 8) {
 
 			float Re0_0 = (ix * 1.0f / gen->bwidth - 0.5f) * gen->swidth + gen->xc;
 
@@ -108,9 +108,8 @@ void mandelbrot_arrays(struct Mb_GeneratorData *gen)
 
 			}
 
-			int *base = &gen->exit_steps[ix + iy*gen->bwidth];
 			for (int i = 0; i < BLOCK_SIZE; ++i)
-				base[i] = steps.d[i];
+				mb_steps_set(gen->exit_steps, gen->format, ix + i + iy*gen->bwidth, steps.d[i]);
 		}
 	}
 }
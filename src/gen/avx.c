@@ -1,13 +1,16 @@
 #include "gen/api.h"
+#include "gen/pack.h"
+#include "gen/interior.h"
 #include <x86intrin.h>
 #include <assert.h>
+#include <stdatomic.h>
 
 void mandelbrot_avx(struct Mb_GeneratorData *gen)
 {
 	float sheight = gen->swidth / gen->bwidth * gen->bheight;
 
 	assert(gen->bwidth % 4 == 0);
-	assert(__builtin_cpu_supports("avx"));
+	assert(gen->rect.x % 4 == 0 && gen->rect.w % 4 == 0);
 
 	float DeltaRe0 = 1.0f / gen->bwidth * gen->swidth;
 	float Re0Arr[4] = { 0 };
@@ -18,12 +21,20 @@ void mandelbrot_avx(struct Mb_GeneratorData *gen)
 	__m128 Radius2 = _mm_set1_ps(EXIT_RADIUS*EXIT_RADIUS);
 	__m128i m128i_One = _mm_set1_epi32(1);
 	__m128 m128_Two = _mm_set1_ps(2);
+	__m128i MaxSteps = _mm_set1_epi32(gen->max_steps);
 
-	for (int iy = 0; iy < gen->bheight; ++iy) {
+	bool cardioid = gen->options & MB_OPT_CARDIOID;
+	bool periodicity = gen->options & MB_OPT_PERIODICITY;
+	float PeriodEps = DeltaRe0 * PERIODICITY_EPS;
+	__m128 PeriodEps2 = _mm_set1_ps(PeriodEps * PeriodEps);
+
+	uint64_t trips = 0;
+
+	for (int iy = gen->rect.y; iy < gen->rect.y + gen->rect.h && !mb_cancelled(gen); ++iy) {
 		float Im0_Val = (iy * 1.0f / gen->bheight - 0.5) * sheight + gen->yc;
 		__m128 Im0 = _mm_set1_ps(Im0_Val);
 
-		for (int ix = 0; ix < gen->bwidth; ix += 4) {
+		for (int ix = gen->rect.x; ix < gen->rect.x + gen->rect.w; ix += 4) {
 
 			float Re0_0 = (ix * 1.0f / gen->bwidth - 0.5) * gen->swidth + gen->xc;
 
@@ -31,9 +42,24 @@ void mandelbrot_avx(struct Mb_GeneratorData *gen)
 
 			__m128 ReN = Re0, ImN = Im0;
 
+			// Lanes which are known to be inside the set
+			__m128 interior = cardioid
+				? mb_interior_mask4(Re0, Im0)
+				: _mm_setzero_ps();
+			if (_mm_movemask_ps(interior) == 0xf) {
+				mb_store_steps4(gen, ix + iy*gen->bwidth, MaxSteps);
+				continue;
+			}
+
+			// Point of the orbit saved for periodicity check,
+			// it is moved forward at iterations 2^k
+			__m128 ReS = ReN, ImS = ImN;
+			int save_at = 1;
+
 			__m128i steps = _mm_set1_epi32(0);
 
-			for (int max_steps = 0; max_steps < gen->max_steps; max_steps++) {
+			int max_steps = 0;
+			for (; max_steps < gen->max_steps; max_steps++) {
 
 				__m128 ReN2 = _mm_mul_ps(ReN, ReN);
 				__m128 ImN2 = _mm_mul_ps(ImN, ImN);
@@ -42,7 +68,11 @@ void mandelbrot_avx(struct Mb_GeneratorData *gen)
 				__m128 Dist = _mm_add_ps(ReN2, ImN2);
 
 				// Mask those, which are inside the circle
-				__m128 mask = _mm_cmp_ps(Dist, Radius2, _CMP_LT_OS);
+				// and not known to stay there forever
+				__m128 mask = _mm_andnot_ps(
+					interior,
+					_mm_cmp_ps(Dist, Radius2, _CMP_LT_OS)
+				);
 
 				// If everyone is outside, exit
 				if (!_mm_movemask_ps(mask))
@@ -63,9 +93,39 @@ void mandelbrot_avx(struct Mb_GeneratorData *gen)
 				ReN = _mm_add_ps(_mm_sub_ps(ReN2, ImN2), Re0);
 				ImN = _mm_add_ps(ImSqr, Im0);
 
+				if (periodicity) {
+					__m128 DRe = _mm_sub_ps(ReN, ReS);
+					__m128 DIm = _mm_sub_ps(ImN, ImS);
+					__m128 Diff = _mm_add_ps(
+						_mm_mul_ps(DRe, DRe),
+						_mm_mul_ps(DIm, DIm)
+					);
+					interior = _mm_or_ps(
+						interior,
+						_mm_and_ps(mask, _mm_cmp_ps(Diff, PeriodEps2, _CMP_LT_OS))
+					);
+
+					if (max_steps == save_at) {
+						ReS = ReN;
+						ImS = ImN;
+						save_at *= 2;
+					}
+				}
 			}
 
-			_mm_store_si128((__m128i*) &gen->exit_steps[ix + iy*gen->bwidth], steps);
+			steps = _mm_castps_si128(_mm_blendv_ps(
+				_mm_castsi128_ps(steps),
+				_mm_castsi128_ps(MaxSteps),
+				interior
+			));
+
+			// Loop which broke out also counts
+			trips += max_steps + (max_steps < gen->max_steps);
+
+			mb_store_steps4(gen, ix + iy*gen->bwidth, steps);
 		}
 	}
+
+	if (gen->stats)
+		atomic_fetch_add(&gen->stats->lane_slots, trips * 4);
 }
@@ -1,13 +1,16 @@
 #include "gen/api.h"
+#include "gen/pack.h"
+#include "gen/interior.h"
 #include <x86intrin.h>
 #include <assert.h>
+#include <stdatomic.h>
 
 void mandelbrot_avx2(struct Mb_GeneratorData *gen)
 {
 	float sheight = gen->swidth / gen->bwidth * gen->bheight;
 
 	assert(gen->bwidth % 8 == 0);
-	assert(__builtin_cpu_supports("avx2"));
+	assert(gen->rect.x % 8 == 0 && gen->rect.w % 8 == 0);
 
 	float DeltaRe0 = 1.0f / gen->bwidth * gen->swidth;
 	float Re0Arr[8] = { 0 };
@@ -18,12 +21,20 @@ void mandelbrot_avx2(struct Mb_GeneratorData *gen)
 	__m256 Radius2 = _mm256_set1_ps(EXIT_RADIUS*EXIT_RADIUS);
 	__m256i m256i_One = _mm256_set1_epi32(1);
 	__m256 m256_Two = _mm256_set1_ps(2);
+	__m256i MaxSteps = _mm256_set1_epi32(gen->max_steps);
 
-	for (int iy = 0; iy < gen->bheight; ++iy) {
+	bool cardioid = gen->options & MB_OPT_CARDIOID;
+	bool periodicity = gen->options & MB_OPT_PERIODICITY;
+	float PeriodEps = DeltaRe0 * PERIODICITY_EPS;
+	__m256 PeriodEps2 = _mm256_set1_ps(PeriodEps * PeriodEps);
+
+	uint64_t trips = 0;
+
+	for (int iy = gen->rect.y; iy < gen->rect.y + gen->rect.h && !mb_cancelled(gen); ++iy) {
 		float Im0_Val = (iy * 1.0f / gen->bheight - 0.5) * sheight + gen->yc;
 		__m256 Im0 = _mm256_set1_ps(Im0_Val);
 
-		for (int ix = 0; ix < gen->bwidth; ix += 8) {
+		for (int ix = gen->rect.x; ix < gen->rect.x + gen->rect.w; ix += 8) {
 
 			float Re0_0 = (ix * 1.0f / gen->bwidth - 0.5) * gen->swidth + gen->xc;
 
@@ -31,10 +42,25 @@ void mandelbrot_avx2(struct Mb_GeneratorData *gen)
 
 			__m256 ReN = Re0, ImN = Im0;
 
+			// Lanes which are known to be inside the set
+			__m256 interior = cardioid
+				? mb_interior_mask8(Re0, Im0)
+				: _mm256_setzero_ps();
+			if (_mm256_movemask_ps(interior) == 0xff) {
+				mb_store_steps8(gen, ix + iy*gen->bwidth, MaxSteps);
+				continue;
+			}
+
+			// Point of the orbit saved for periodicity check,
+			// it is moved forward at iterations 2^k
+			__m256 ReS = ReN, ImS = ImN;
+			int save_at = 1;
+
 			//int steps = 0;
 			__m256i steps = _mm256_set1_epi32(0);
 
-			for (int max_steps = 0; max_steps < gen->max_steps; max_steps++) {
+			int max_steps = 0;
+			for (; max_steps < gen->max_steps; max_steps++) {
 
 				__m256 ReN2 = _mm256_mul_ps(ReN, ReN);
 				__m256 ImN2 = _mm256_mul_ps(ImN, ImN);
@@ -43,7 +69,11 @@ void mandelbrot_avx2(struct Mb_GeneratorData *gen)
 				__m256 Dist = _mm256_add_ps(ReN2, ImN2);
 
 				// Mask those, which are inside the circle
-				__m256 mask = _mm256_cmp_ps(Dist, Radius2, _CMP_LT_OS);
+				// and not known to stay there forever
+				__m256 mask = _mm256_andnot_ps(
+					interior,
+					_mm256_cmp_ps(Dist, Radius2, _CMP_LT_OS)
+				);
 
 				// If everyone is outside, exit
 				if (!_mm256_movemask_ps(mask))
@@ -64,9 +94,39 @@ void mandelbrot_avx2(struct Mb_GeneratorData *gen)
 				ReN = _mm256_add_ps(_mm256_sub_ps(ReN2, ImN2), Re0);
 				ImN = _mm256_add_ps(ImSqr, Im0);
 
+				if (periodicity) {
+					__m256 DRe = _mm256_sub_ps(ReN, ReS);
+					__m256 DIm = _mm256_sub_ps(ImN, ImS);
+					__m256 Diff = _mm256_add_ps(
+						_mm256_mul_ps(DRe, DRe),
+						_mm256_mul_ps(DIm, DIm)
+					);
+					interior = _mm256_or_ps(
+						interior,
+						_mm256_and_ps(mask, _mm256_cmp_ps(Diff, PeriodEps2, _CMP_LT_OS))
+					);
+
+					if (max_steps == save_at) {
+						ReS = ReN;
+						ImS = ImN;
+						save_at *= 2;
+					}
+				}
 			}
 
-			_mm256_store_si256((__m256i*) &gen->exit_steps[ix + iy*gen->bwidth], steps);
+			steps = _mm256_castps_si256(_mm256_blendv_ps(
+				_mm256_castsi256_ps(steps),
+				_mm256_castsi256_ps(MaxSteps),
+				interior
+			));
+
+			// Loop which broke out also counts
+			trips += max_steps + (max_steps < gen->max_steps);
+
+			mb_store_steps8(gen, ix + iy*gen->bwidth, steps);
 		}
 	}
+
+	if (gen->stats)
+		atomic_fetch_add(&gen->stats->lane_slots, trips * 8);
 }
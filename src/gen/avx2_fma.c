@@ -0,0 +1,120 @@
+///
+/// AVX2 generators which iterate several groups of 8 pixels at once.
+///
+/// One group is a single chain of dependent mul/add ops, so the CPU
+/// mostly waits for their latency. With N independent groups (chains)
+/// in the same loop their ops overlap. Squares are also fused with
+/// additions using FMA.
+///
+/// All variants are made from one kernel where the number of chains
+/// is a compile time constant, see AVX2_FMA_VARIANT at the bottom.
+///
+#include "gen/api.h"
+#include "gen/pack.h"
+#include <x86intrin.h>
+#include <assert.h>
+#include <stdatomic.h>
+
+#define MAX_CHAINS 4
+#define TARGET __attribute__((target("avx2,fma")))
+
+/// Computes `chains` groups of 8 pixels, starting with (ix, iy).
+/// Returns number of loop trips made.
+TARGET __attribute__((always_inline))
+static inline uint64_t iterate_chains(
+		struct Mb_GeneratorData *gen,
+		int ix, int iy, const int chains
+)
+{
+	float sheight = gen->swidth / gen->bwidth * gen->bheight;
+	float DeltaRe0 = 1.0f / gen->bwidth * gen->swidth;
+
+	__m256 Radius2 = _mm256_set1_ps(EXIT_RADIUS*EXIT_RADIUS);
+	__m256 Im0 = _mm256_set1_ps((iy * 1.0f / gen->bheight - 0.5) * sheight + gen->yc);
+	__m256 DeltaRe = _mm256_mul_ps(
+		_mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7),
+		_mm256_set1_ps(DeltaRe0)
+	);
+
+	__m256 Re0[MAX_CHAINS], ReN[MAX_CHAINS], ImN[MAX_CHAINS];
+	__m256i steps[MAX_CHAINS];
+
+	#pragma GCC unroll 4
+	for (int c = 0; c < chains; ++c) {
+		float Re0_0 = ((ix + 8*c) * 1.0f / gen->bwidth - 0.5) * gen->swidth + gen->xc;
+		Re0[c] = _mm256_add_ps(DeltaRe, _mm256_set1_ps(Re0_0));
+		ReN[c] = Re0[c];
+		ImN[c] = Im0;
+		steps[c] = _mm256_setzero_si256();
+	}
+
+	int max_steps = 0;
+	for (; max_steps < gen->max_steps; max_steps++) {
+		int any = 0;
+
+		#pragma GCC unroll 4
+		for (int c = 0; c < chains; ++c) {
+			__m256 ImN2 = _mm256_mul_ps(ImN[c], ImN[c]);
+
+			// Dist = ReN * ReN + ImN^2
+			__m256 Dist = _mm256_fmadd_ps(ReN[c], ReN[c], ImN2);
+			__m256 mask = _mm256_cmp_ps(Dist, Radius2, _CMP_LT_OS);
+			any |= _mm256_movemask_ps(mask);
+
+			// Mask is -1 for the ones inside
+			steps[c] = _mm256_sub_epi32(steps[c], _mm256_castps_si256(mask));
+
+			// ImN = (ReN + ReN) * ImN + Im0
+			// ReN = ReN * ReN + (Re0 - ImN^2)
+			__m256 ReOld = ReN[c];
+			ReN[c] = _mm256_fmadd_ps(ReOld, ReOld, _mm256_sub_ps(Re0[c], ImN2));
+			ImN[c] = _mm256_fmadd_ps(_mm256_add_ps(ReOld, ReOld), ImN[c], Im0);
+		}
+
+		// Escaped lanes stay escaped, so their counters
+		// do not move while others are iterated
+		if (!any)
+			break;
+	}
+
+	#pragma GCC unroll 4
+	for (int c = 0; c < chains; ++c)
+		mb_store_steps8(gen, ix + 8*c + iy*gen->bwidth, steps[c]);
+
+	// Loop which broke out also counts
+	return max_steps + (max_steps < gen->max_steps);
+}
+
+TARGET __attribute__((always_inline))
+static inline void mandelbrot_chains(struct Mb_GeneratorData *gen, const int chains)
+{
+	assert(gen->bwidth % 8 == 0);
+	assert(gen->rect.x % 8 == 0 && gen->rect.w % 8 == 0);
+
+	uint64_t slots = 0;
+	int end = gen->rect.x + gen->rect.w;
+
+	for (int iy = gen->rect.y; iy < gen->rect.y + gen->rect.h && !mb_cancelled(gen); ++iy) {
+		int ix = gen->rect.x;
+		for (; ix + 8*chains <= end; ix += 8*chains)
+			slots += iterate_chains(gen, ix, iy, chains) * 8 * chains;
+
+		// Rest of the row, if it is not a multiple of the chains
+		for (; ix < end; ix += 8)
+			slots += iterate_chains(gen, ix, iy, 1) * 8;
+	}
+
+	if (gen->stats)
+		atomic_fetch_add(&gen->stats->lane_slots, slots);
+}
+
+#define AVX2_FMA_VARIANT(N) \
+	TARGET void mandelbrot_avx2_fma##N(struct Mb_GeneratorData *gen) \
+	{ \
+		mandelbrot_chains(gen, N); \
+	}
+
+AVX2_FMA_VARIANT(1)
+AVX2_FMA_VARIANT(2)
+AVX2_FMA_VARIANT(3)
+AVX2_FMA_VARIANT(4)
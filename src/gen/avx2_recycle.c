@@ -0,0 +1,160 @@
+///
+/// AVX2 generator which does not wait for the slowest pixel
+/// of the group. Lanes take pixels from a queue (rect in row-major
+/// order), and when a lane is done, its result is stored and the next
+/// pending pixel is loaded into it, so near the boundary all 8 lanes
+/// keep doing useful work.
+///
+#include "gen/api.h"
+#include <x86intrin.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#define LANES 8
+
+/// Refilling means spilling lanes to memory, so we
+/// wait for a few lanes to finish before doing it
+#define REFILL_THRESHOLD 3
+
+struct PixelQueue {
+	const struct Mb_GeneratorData *gen;
+	float *Re0Row;   // Re0 of every column in the rect
+	float Im0;       // Im0 of the current row
+	float sheight;
+	int x, y;        // next pixel, relative to the rect
+};
+
+static inline void queue_load_row(struct PixelQueue *q)
+{
+	int iy = q->gen->rect.y + q->y;
+	q->Im0 = (iy * 1.0f / q->gen->bheight - 0.5) * q->sheight + q->gen->yc;
+}
+
+static inline bool queue_empty(const struct PixelQueue *q)
+{
+	return q->y >= q->gen->rect.h;
+}
+
+static inline int queue_pop(struct PixelQueue *q, float *Re0, float *Im0)
+{
+	const struct Mb_GeneratorData *gen = q->gen;
+	int pixel = (gen->rect.x + q->x) + (gen->rect.y + q->y) * gen->bwidth;
+	*Re0 = q->Re0Row[q->x];
+	*Im0 = q->Im0;
+
+	if (++q->x == gen->rect.w) {
+		q->x = 0;
+		q->y++;
+		// Pixels in the lanes are finished, new rows are not started
+		if (mb_cancelled(gen))
+			q->y = gen->rect.h;
+		queue_load_row(q);
+	}
+	return pixel;
+}
+
+void mandelbrot_avx2_recycle(struct Mb_GeneratorData *gen)
+{
+	if (gen->rect.w <= 0 || gen->rect.h <= 0)
+		return;
+
+	struct PixelQueue queue = {
+		.gen = gen,
+		.Re0Row = malloc(gen->rect.w * sizeof(float)),
+		.sheight = gen->swidth / gen->bwidth * gen->bheight,
+	};
+	for (int x = 0; x < gen->rect.w; ++x) {
+		int ix = gen->rect.x + x;
+		queue.Re0Row[x] = (ix * 1.0f / gen->bwidth - 0.5) * gen->swidth + gen->xc;
+	}
+	queue_load_row(&queue);
+
+	// New values for refilled lanes
+	float Re0Arr[LANES] __attribute__((aligned(32))) = { 0 };
+	float Im0Arr[LANES] __attribute__((aligned(32))) = { 0 };
+	int IterArr[LANES] __attribute__((aligned(32))) = { 0 };
+	int IdleArr[LANES] __attribute__((aligned(32))) = { 0 };
+	int PixelArr[LANES];
+
+	int live = 0;
+	for (int lane = 0; lane < LANES; ++lane) {
+		if (queue_empty(&queue)) {
+			IdleArr[lane] = -1;
+			continue;
+		}
+		PixelArr[lane] = queue_pop(&queue, &Re0Arr[lane], &Im0Arr[lane]);
+		live++;
+	}
+
+	__m256 Re0 = _mm256_load_ps(Re0Arr), Im0 = _mm256_load_ps(Im0Arr);
+	__m256 ReN = Re0, ImN = Im0;
+	__m256i iter = _mm256_setzero_si256();
+	__m256i idle = _mm256_load_si256((__m256i*) IdleArr);
+
+	__m256 Radius2 = _mm256_set1_ps(EXIT_RADIUS*EXIT_RADIUS);
+	__m256i MaxSteps = _mm256_set1_epi32(gen->max_steps);
+	__m256 m256_Two = _mm256_set1_ps(2);
+
+	uint64_t trips = 0;
+
+	while (live > 0) {
+		trips++;
+
+		__m256 ReN2 = _mm256_mul_ps(ReN, ReN);
+		__m256 ImN2 = _mm256_mul_ps(ImN, ImN);
+		__m256 Dist = _mm256_add_ps(ReN2, ImN2);
+
+		// Lanes which are inside the circle and still have steps left
+		__m256i running = _mm256_and_si256(
+			_mm256_castps_si256(_mm256_cmp_ps(Dist, Radius2, _CMP_LT_OS)),
+			_mm256_cmpgt_epi32(MaxSteps, iter)
+		);
+
+		// ReN = ReN^2 - ImN^2 + Re0, ImN = 2 * ReN * ImN + Im0
+		// Finished lanes may be iterated further, escaped ones
+		// never come back and others are stopped by `iter`
+		iter = _mm256_sub_epi32(iter, running);
+		__m256 ImSqr = _mm256_mul_ps(m256_Two, _mm256_mul_ps(ReN, ImN));
+		ReN = _mm256_add_ps(_mm256_sub_ps(ReN2, ImN2), Re0);
+		ImN = _mm256_add_ps(ImSqr, Im0);
+
+		// Lanes which finished their pixel
+		int done = ~_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_or_si256(running, idle))) & 0xff;
+		if (!done || (__builtin_popcount(done) < REFILL_THRESHOLD && !queue_empty(&queue)))
+			continue;
+
+		_mm256_store_si256((__m256i*) IterArr, iter);
+
+		for (int lane = 0; lane < LANES; ++lane) {
+			if (!(done & (1 << lane)))
+				continue;
+
+			mb_steps_set(gen->exit_steps, gen->format, PixelArr[lane], IterArr[lane]);
+
+			if (queue_empty(&queue)) {
+				IdleArr[lane] = -1;
+				live--;
+			} else {
+				PixelArr[lane] = queue_pop(&queue, &Re0Arr[lane], &Im0Arr[lane]);
+				IterArr[lane] = 0;
+			}
+		}
+
+		// Take new values only for the refilled lanes
+		__m256 refill = _mm256_castsi256_ps(_mm256_andnot_si256(
+			_mm256_or_si256(running, idle),
+			_mm256_set1_epi32(-1)
+		));
+		Re0 = _mm256_blendv_ps(Re0, _mm256_load_ps(Re0Arr), refill);
+		Im0 = _mm256_blendv_ps(Im0, _mm256_load_ps(Im0Arr), refill);
+		ReN = _mm256_blendv_ps(ReN, Re0, refill);
+		ImN = _mm256_blendv_ps(ImN, Im0, refill);
+		iter = _mm256_load_si256((__m256i*) IterArr);
+		idle = _mm256_load_si256((__m256i*) IdleArr);
+	}
+
+	free(queue.Re0Row);
+
+	if (gen->stats)
+		atomic_fetch_add(&gen->stats->lane_slots, trips * LANES);
+}
@@ -0,0 +1,159 @@
+///
+/// AVX-512 generators, 16 pixels per vector. Lanes which are done
+/// are switched off by mask registers instead of blends.
+///
+/// Like in `avx2-fma*`, several vectors (chains) are iterated at once
+/// to hide latency of FMA, and the iteration is the same, so frames
+/// are identical to theirs. See AVX512_VARIANT at the bottom.
+///
+/// Compiled only if the compiler knows AVX-512 (MB_HAVE_AVX512).
+///
+#include "gen/api.h"
+#include "gen/pack.h"
+#include "gen/interior.h"
+#include <x86intrin.h>
+#include <assert.h>
+#include <stdatomic.h>
+
+#define MAX_CHAINS 3
+
+/// Computes `chains` vectors of 16 pixels, starting with (ix, iy).
+/// Only lower half of the last one is computed, if `last_full` is
+/// false. Returns number of loop trips made.
+__attribute__((always_inline))
+static inline uint64_t iterate_chains(
+		struct Mb_GeneratorData *gen,
+		int ix, int iy, bool last_full, const int chains
+)
+{
+	float sheight = gen->swidth / gen->bwidth * gen->bheight;
+	float DeltaRe0 = 1.0f / gen->bwidth * gen->swidth;
+	float PeriodEps = DeltaRe0 * PERIODICITY_EPS;
+
+	bool cardioid = gen->options & MB_OPT_CARDIOID;
+	bool periodicity = gen->options & MB_OPT_PERIODICITY;
+
+	// Vector is two groups of 8, each one is offset from its own
+	// first pixel, like in the 8-wide generators
+	__m512 Index = _mm512_setr_ps(0, 1, 2, 3, 4, 5, 6, 7, 0, 1, 2, 3, 4, 5, 6, 7);
+	__m512 Radius2 = _mm512_set1_ps(EXIT_RADIUS*EXIT_RADIUS);
+	__m512 PeriodEps2 = _mm512_set1_ps(PeriodEps * PeriodEps);
+	__m512i One = _mm512_set1_epi32(1);
+	__m512 Im0 = _mm512_set1_ps((iy * 1.0f / gen->bheight - 0.5) * sheight + gen->yc);
+
+	__m512 Re0[MAX_CHAINS], ReN[MAX_CHAINS], ImN[MAX_CHAINS];
+	__m512i steps[MAX_CHAINS];
+
+	// Lanes which are iterated and ones known to be inside the set
+	__mmask16 valid[MAX_CHAINS], interior[MAX_CHAINS];
+
+	// Points of the orbits saved for periodicity check,
+	// they are moved forward at iterations 2^k
+	__m512 ReS[MAX_CHAINS], ImS[MAX_CHAINS];
+	int save_at = 1;
+
+	#pragma GCC unroll 4
+	for (int c = 0; c < chains; ++c) {
+		int x = ix + 16*c;
+		float Re0_0 = (x * 1.0f / gen->bwidth - 0.5) * gen->swidth + gen->xc;
+		float Re0_8 = ((x + 8) * 1.0f / gen->bwidth - 0.5) * gen->swidth + gen->xc;
+		Re0[c] = _mm512_fmadd_ps(
+			Index, _mm512_set1_ps(DeltaRe0),
+			_mm512_mask_blend_ps(0xff00, _mm512_set1_ps(Re0_0), _mm512_set1_ps(Re0_8))
+		);
+		ReN[c] = ReS[c] = Re0[c];
+		ImN[c] = ImS[c] = Im0;
+		steps[c] = _mm512_setzero_si512();
+		valid[c] = c < chains - 1 || last_full ? 0xffff : 0x00ff;
+		interior[c] = cardioid ? mb_interior_mask16(Re0[c], Im0) : 0;
+	}
+
+	int max_steps = 0;
+	for (; max_steps < gen->max_steps; max_steps++) {
+		int any = 0;
+
+		#pragma GCC unroll 4
+		for (int c = 0; c < chains; ++c) {
+			__m512 ImN2 = _mm512_mul_ps(ImN[c], ImN[c]);
+
+			// Dist = ReN * ReN + ImN^2, lanes inside the circle
+			// and not known to stay there forever are counted
+			__m512 Dist = _mm512_fmadd_ps(ReN[c], ReN[c], ImN2);
+			__mmask16 mask = _mm512_mask_cmp_ps_mask(
+				valid[c] & ~interior[c], Dist, Radius2, _CMP_LT_OS
+			);
+			any |= mask;
+			steps[c] = _mm512_mask_add_epi32(steps[c], mask, steps[c], One);
+
+			// ImN = (ReN + ReN) * ImN + Im0
+			// ReN = ReN * ReN + (Re0 - ImN^2)
+			__m512 ReOld = ReN[c];
+			ReN[c] = _mm512_fmadd_ps(ReOld, ReOld, _mm512_sub_ps(Re0[c], ImN2));
+			ImN[c] = _mm512_fmadd_ps(_mm512_add_ps(ReOld, ReOld), ImN[c], Im0);
+
+			if (periodicity) {
+				__m512 DRe = _mm512_sub_ps(ReN[c], ReS[c]);
+				__m512 DIm = _mm512_sub_ps(ImN[c], ImS[c]);
+				__m512 Diff = _mm512_fmadd_ps(DRe, DRe, _mm512_mul_ps(DIm, DIm));
+				interior[c] |= _mm512_mask_cmp_ps_mask(mask, Diff, PeriodEps2, _CMP_LT_OS);
+			}
+		}
+
+		if (!any)
+			break;
+
+		if (periodicity && max_steps == save_at) {
+			#pragma GCC unroll 4
+			for (int c = 0; c < chains; ++c) {
+				ReS[c] = ReN[c];
+				ImS[c] = ImN[c];
+			}
+			save_at *= 2;
+		}
+	}
+
+	#pragma GCC unroll 4
+	for (int c = 0; c < chains; ++c) {
+		__m512i s = _mm512_mask_mov_epi32(steps[c], interior[c], _mm512_set1_epi32(gen->max_steps));
+		size_t at = ix + 16*c + iy*gen->bwidth;
+		mb_store_steps8(gen, at, _mm512_castsi512_si256(s));
+		if (valid[c] == 0xffff)
+			mb_store_steps8(gen, at + 8, _mm512_extracti64x4_epi64(s, 1));
+	}
+
+	// Loop which broke out also counts
+	return max_steps + (max_steps < gen->max_steps);
+}
+
+__attribute__((always_inline))
+static inline void mandelbrot_chains(struct Mb_GeneratorData *gen, const int chains)
+{
+	assert(gen->bwidth % 8 == 0);
+	assert(gen->rect.x % 8 == 0 && gen->rect.w % 8 == 0);
+
+	uint64_t slots = 0;
+	int end = gen->rect.x + gen->rect.w;
+
+	for (int iy = gen->rect.y; iy < gen->rect.y + gen->rect.h && !mb_cancelled(gen); ++iy) {
+		int ix = gen->rect.x;
+		for (; ix + 16*chains <= end; ix += 16*chains)
+			slots += iterate_chains(gen, ix, iy, true, chains) * 16 * chains;
+
+		// Rest of the row, it may end with a half of the vector
+		for (; ix < end; ix += 16)
+			slots += iterate_chains(gen, ix, iy, ix + 16 <= end, 1) * 16;
+	}
+
+	if (gen->stats)
+		atomic_fetch_add(&gen->stats->lane_slots, slots);
+}
+
+#define AVX512_VARIANT(N) \
+	void mandelbrot_avx512_fma##N(struct Mb_GeneratorData *gen) \
+	{ \
+		mandelbrot_chains(gen, N); \
+	}
+
+AVX512_VARIANT(1)
+AVX512_VARIANT(2)
+AVX512_VARIANT(3)
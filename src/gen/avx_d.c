@@ -0,0 +1,69 @@
+#include "gen/api.h"
+#include "gen/pack.h"
+#include <x86intrin.h>
+#include <assert.h>
+
+void mandelbrot_avx_d(struct Mb_GeneratorData *gen)
+{
+	double sheight = gen->swidth / gen->bwidth * gen->bheight;
+
+	assert(gen->bwidth % 4 == 0);
+	assert(gen->rect.x % 4 == 0 && gen->rect.w % 4 == 0);
+
+	double DeltaRe0 = 1.0 / gen->bwidth * gen->swidth;
+	double Re0Arr[4] __attribute__((aligned(32))) = { 0 };
+	for (int i = 1; i < 4; ++i)
+		Re0Arr[i] = Re0Arr[i-1] + DeltaRe0;
+
+	__m256d DeltaRe = _mm256_load_pd(Re0Arr);
+	__m256d Radius2 = _mm256_set1_pd(EXIT_RADIUS*EXIT_RADIUS);
+	__m256d m256d_One = _mm256_set1_pd(1);
+	__m256d m256d_Two = _mm256_set1_pd(2);
+
+	for (int iy = gen->rect.y; iy < gen->rect.y + gen->rect.h && !mb_cancelled(gen); ++iy) {
+		double Im0_Val = (iy * 1.0 / gen->bheight - 0.5) * sheight + gen->yc;
+		__m256d Im0 = _mm256_set1_pd(Im0_Val);
+
+		for (int ix = gen->rect.x; ix < gen->rect.x + gen->rect.w; ix += 4) {
+
+			double Re0_0 = (ix * 1.0 / gen->bwidth - 0.5) * gen->swidth + gen->xc;
+
+			__m256d Re0 = _mm256_add_pd(DeltaRe, _mm256_set1_pd(Re0_0));
+
+			__m256d ReN = Re0, ImN = Im0;
+
+			// No 256-bit integer ops in AVX, so count in doubles
+			__m256d steps = _mm256_setzero_pd();
+
+			for (int max_steps = 0; max_steps < gen->max_steps; max_steps++) {
+
+				__m256d ReN2 = _mm256_mul_pd(ReN, ReN);
+				__m256d ImN2 = _mm256_mul_pd(ImN, ImN);
+
+				__m256d Dist = _mm256_add_pd(ReN2, ImN2);
+
+				// Mask those, which are inside the circle
+				__m256d mask = _mm256_cmp_pd(Dist, Radius2, _CMP_LT_OS);
+
+				// If everyone is outside, exit
+				if (!_mm256_movemask_pd(mask))
+					break;
+
+				// Advance counter for ones inside
+				steps = _mm256_add_pd(steps, _mm256_and_pd(m256d_One, mask));
+
+				// ImSqr = 2 * ReN * ImN
+				__m256d ImSqr = _mm256_mul_pd(
+					m256d_Two,
+					_mm256_mul_pd(ReN, ImN)
+				);
+
+				ReN = _mm256_add_pd(_mm256_sub_pd(ReN2, ImN2), Re0);
+				ImN = _mm256_add_pd(ImSqr, Im0);
+
+			}
+
+			mb_store_steps4(gen, ix + iy*gen->bwidth, _mm256_cvtpd_epi32(steps));
+		}
+	}
+}
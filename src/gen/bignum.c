@@ -0,0 +1,173 @@
+#include "gen/bignum.h"
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#define N MB_BIG_LIMBS
+
+bool mb_big_is_neg(const struct Mb_Big *val)
+{
+	return val->limb[N-1] >> 31;
+}
+
+struct Mb_Big mb_big_neg(struct Mb_Big val)
+{
+	uint64_t carry = 1;
+	for (int i = 0; i < N; ++i) {
+		uint64_t t = (uint64_t) (uint32_t) ~val.limb[i] + carry;
+		val.limb[i] = t;
+		carry = t >> 32;
+	}
+	return val;
+}
+
+struct Mb_Big mb_big_add(const struct Mb_Big *a, const struct Mb_Big *b)
+{
+	struct Mb_Big res;
+	uint64_t carry = 0;
+	for (int i = 0; i < N; ++i) {
+		uint64_t t = (uint64_t) a->limb[i] + b->limb[i] + carry;
+		res.limb[i] = t;
+		carry = t >> 32;
+	}
+	return res;
+}
+
+struct Mb_Big mb_big_sub(const struct Mb_Big *a, const struct Mb_Big *b)
+{
+	struct Mb_Big nb = mb_big_neg(*b);
+	return mb_big_add(a, &nb);
+}
+
+struct Mb_Big mb_big_mul(const struct Mb_Big *a, const struct Mb_Big *b)
+{
+	bool neg = mb_big_is_neg(a) != mb_big_is_neg(b);
+	struct Mb_Big ma = mb_big_is_neg(a) ? mb_big_neg(*a) : *a;
+	struct Mb_Big mb = mb_big_is_neg(b) ? mb_big_neg(*b) : *b;
+
+	uint32_t prod[2*N] = { 0 };
+	for (int i = 0; i < N; ++i) {
+		uint64_t carry = 0;
+		for (int j = 0; j < N; ++j) {
+			uint64_t t = (uint64_t) ma.limb[i] * mb.limb[j] + prod[i+j] + carry;
+			prod[i+j] = t;
+			carry = t >> 32;
+		}
+		prod[i+N] = carry;
+	}
+
+	// Both have N-1 fractional limbs, so product has 2N-2 of them
+	struct Mb_Big res;
+	memcpy(res.limb, &prod[N-1], sizeof(res.limb));
+	return neg ? mb_big_neg(res) : res;
+}
+
+struct Mb_Big mb_big_from_double(double val)
+{
+	struct Mb_Big res;
+	double mag = fabs(val);
+
+	for (int i = N-1; i >= 0; --i) {
+		double part = floor(mag);
+		res.limb[i] = (uint32_t) part;
+		mag = (mag - part) * 4294967296.0;
+	}
+	return val < 0 ? mb_big_neg(res) : res;
+}
+
+double mb_big_to_double(const struct Mb_Big *val)
+{
+	struct Mb_Big mag = mb_big_is_neg(val) ? mb_big_neg(*val) : *val;
+	double res = 0;
+	for (int i = 0; i < N; ++i)
+		res += ldexp(mag.limb[i], 32 * (i - (N-1)));
+	return mb_big_is_neg(val) ? -res : res;
+}
+
+// Returns the remainder
+static uint32_t div_small(struct Mb_Big *val, uint32_t div)
+{
+	uint64_t rem = 0;
+	for (int i = N-1; i >= 0; --i) {
+		uint64_t cur = (rem << 32) | val->limb[i];
+		val->limb[i] = cur / div;
+		rem = cur % div;
+	}
+	return rem;
+}
+
+// Returns what overflowed out of the top limb
+static uint32_t mul_small(struct Mb_Big *val, uint32_t mul)
+{
+	uint64_t carry = 0;
+	for (int i = 0; i < N; ++i) {
+		uint64_t t = (uint64_t) val->limb[i] * mul + carry;
+		val->limb[i] = t;
+		carry = t >> 32;
+	}
+	return carry;
+}
+
+bool mb_big_from_str(struct Mb_Big *res, const char *str)
+{
+	bool neg = false;
+	if (*str == '-' || *str == '+')
+		neg = *str++ == '-';
+
+	const char *int_begin = str;
+	while (isdigit((unsigned char) *str))
+		++str;
+	const char *int_end = str;
+
+	const char *frac_begin = str, *frac_end = str;
+	if (*str == '.') {
+		frac_begin = ++str;
+		while (isdigit((unsigned char) *str))
+			++str;
+		frac_end = str;
+	}
+
+	if (*str != '\0' || (int_begin == int_end && frac_begin == frac_end))
+		return false;
+
+	struct Mb_Big val = { 0 };
+
+	// Fraction is accumulated from the last digit: f = (d + f) / 10
+	for (const char *c = frac_end; c != frac_begin; --c) {
+		val.limb[N-1] = c[-1] - '0';
+		div_small(&val, 10);
+	}
+
+	uint64_t int_part = 0;
+	for (const char *c = int_begin; c != int_end; ++c) {
+		int_part = int_part * 10 + (*c - '0');
+		if (int_part > INT32_MAX)
+			return false;
+	}
+	val.limb[N-1] = int_part;
+
+	*res = neg ? mb_big_neg(val) : val;
+	return true;
+}
+
+void mb_big_to_str(const struct Mb_Big *val, char *buf, size_t size, int digits)
+{
+	struct Mb_Big mag = mb_big_is_neg(val) ? mb_big_neg(*val) : *val;
+
+	int len = snprintf(
+		buf, size, "%s%u.",
+		mb_big_is_neg(val) ? "-" : "", mag.limb[N-1]
+	);
+	if (len < 0 || len >= (int) size)
+		return;
+	mag.limb[N-1] = 0;
+
+	for (int i = 0; i < digits && len + 1 < (int) size; ++i) {
+		mul_small(&mag, 10);
+		buf[len++] = '0' + mag.limb[N-1];
+		mag.limb[N-1] = 0;
+	}
+	if (len < (int) size)
+		buf[len] = '\0';
+}
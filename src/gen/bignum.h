@@ -0,0 +1,39 @@
+///
+/// Fixed-point numbers with more precision than double has,
+/// used for center of the frame on deep zooms
+///
+#ifndef I_GEN_BIGNUM
+#define I_GEN_BIGNUM
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// Total number of 32-bit limbs, one of them is the integer part,
+/// so we have 32 * 9 = 288 bits (~86 decimal digits) after the point
+#define MB_BIG_LIMBS 10
+#define MB_BIG_FRAC_BITS (32 * (MB_BIG_LIMBS - 1))
+
+/// Two's complement fixed point number, least significant limb first.
+/// Last limb is the integer part, so values are within ±2^31.
+struct Mb_Big {
+	uint32_t limb[MB_BIG_LIMBS];
+};
+
+struct Mb_Big mb_big_from_double(double val);
+double mb_big_to_double(const struct Mb_Big *val);
+
+/// Parses `[-]123.456` decimal. Returns false if the string is
+/// not a number or does not fit.
+bool mb_big_from_str(struct Mb_Big *res, const char *str);
+
+/// Prints number with given count of digits after the point
+void mb_big_to_str(const struct Mb_Big *val, char *buf, size_t size, int digits);
+
+bool mb_big_is_neg(const struct Mb_Big *val);
+struct Mb_Big mb_big_neg(struct Mb_Big val);
+struct Mb_Big mb_big_add(const struct Mb_Big *a, const struct Mb_Big *b);
+struct Mb_Big mb_big_sub(const struct Mb_Big *a, const struct Mb_Big *b);
+struct Mb_Big mb_big_mul(const struct Mb_Big *a, const struct Mb_Big *b);
+
+#endif
@@ -0,0 +1,239 @@
+///
+/// Continuation of orbits which have not escaped by the previous
+/// iteration limit, see `Mb_Orbits`. Orbits are a list, not a frame,
+/// so only pixels which are still iterated take vector lanes.
+///
+/// Iteration is the same as in `avx2-fma*`, with FMA in the scalar loop
+/// too. The kernel is compiled for AVX2 and FMA by an attribute, other
+/// CPUs get the scalar loop.
+///
+/// Options work like in the generators: with `cardioid` points known to
+/// be inside are not collected as orbits at all, with `periodicity` an
+/// orbit which came back to its saved point is inside. Its z stays on
+/// the cycle, so the next pass finds it again in a few iterations.
+///
+#include "gen/api.h"
+#include <x86intrin.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#define TARGET __attribute__((target("avx2,fma")))
+
+void mb_orbits_free(struct Mb_Orbits *orbits)
+{
+	free(orbits->pixel);
+	free(orbits->re);
+	free(orbits->im);
+	free(orbits->inside);
+	*orbits = (struct Mb_Orbits) { .steps = -1 };
+}
+
+// Same as in `avx2-fma*`: offset from the first pixel of the group of 8,
+// so orbits of their frames (and `avx512-fma*` ones) continue exactly
+static inline void pixel_coords(
+		const struct Mb_GeneratorData *gen, int pixel,
+		float *Re0, float *Im0
+)
+{
+	float sheight = gen->swidth / gen->bwidth * gen->bheight;
+	float DeltaRe0 = 1.0f / gen->bwidth * gen->swidth;
+	int ix = pixel % gen->bwidth, iy = pixel / gen->bwidth;
+	int group = ix / 8 * 8;
+	float Re0_0 = (group * 1.0f / gen->bwidth - 0.5) * gen->swidth + gen->xc;
+	*Re0 = fmaf(ix - group, DeltaRe0, Re0_0);
+	*Im0 = (iy * 1.0f / gen->bheight - 0.5) * sheight + gen->yc;
+}
+
+void mb_orbits_collect(const struct Mb_GeneratorData *gen, struct Mb_Orbits *orbits)
+{
+	int npixels = gen->bwidth * gen->bheight;
+	if (orbits->cap < npixels) {
+		orbits->cap = npixels;
+		orbits->pixel = realloc(orbits->pixel, npixels * sizeof(*orbits->pixel));
+		orbits->re = realloc(orbits->re, npixels * sizeof(*orbits->re));
+		orbits->im = realloc(orbits->im, npixels * sizeof(*orbits->im));
+		orbits->inside = realloc(orbits->inside, npixels * sizeof(*orbits->inside));
+	}
+
+	// Orbits start at z = c, like in the generators
+	bool cardioid = gen->options & MB_OPT_CARDIOID;
+	orbits->count = orbits->ninside = 0;
+	orbits->steps = 0;
+	for (int i = 0; i < npixels; ++i) {
+		if (mb_steps_get(gen->exit_steps, gen->format, i) != gen->max_steps)
+			continue;
+
+		float Re0, Im0;
+		pixel_coords(gen, i, &Re0, &Im0);
+		if (cardioid && mb_interior(Re0, Im0)) {
+			orbits->inside[orbits->ninside++] = i;
+			continue;
+		}
+		orbits->pixel[orbits->count] = i;
+		orbits->re[orbits->count] = Re0;
+		orbits->im[orbits->count] = Im0;
+		orbits->count++;
+	}
+}
+
+static int deepen_scalar(struct Mb_GeneratorData *gen, struct Mb_Orbits *o, int from, int to)
+{
+	bool periodicity = gen->options & MB_OPT_PERIODICITY;
+	float PeriodEps = 1.0f / gen->bwidth * gen->swidth * PERIODICITY_EPS;
+	int kept = from;
+	uint64_t trips = 0;
+
+	for (int i = from; i < to && !mb_cancelled(gen); ++i) {
+		float Re0, Im0;
+		pixel_coords(gen, o->pixel[i], &Re0, &Im0);
+		float ReN = o->re[i], ImN = o->im[i];
+
+		// Point of the orbit saved for periodicity check
+		float ReS = ReN, ImS = ImN;
+		int save_at = 1;
+
+		int steps = o->steps;
+		bool inside = false;
+		for (; !inside && steps < gen->max_steps; ++steps) {
+			float ImN2 = ImN * ImN;
+			if (!(fmaf(ReN, ReN, ImN2) < EXIT_RADIUS*EXIT_RADIUS))
+				break;
+
+			float ReOld = ReN;
+			ReN = fmaf(ReOld, ReOld, Re0 - ImN2);
+			ImN = fmaf(ReOld + ReOld, ImN, Im0);
+
+			if (periodicity) {
+				float DRe = ReN - ReS, DIm = ImN - ImS;
+				inside = fmaf(DRe, DRe, DIm * DIm) < PeriodEps * PeriodEps;
+				if (steps - o->steps == save_at) {
+					ReS = ReN;
+					ImS = ImN;
+					save_at *= 2;
+				}
+			}
+		}
+		trips += steps - o->steps;
+		if (inside)
+			steps = gen->max_steps;
+
+		mb_steps_set(gen->exit_steps, gen->format, o->pixel[i], steps);
+		if (steps == gen->max_steps) {
+			o->pixel[kept] = o->pixel[i];
+			o->re[kept] = ReN;
+			o->im[kept] = ImN;
+			kept++;
+		}
+	}
+
+	if (gen->stats)
+		atomic_fetch_add(&gen->stats->lane_slots, trips);
+	return kept - from;
+}
+
+TARGET
+static int deepen_avx2(struct Mb_GeneratorData *gen, struct Mb_Orbits *o, int from, int to)
+{
+	__m256 Radius2 = _mm256_set1_ps(EXIT_RADIUS*EXIT_RADIUS);
+	bool periodicity = gen->options & MB_OPT_PERIODICITY;
+	float PeriodEps = 1.0f / gen->bwidth * gen->swidth * PERIODICITY_EPS;
+	__m256 PeriodEps2 = _mm256_set1_ps(PeriodEps * PeriodEps);
+	int kept = from;
+	uint64_t trips = 0;
+
+	for (int i = from; i < to && !mb_cancelled(gen); i += 8) {
+		int n = to - i < 8 ? to - i : 8;
+
+		// Lanes past the end start outside, so they never count
+		float Re0Arr[8], Im0Arr[8], ReArr[8], ImArr[8];
+		int StepsArr[8];
+		for (int l = 0; l < 8; ++l) {
+			if (l < n) {
+				pixel_coords(gen, o->pixel[i + l], &Re0Arr[l], &Im0Arr[l]);
+				ReArr[l] = o->re[i + l];
+				ImArr[l] = o->im[i + l];
+			} else {
+				Re0Arr[l] = Im0Arr[l] = ImArr[l] = 0;
+				ReArr[l] = EXIT_RADIUS;
+			}
+		}
+
+		__m256 Re0 = _mm256_loadu_ps(Re0Arr), Im0 = _mm256_loadu_ps(Im0Arr);
+		__m256 ReN = _mm256_loadu_ps(ReArr), ImN = _mm256_loadu_ps(ImArr);
+		__m256i steps = _mm256_set1_epi32(o->steps);
+
+		// Lanes found to be periodic, and points of the orbits
+		// saved for the check, moved forward at trips 2^k
+		__m256 interior = _mm256_setzero_ps();
+		__m256 ReS = ReN, ImS = ImN;
+		int save_at = 1;
+
+		int max_steps = o->steps;
+		for (; max_steps < gen->max_steps; max_steps++) {
+			__m256 ImN2 = _mm256_mul_ps(ImN, ImN);
+
+			// Dist = ReN * ReN + ImN^2
+			__m256 Dist = _mm256_fmadd_ps(ReN, ReN, ImN2);
+			__m256 mask = _mm256_andnot_ps(interior, _mm256_cmp_ps(Dist, Radius2, _CMP_LT_OS));
+			if (!_mm256_movemask_ps(mask))
+				break;
+
+			// Mask is -1 for the ones inside
+			steps = _mm256_sub_epi32(steps, _mm256_castps_si256(mask));
+
+			// Escaped lanes keep going, but are not counted anymore
+			__m256 ReOld = ReN;
+			ReN = _mm256_fmadd_ps(ReOld, ReOld, _mm256_sub_ps(Re0, ImN2));
+			ImN = _mm256_fmadd_ps(_mm256_add_ps(ReOld, ReOld), ImN, Im0);
+
+			if (periodicity) {
+				__m256 DRe = _mm256_sub_ps(ReN, ReS);
+				__m256 DIm = _mm256_sub_ps(ImN, ImS);
+				__m256 Diff = _mm256_fmadd_ps(DRe, DRe, _mm256_mul_ps(DIm, DIm));
+				interior = _mm256_or_ps(
+					interior,
+					_mm256_and_ps(mask, _mm256_cmp_ps(Diff, PeriodEps2, _CMP_LT_OS))
+				);
+				if (max_steps - o->steps == save_at) {
+					ReS = ReN;
+					ImS = ImN;
+					save_at *= 2;
+				}
+			}
+		}
+		trips += max_steps - o->steps + (max_steps < gen->max_steps);
+
+		steps = _mm256_castps_si256(_mm256_blendv_ps(
+			_mm256_castsi256_ps(steps),
+			_mm256_castsi256_ps(_mm256_set1_epi32(gen->max_steps)),
+			interior
+		));
+		_mm256_storeu_si256((__m256i*) StepsArr, steps);
+		_mm256_storeu_ps(ReArr, ReN);
+		_mm256_storeu_ps(ImArr, ImN);
+
+		// Lanes are already loaded, so survivors may overwrite them
+		for (int l = 0; l < n; ++l) {
+			int pixel = o->pixel[i + l];
+			mb_steps_set(gen->exit_steps, gen->format, pixel, StepsArr[l]);
+			if (StepsArr[l] == gen->max_steps) {
+				o->pixel[kept] = pixel;
+				o->re[kept] = ReArr[l];
+				o->im[kept] = ImArr[l];
+				kept++;
+			}
+		}
+	}
+
+	if (gen->stats)
+		atomic_fetch_add(&gen->stats->lane_slots, trips * 8);
+	return kept - from;
+}
+
+int mb_deepen(struct Mb_GeneratorData *gen, struct Mb_Orbits *orbits, int from, int to)
+{
+	if (mb_isa_supported(MB_ISA_AVX2_FMA))
+		return deepen_avx2(gen, orbits, from, to);
+	return deepen_scalar(gen, orbits, from, to);
+}
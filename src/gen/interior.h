@@ -0,0 +1,80 @@
+///
+/// Vectorized checks for points which are known to be
+/// inside the set without iterating them
+///
+#ifndef I_GEN_INTERIOR
+#define I_GEN_INTERIOR
+
+#include <x86intrin.h>
+
+// Main cardioid: q (q + (x - 1/4)) <= y^2 / 4, where q = (x - 1/4)^2 + y^2
+// Period-2 bulb: (x + 1)^2 + y^2 <= 1/16
+
+static inline __m256 mb_interior_mask8(__m256 Re, __m256 Im)
+{
+	__m256 Y2 = _mm256_mul_ps(Im, Im);
+
+	__m256 Xq = _mm256_sub_ps(Re, _mm256_set1_ps(0.25f));
+	__m256 Q = _mm256_add_ps(_mm256_mul_ps(Xq, Xq), Y2);
+	__m256 cardioid = _mm256_cmp_ps(
+		_mm256_mul_ps(Q, _mm256_add_ps(Q, Xq)),
+		_mm256_mul_ps(Y2, _mm256_set1_ps(0.25f)),
+		_CMP_LE_OS
+	);
+
+	__m256 Xb = _mm256_add_ps(Re, _mm256_set1_ps(1));
+	__m256 bulb = _mm256_cmp_ps(
+		_mm256_add_ps(_mm256_mul_ps(Xb, Xb), Y2),
+		_mm256_set1_ps(1.0f / 16),
+		_CMP_LE_OS
+	);
+
+	return _mm256_or_ps(cardioid, bulb);
+}
+
+static inline __m128 mb_interior_mask4(__m128 Re, __m128 Im)
+{
+	__m128 Y2 = _mm_mul_ps(Im, Im);
+
+	__m128 Xq = _mm_sub_ps(Re, _mm_set1_ps(0.25f));
+	__m128 Q = _mm_add_ps(_mm_mul_ps(Xq, Xq), Y2);
+	__m128 cardioid = _mm_cmp_ps(
+		_mm_mul_ps(Q, _mm_add_ps(Q, Xq)),
+		_mm_mul_ps(Y2, _mm_set1_ps(0.25f)),
+		_CMP_LE_OS
+	);
+
+	__m128 Xb = _mm_add_ps(Re, _mm_set1_ps(1));
+	__m128 bulb = _mm_cmp_ps(
+		_mm_add_ps(_mm_mul_ps(Xb, Xb), Y2),
+		_mm_set1_ps(1.0f / 16),
+		_CMP_LE_OS
+	);
+
+	return _mm_or_ps(cardioid, bulb);
+}
+
+/// Same for 16 lanes, needs AVX-512
+static inline __mmask16 mb_interior_mask16(__m512 Re, __m512 Im)
+{
+	__m512 Y2 = _mm512_mul_ps(Im, Im);
+
+	__m512 Xq = _mm512_sub_ps(Re, _mm512_set1_ps(0.25f));
+	__m512 Q = _mm512_add_ps(_mm512_mul_ps(Xq, Xq), Y2);
+	__mmask16 cardioid = _mm512_cmp_ps_mask(
+		_mm512_mul_ps(Q, _mm512_add_ps(Q, Xq)),
+		_mm512_mul_ps(Y2, _mm512_set1_ps(0.25f)),
+		_CMP_LE_OS
+	);
+
+	__m512 Xb = _mm512_add_ps(Re, _mm512_set1_ps(1));
+	__mmask16 bulb = _mm512_cmp_ps_mask(
+		_mm512_add_ps(_mm512_mul_ps(Xb, Xb), Y2),
+		_mm512_set1_ps(1.0f / 16),
+		_CMP_LE_OS
+	);
+
+	return cardioid | bulb;
+}
+
+#endif
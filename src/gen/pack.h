@@ -0,0 +1,54 @@
+///
+/// Stores of vectors of step counts into `exit_steps`
+/// of any format, narrowing them with saturation
+///
+#ifndef I_GEN_PACK
+#define I_GEN_PACK
+
+#include "gen/api.h"
+#include <x86intrin.h>
+
+/// Stores 8 counts at pixel `i`, which must be a multiple of 8
+static inline void mb_store_steps8(const struct Mb_GeneratorData *gen, size_t i, __m256i steps)
+{
+	switch (gen->format) {
+	case MB_STEPS_I32:
+		_mm256_store_si256((__m256i*) ((int*) gen->exit_steps + i), steps);
+		break;
+	case MB_STEPS_U16: {
+		// Packing works in 128-bit halves, so the result is in qwords 0 and 2
+		__m256i words = _mm256_packus_epi32(steps, steps);
+		words = _mm256_permute4x64_epi64(words, 0x08);
+		_mm_storeu_si128((__m128i*) ((uint16_t*) gen->exit_steps + i), _mm256_castsi256_si128(words));
+		break;
+	}
+	case MB_STEPS_U8: {
+		__m256i words = _mm256_packus_epi32(steps, steps);
+		__m256i bytes = _mm256_packus_epi16(words, words);
+		bytes = _mm256_permutevar8x32_epi32(bytes, _mm256_setr_epi32(0, 4, 0, 0, 0, 0, 0, 0));
+		_mm_storel_epi64((__m128i*) ((uint8_t*) gen->exit_steps + i), _mm256_castsi256_si128(bytes));
+		break;
+	}
+	}
+}
+
+/// Stores 4 counts at pixel `i`, which must be a multiple of 4
+static inline void mb_store_steps4(const struct Mb_GeneratorData *gen, size_t i, __m128i steps)
+{
+	switch (gen->format) {
+	case MB_STEPS_I32:
+		_mm_store_si128((__m128i*) ((int*) gen->exit_steps + i), steps);
+		break;
+	case MB_STEPS_U16:
+		_mm_storel_epi64((__m128i*) ((uint16_t*) gen->exit_steps + i), _mm_packus_epi32(steps, steps));
+		break;
+	case MB_STEPS_U8: {
+		__m128i words = _mm_packus_epi32(steps, steps);
+		int bytes = _mm_cvtsi128_si32(_mm_packus_epi16(words, words));
+		memcpy((uint8_t*) gen->exit_steps + i, &bytes, sizeof(bytes));
+		break;
+	}
+	}
+}
+
+#endif
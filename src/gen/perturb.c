@@ -0,0 +1,371 @@
+///
+/// Deep zoom generator based on perturbation theory.
+///
+/// One reference orbit Z_{n+1} = Z_n^2 + C (with Z_0 = 0) is computed
+/// in the frame center with bignums. Every pixel c = C + dc then only
+/// tracks its difference d_n = z_n - Z_n, which is small and fits in a
+/// double just fine:
+///
+///     d_{n+1} = 2 Z_n d_n + d_n^2 + dc
+///
+/// First iterations are skipped for all pixels with series
+/// approximation d_n = A_n dc + B_n dc^2 + C_n dc^3.
+///
+/// When pixel orbit comes closer to 0 than to the reference (|z_n| < |d_n|),
+/// precision of d_n gets lost and image glitches. Such lanes are rebased:
+/// d_n becomes z_n and they continue from the start of the reference,
+/// which is also done when the reference escapes before the pixel.
+///
+#include "gen/api.h"
+#include "gen/pack.h"
+#include <x86intrin.h>
+#include <assert.h>
+#include <complex.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+/// Series approximation is used while its truncation
+/// error is this much smaller than the linear term
+#define SA_TOLERANCE 1e-12
+
+/// Most recently used references which are kept
+#define REF_SLOTS 4
+
+/// Reference iterations between checks if the frame is cancelled
+#define REF_CANCEL_CHECK 4096
+
+struct RefOrbit {
+	int refcount;
+	bool ready;             // orbit and series are computed
+	bool failed;            // computing it was cancelled, it is dropped
+	uint64_t used;          // `ref_clock` when it was last taken
+
+	// Key
+	struct Mb_Big xc, yc;
+	double swidth;
+	int bwidth, bheight, max_steps;
+
+	// Reference orbit in doubles, Z_0 .. Z_{len-1}. Last one
+	// is either escaped or Z_{max_steps}.
+	double *re, *im;
+	int len;
+
+	// Iterations skipped by series approximation
+	int skip;
+	double complex sa_a, sa_b, sa_c;
+};
+
+// Tiles of one frame are computed in parallel, but need the same
+// reference, so recent ones are shared. A reference is computed by the
+// first thread which needs it, without the lock, so threads which need
+// other ones (tiles of the server have their own centers) do not wait
+// for it. Others which need it wait for `ref_ready`.
+static pthread_mutex_t ref_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ref_ready = PTHREAD_COND_INITIALIZER;
+static struct RefOrbit *refs[REF_SLOTS];
+static uint64_t ref_clock;
+
+static void ref_release_locked(struct RefOrbit *ref)
+{
+	if (--ref->refcount > 0)
+		return;
+	free(ref->re);
+	free(ref->im);
+	free(ref);
+}
+
+static bool ref_matches(
+		const struct RefOrbit *ref,
+		const struct Mb_GeneratorData *gen,
+		const struct Mb_Big *xc, const struct Mb_Big *yc
+)
+{
+	return memcmp(&ref->xc, xc, sizeof(*xc)) == 0
+		&& memcmp(&ref->yc, yc, sizeof(*yc)) == 0
+		&& ref->swidth == gen->swidth
+		&& ref->bwidth == gen->bwidth
+		&& ref->bheight == gen->bheight
+		&& ref->max_steps == gen->max_steps;
+}
+
+/// Returns false if the frame was cancelled meanwhile
+static bool compute_orbit(struct RefOrbit *ref, const struct Mb_GeneratorData *gen)
+{
+	ref->re = aligned_alloc(32, (ref->max_steps + 4) * sizeof(double));
+	ref->im = aligned_alloc(32, (ref->max_steps + 4) * sizeof(double));
+
+	struct Mb_Big ReZ = { 0 }, ImZ = { 0 };
+	struct Mb_Big Radius2 = mb_big_from_double(EXIT_RADIUS*EXIT_RADIUS);
+
+	ref->len = 0;
+	while (true) {
+		ref->re[ref->len] = mb_big_to_double(&ReZ);
+		ref->im[ref->len] = mb_big_to_double(&ImZ);
+		ref->len++;
+
+		struct Mb_Big ReZ2 = mb_big_mul(&ReZ, &ReZ);
+		struct Mb_Big ImZ2 = mb_big_mul(&ImZ, &ImZ);
+		struct Mb_Big Dist = mb_big_add(&ReZ2, &ImZ2);
+		struct Mb_Big Over = mb_big_sub(&Radius2, &Dist);
+
+		if (mb_big_is_neg(&Over) || ref->len > ref->max_steps)
+			break;
+		if (ref->len % REF_CANCEL_CHECK == 0 && mb_cancelled(gen))
+			return false;
+
+		// Z = Z^2 + C
+		struct Mb_Big ReIm = mb_big_mul(&ReZ, &ImZ);
+		struct Mb_Big ReSqr = mb_big_sub(&ReZ2, &ImZ2);
+		struct Mb_Big ImSqr = mb_big_add(&ReIm, &ReIm);
+		ReZ = mb_big_add(&ReSqr, &ref->xc);
+		ImZ = mb_big_add(&ImSqr, &ref->yc);
+	}
+	return true;
+}
+
+static void compute_series(struct RefOrbit *ref)
+{
+	// Largest |dc| in the frame
+	double sheight = ref->swidth / ref->bwidth * ref->bheight;
+	double r = hypot(ref->swidth, sheight) / 2;
+
+	// d_1 = dc
+	double complex A = 1, B = 0, C = 0;
+	ref->skip = 1;
+	ref->sa_a = A;
+	ref->sa_b = B;
+	ref->sa_c = C;
+
+	for (int n = 1; n + 1 < ref->len; ++n) {
+		double complex Z = ref->re[n] + I * ref->im[n];
+
+		double complex NA = 2 * Z * A + 1;
+		double complex NB = 2 * Z * B + A * A;
+		double complex NC = 2 * Z * C + 2 * A * B;
+		A = NA, B = NB, C = NC;
+
+		// Pixels must not be able to escape while skipped
+		double complex Zn = ref->re[n+1] + I * ref->im[n+1];
+		if (cabs(Zn) + cabs(A) * r >= EXIT_RADIUS / 2)
+			break;
+		if (!(cabs(C) * r * r < SA_TOLERANCE * cabs(A)))
+			break;
+
+		ref->skip = n + 1;
+		ref->sa_a = A;
+		ref->sa_b = B;
+		ref->sa_c = C;
+	}
+}
+
+/// Takes the slot of `ref` back, if it still has one
+static void ref_unslot_locked(struct RefOrbit *ref)
+{
+	for (int i = 0; i < REF_SLOTS; ++i) {
+		if (refs[i] == ref) {
+			refs[i] = NULL;
+			ref_release_locked(ref);
+		}
+	}
+}
+
+/// Puts a new reference in the empty or least recently used slot
+static void ref_slot_locked(struct RefOrbit *ref)
+{
+	int slot = 0;
+	for (int i = 0; i < REF_SLOTS; ++i) {
+		if (!refs[i]) {
+			slot = i;
+			break;
+		}
+		if (refs[i]->used < refs[slot]->used)
+			slot = i;
+	}
+	if (refs[slot])
+		ref_release_locked(refs[slot]);
+	refs[slot] = ref;
+	ref->refcount++;
+}
+
+/// Reference for the frame, NULL if the frame was cancelled
+/// while it was computed or waited for
+static struct RefOrbit *ref_acquire(const struct Mb_GeneratorData *gen)
+{
+	struct Mb_Big xc, yc;
+	mb_hp_center(gen, &xc, &yc);
+
+	pthread_mutex_lock(&ref_mutex);
+
+	while (!mb_cancelled(gen)) {
+		struct RefOrbit *ref = NULL;
+		for (int i = 0; i < REF_SLOTS; ++i)
+			if (refs[i] && ref_matches(refs[i], gen, &xc, &yc))
+				ref = refs[i];
+
+		if (ref) {
+			ref->refcount++;
+			ref->used = ++ref_clock;
+			while (!ref->ready && !ref->failed)
+				pthread_cond_wait(&ref_ready, &ref_mutex);
+			if (ref->ready) {
+				pthread_mutex_unlock(&ref_mutex);
+				return ref;
+			}
+
+			// Whoever computed it was cancelled, try again
+			ref_release_locked(ref);
+			continue;
+		}
+
+		ref = calloc(1, sizeof(*ref));
+		ref->refcount = 1;
+		ref->used = ++ref_clock;
+		ref->xc = xc;
+		ref->yc = yc;
+		ref->swidth = gen->swidth;
+		ref->bwidth = gen->bwidth;
+		ref->bheight = gen->bheight;
+		ref->max_steps = gen->max_steps;
+		ref_slot_locked(ref);
+		pthread_mutex_unlock(&ref_mutex);
+
+		bool ok = compute_orbit(ref, gen);
+		if (ok)
+			compute_series(ref);
+
+		pthread_mutex_lock(&ref_mutex);
+		ref->ready = ok;
+		ref->failed = !ok;
+		if (!ok)
+			ref_unslot_locked(ref);
+		pthread_cond_broadcast(&ref_ready);
+		if (ok) {
+			pthread_mutex_unlock(&ref_mutex);
+			return ref;
+		}
+		ref_release_locked(ref);
+	}
+
+	pthread_mutex_unlock(&ref_mutex);
+	return NULL;
+}
+
+static void ref_release(struct RefOrbit *ref)
+{
+	pthread_mutex_lock(&ref_mutex);
+	ref_release_locked(ref);
+	pthread_mutex_unlock(&ref_mutex);
+}
+
+void mandelbrot_perturb(struct Mb_GeneratorData *gen)
+{
+	double sheight = gen->swidth / gen->bwidth * gen->bheight;
+
+	assert(gen->bwidth % 4 == 0);
+	assert(gen->rect.x % 4 == 0 && gen->rect.w % 4 == 0);
+
+	struct RefOrbit *ref = ref_acquire(gen);
+	if (!ref)
+		return;
+
+	__m256d Radius2 = _mm256_set1_pd(EXIT_RADIUS*EXIT_RADIUS);
+	__m256d m256d_Two = _mm256_set1_pd(2);
+	__m256i m256i_One = _mm256_set1_epi64x(1);
+	__m256i LastRef = _mm256_set1_epi64x(ref->len - 1);
+	__m256i PackIdx = _mm256_setr_epi32(0, 2, 4, 6, 0, 0, 0, 0);
+
+	for (int iy = gen->rect.y; iy < gen->rect.y + gen->rect.h && !mb_cancelled(gen); ++iy) {
+		double dIm0_Val = (iy * 1.0 / gen->bheight - 0.5) * sheight;
+
+		for (int ix = gen->rect.x; ix < gen->rect.x + gen->rect.w; ix += 4) {
+
+			// Starting deltas from the series
+			double dRe0Arr[4], dReArr[4], dImArr[4];
+			for (int i = 0; i < 4; ++i) {
+				dRe0Arr[i] = ((ix + i) * 1.0 / gen->bwidth - 0.5) * gen->swidth;
+				double complex dc = dRe0Arr[i] + I * dIm0_Val;
+				double complex d = ((ref->sa_c * dc + ref->sa_b) * dc + ref->sa_a) * dc;
+				dReArr[i] = creal(d);
+				dImArr[i] = cimag(d);
+			}
+
+			__m256d dRe0 = _mm256_loadu_pd(dRe0Arr);
+			__m256d dIm0 = _mm256_set1_pd(dIm0_Val);
+			__m256d dRe = _mm256_loadu_pd(dReArr);
+			__m256d dIm = _mm256_loadu_pd(dImArr);
+
+			// Index in the reference orbit, differs between lanes after rebasing
+			__m256i m = _mm256_set1_epi64x(ref->skip);
+
+			__m256d active = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+			__m256i steps = _mm256_set1_epi64x(ref->skip - 1);
+
+			for (int n = ref->skip; n <= gen->max_steps; ++n) {
+
+				__m256d ReZ = _mm256_i64gather_pd(ref->re, m, 8);
+				__m256d ImZ = _mm256_i64gather_pd(ref->im, m, 8);
+
+				// z = Z + d
+				__m256d ReN = _mm256_add_pd(ReZ, dRe);
+				__m256d ImN = _mm256_add_pd(ImZ, dIm);
+
+				__m256d Dist = _mm256_add_pd(
+					_mm256_mul_pd(ReN, ReN),
+					_mm256_mul_pd(ImN, ImN)
+				);
+
+				// Lanes which escaped once, never come back
+				active = _mm256_and_pd(active, _mm256_cmp_pd(Dist, Radius2, _CMP_LT_OS));
+				if (!_mm256_movemask_pd(active))
+					break;
+
+				steps = _mm256_sub_epi64(steps, _mm256_castpd_si256(active));
+
+				if (n == gen->max_steps)
+					break;
+
+				// Rebase when |z| < |d| or the reference has ended
+				__m256d DDist = _mm256_add_pd(
+					_mm256_mul_pd(dRe, dRe),
+					_mm256_mul_pd(dIm, dIm)
+				);
+				__m256d rebase = _mm256_or_pd(
+					_mm256_cmp_pd(Dist, DDist, _CMP_LT_OS),
+					_mm256_castsi256_pd(_mm256_cmpeq_epi64(m, LastRef))
+				);
+				dRe = _mm256_blendv_pd(dRe, ReN, rebase);
+				dIm = _mm256_blendv_pd(dIm, ImN, rebase);
+				ReZ = _mm256_andnot_pd(rebase, ReZ);
+				ImZ = _mm256_andnot_pd(rebase, ImZ);
+				m = _mm256_andnot_si256(_mm256_castpd_si256(rebase), m);
+
+				// d = 2 Z d + d^2 + dc
+				__m256d ReD = _mm256_add_pd(
+					_mm256_mul_pd(m256d_Two, _mm256_sub_pd(
+						_mm256_mul_pd(ReZ, dRe), _mm256_mul_pd(ImZ, dIm)
+					)),
+					_mm256_sub_pd(_mm256_mul_pd(dRe, dRe), _mm256_mul_pd(dIm, dIm))
+				);
+				__m256d ImD = _mm256_mul_pd(m256d_Two, _mm256_add_pd(
+					_mm256_add_pd(_mm256_mul_pd(ReZ, dIm), _mm256_mul_pd(ImZ, dRe)),
+					_mm256_mul_pd(dRe, dIm)
+				));
+
+				// Escaped lanes are parked at the start, so gather stays in bounds
+				dRe = _mm256_and_pd(active, _mm256_add_pd(ReD, dRe0));
+				dIm = _mm256_and_pd(active, _mm256_add_pd(ImD, dIm0));
+				m = _mm256_and_si256(
+					_mm256_castpd_si256(active),
+					_mm256_add_epi64(m, m256i_One)
+				);
+			}
+
+			mb_store_steps4(
+				gen, ix + iy*gen->bwidth,
+				_mm256_castsi256_si128(_mm256_permutevar8x32_epi32(steps, PackIdx))
+			);
+		}
+	}
+
+	ref_release(ref);
+}
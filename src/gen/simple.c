@@ -4,8 +4,8 @@ void mandelbrot_simple(struct Mb_GeneratorData *gen)
 {
 	float sheight = gen->swidth / gen->bwidth * gen->bheight;
 
-	for (int iy = 0; iy < gen->bheight; ++iy) {
-		for (int ix = 0; ix < gen->bwidth; ++ix) {
+	for (int iy = gen->rect.y; iy < gen->rect.y + gen->rect.h && !mb_cancelled(gen); ++iy) {
+		for (int ix = gen->rect.x; ix < gen->rect.x + gen->rect.w; ++ix) {
 
 			float Re0 = (ix * 1.0f / gen->bwidth - 0.5) * gen->swidth + gen->xc;
 			float Im0 = (iy * 1.0f / gen->bheight - 0.5) * sheight + gen->yc;
@@ -23,7 +23,7 @@ void mandelbrot_simple(struct Mb_GeneratorData *gen)
 				ImN = ImSqr + Im0;
 			}
 
-			gen->exit_steps[ix + iy*gen->bwidth] = steps;
+			mb_steps_set(gen->exit_steps, gen->format, ix + iy*gen->bwidth, steps);
 		}
 	}
 }
@@ -0,0 +1,28 @@
+#include "gen/api.h"
+
+void mandelbrot_simple_d(struct Mb_GeneratorData *gen)
+{
+	double sheight = gen->swidth / gen->bwidth * gen->bheight;
+
+	for (int iy = gen->rect.y; iy < gen->rect.y + gen->rect.h && !mb_cancelled(gen); ++iy) {
+		for (int ix = gen->rect.x; ix < gen->rect.x + gen->rect.w; ++ix) {
+
+			double Re0 = (ix * 1.0 / gen->bwidth - 0.5) * gen->swidth + gen->xc;
+			double Im0 = (iy * 1.0 / gen->bheight - 0.5) * sheight + gen->yc;
+
+			double ReN = Re0, ImN = Im0;
+
+			int steps = 0;
+			for (; ReN*ReN + ImN*ImN < EXIT_RADIUS*EXIT_RADIUS && steps < gen->max_steps; ++steps) {
+
+				double ReSqr = ReN*ReN - ImN*ImN;
+				double ImSqr = 2*ReN*ImN;
+
+				ReN = ReSqr + Re0;
+				ImN = ImSqr + Im0;
+			}
+
+			mb_steps_set(gen->exit_steps, gen->format, ix + iy*gen->bwidth, steps);
+		}
+	}
+}
@@ -0,0 +1,51 @@
+///
+/// Image files of the `render` tool, written strip by strip
+/// from the top, so the whole image is never in memory
+///
+#ifndef I_IMAGE
+#define I_IMAGE
+
+#include "color/api.h"
+#include "gen/api.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+enum Img_Format {
+	IMG_PNG,
+	IMG_PPM,
+	IMG_RAW,    // step counts without a header, for coloring later
+};
+
+struct Img_FormatName {
+	enum Img_Format format;
+	const char *name;
+};
+
+static const struct Img_FormatName img_formats[] = {
+	{ IMG_PNG, "png" },
+	{ IMG_PPM, "ppm" },
+	{ IMG_RAW, "raw" },
+};
+
+/// All of the writer state is here, so it can be saved
+/// and writing can be continued after a restart
+struct Img_Writer {
+	int fd;
+	enum Img_Format format;
+	int width, height;
+	enum Mb_StepsFormat steps_format;   // of raw files
+	uint64_t offset;                    // where the next bytes go
+	uint32_t adler;                     // of PNG pixel data written so far
+};
+
+/// Writes the header to an empty file
+bool img_begin(struct Img_Writer *w);
+
+/// Appends `rows` full rows. Raw files take `steps`,
+/// others take `colors`, both `width` pixels per row.
+bool img_write_rows(struct Img_Writer *w, const ARGB *colors, const void *steps, int rows);
+
+/// Writes what goes after the last row
+bool img_finish(struct Img_Writer *w);
+
+#endif
@@ -0,0 +1,399 @@
+///
+/// Renders images of any size to a file, in horizontal strips, so
+/// memory use depends only on the width. After every strip the state
+/// is saved next to the output, and an interrupted render started
+/// again with the same options continues from there.
+///
+#include "common.h"
+#include "color/api.h"
+#include "gen/api.h"
+#include "image/image.h"
+#include "render/api.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/// Default memory for one strip, MiB
+#define STRIP_MB 64
+
+#define CHECKPOINT_MAGIC "MBRENDR1"
+
+/// Everything which changes the image. A checkpoint
+/// is used only if these are exactly the same.
+struct RenderParams {
+	int width, height;
+	int max_steps;
+	enum Img_Format format;
+	unsigned options;
+	double swidth;
+	char generator[32];
+	char colorizer[32];
+	char xc[128], yc[128];
+};
+
+struct Checkpoint {
+	char magic[8];
+	struct RenderParams params;
+	uint64_t rows_done;
+	uint64_t offset;        // of the output, after rows_done rows
+	uint32_t adler;
+};
+
+struct ColorJob {
+	const struct Mb_Palette *palette;
+	ARGB *colors;
+	const void *steps;
+	enum Mb_StepsFormat format;
+	int width, stride;
+};
+
+static void color_row(struct ColorJob *job, int y)
+{
+	color_fill(
+		job->palette, job->colors + (size_t) y * job->width,
+		(const char*) job->steps + (size_t) y * job->stride * mb_steps_size(job->format),
+		job->format, job->width
+	);
+}
+
+static bool load_checkpoint(const char *path, struct Checkpoint *ckpt)
+{
+	FILE *f = fopen(path, "rb");
+	if (!f)
+		return false;
+	bool ok = fread(ckpt, sizeof(*ckpt), 1, f) == 1
+		&& memcmp(ckpt->magic, CHECKPOINT_MAGIC, sizeof(ckpt->magic)) == 0;
+	fclose(f);
+	return ok;
+}
+
+/// Written to a temporary file which replaces the old one,
+/// so there always is a complete checkpoint
+static bool save_checkpoint(const char *path, const struct Checkpoint *ckpt)
+{
+	char tmp[4096 + 8];
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+	int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return false;
+	bool ok = write(fd, ckpt, sizeof(*ckpt)) == sizeof(*ckpt) && fsync(fd) == 0;
+	ok = close(fd) == 0 && ok;
+	return ok && rename(tmp, path) == 0;
+}
+
+static int find_format(const char *name)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(img_formats); ++i)
+		if (strcmp(img_formats[i].name, name) == 0)
+			return img_formats[i].format;
+	return -1;
+}
+
+static int find_colorizer(const char *name)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(colorizers); ++i)
+		if (strcmp(colorizers[i].name, name) == 0)
+			return i;
+	return -1;
+}
+
+static void print_usage(const char *name)
+{
+	printf(
+			"Usage: %s -o FILE [-f FORMAT] [-W WIDTH] [-H HEIGHT] [-g GENERATOR_NAME]\n"
+			"       [-c COLORIZER] [-t THREADS] [-x X] [-y Y] [-w WIDTH] [-s MAX_STEPS]\n"
+			"       [-i] [-M MIB] [-h]\n", name
+	);
+	printf(
+			"  -h                 Prints this help message\n"
+			"  -o FILE            Output file. If FILE.ckpt exists, the render\n"
+			"                     which was interrupted is continued\n"
+			"  -f FORMAT          png, ppm or raw (step counts), by default\n"
+			"                     taken from the extension, png if it is unknown\n"
+			"  -W, -H PIXELS      Size of the image, %dx%d by default\n"
+			"  -g GENERATOR_NAME  Generator to compute with, `%s` by default,\n"
+			"                     a more precise one is taken if needed\n"
+			"  -c COLORIZER       Colorizer, `%s` by default\n"
+			"  -t THREADS         Number of threads, all CPUs by default\n"
+			"  -x X, -y Y         Center, (0, 0) by default, may have more\n"
+			"                     digits than double holds\n"
+			"  -w WIDTH           Width of the image on the plane, %g by default\n"
+			"  -s MAX_STEPS       Iteration limit, %d by default\n"
+			"  -i                 Enable interior checks\n"
+			"  -M MIB             Memory for one strip, %d by default\n",
+			WIN_WIDTH, WIN_HEIGHT,
+			generators[DEFAULT_GENERATOR].name, colorizers[DEFAULT_COLORIZER].name,
+			(double) INITIAL_SCALE, VIEWER_MAX_STEPS, STRIP_MB
+	);
+}
+
+int main(int argc, char **argv)
+{
+	const char *path = NULL;
+	const char *format_name = NULL;
+	const char *gen_name = generators[DEFAULT_GENERATOR].name;
+	const char *color_name = colorizers[DEFAULT_COLORIZER].name;
+	const char *xc_str = "0", *yc_str = "0";
+	int width = WIN_WIDTH, height = WIN_HEIGHT;
+	int threads = mb_cpu_count();
+	double swidth = INITIAL_SCALE;
+	int max_steps = VIEWER_MAX_STEPS;
+	unsigned options = 0;
+	int strip_mb = STRIP_MB;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "o:f:W:H:g:c:t:x:y:w:s:iM:h")) != -1) {
+		switch (opt) {
+		case 'h':
+			print_usage(argv[0]);
+			return 0;
+		case 'o':
+			path = optarg;
+			break;
+		case 'f':
+			format_name = optarg;
+			break;
+		case 'W':
+			width = atoi(optarg);
+			break;
+		case 'H':
+			height = atoi(optarg);
+			break;
+		case 'g':
+			gen_name = optarg;
+			break;
+		case 'c':
+			color_name = optarg;
+			break;
+		case 't':
+			threads = atoi(optarg);
+			break;
+		case 'x':
+			xc_str = optarg;
+			break;
+		case 'y':
+			yc_str = optarg;
+			break;
+		case 'w':
+			swidth = atof(optarg);
+			break;
+		case 's':
+			max_steps = atoi(optarg);
+			break;
+		case 'i':
+			options = MB_OPT_CARDIOID | MB_OPT_PERIODICITY;
+			break;
+		case 'M':
+			strip_mb = atoi(optarg);
+			break;
+		default:
+			print_usage(argv[0]);
+			return -1;
+		}
+	}
+
+	if (!path) {
+		printf("Error: no output file given\n");
+		return -1;
+	}
+
+	if (!format_name) {
+		const char *ext = strrchr(path, '.');
+		format_name = ext && find_format(ext + 1) >= 0 ? ext + 1 : "png";
+	}
+	int format = find_format(format_name);
+	if (format < 0) {
+		printf("Error: unknown format `%s`\n", format_name);
+		return -1;
+	}
+
+	int gen_idx = mb_find_generator(gen_name);
+	if (gen_idx < 0) {
+		printf("Error: unknown generator `%s` or the CPU does not support it\n", gen_name);
+		return -1;
+	}
+
+	int color_idx = find_colorizer(color_name);
+	if (color_idx < 0) {
+		printf("Error: unknown colorizer `%s`\n", color_name);
+		return -1;
+	}
+
+	struct Mb_Big xc, yc;
+	if (!mb_big_from_str(&xc, xc_str) || !mb_big_from_str(&yc, yc_str)) {
+		printf("Error: `-x` and `-y` expect decimal numbers\n");
+		return -1;
+	}
+
+	if (width < 1 || height < 1 || threads < 1 || max_steps < 1
+			|| strip_mb < 1 || !(swidth > 0)) {
+		printf("Error: invalid numeric argument\n");
+		return -1;
+	}
+
+	struct RenderParams params;
+	memset(&params, 0, sizeof(params));     // padding is compared too
+	params.width = width;
+	params.height = height;
+	params.max_steps = max_steps;
+	params.format = format;
+	params.options = options;
+	params.swidth = swidth;
+	snprintf(params.generator, sizeof(params.generator), "%s", gen_name);
+	snprintf(params.colorizer, sizeof(params.colorizer), "%s", color_name);
+	snprintf(params.xc, sizeof(params.xc), "%s", xc_str);
+	snprintf(params.yc, sizeof(params.yc), "%s", yc_str);
+
+	char ckpt_path[4096];
+	snprintf(ckpt_path, sizeof(ckpt_path), "%s.ckpt", path);
+
+	struct Img_Writer writer = {
+		.format = format,
+		.width = width,
+		.height = height,
+		.steps_format = mb_compact_format(max_steps),
+	};
+
+	struct Checkpoint ckpt;
+	bool resume = load_checkpoint(ckpt_path, &ckpt);
+	if (resume) {
+		if (memcmp(&ckpt.params, &params, sizeof(params)) != 0) {
+			printf("Error: `%s` is of a render with other options, "
+					"remove it to start again\n", ckpt_path);
+			return -1;
+		}
+
+		// Anything after the checkpoint is from an unfinished strip
+		writer.fd = open(path, O_RDWR);
+		if (writer.fd < 0 || ftruncate(writer.fd, ckpt.offset) < 0) {
+			printf("Error: failed to reopen `%s`: %s\n", path, strerror(errno));
+			return -1;
+		}
+		writer.offset = ckpt.offset;
+		writer.adler = ckpt.adler;
+		printf("Continuing from row %lu of %d\n", ckpt.rows_done, height);
+	} else {
+		writer.fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if (writer.fd < 0 || !img_begin(&writer)) {
+			printf("Error: failed to write `%s`: %s\n", path, strerror(errno));
+			return -1;
+		}
+		memset(&ckpt, 0, sizeof(ckpt));
+		memcpy(ckpt.magic, CHECKPOINT_MAGIC, sizeof(ckpt.magic));
+		ckpt.params = params;
+	}
+
+	// Generators need widths of whole groups of 8 pixels,
+	// so strips have extra pixels on the right, which are not written
+	int bwidth = (width + 7) / 8 * 8;
+	double pixel = swidth / width;
+
+	struct Mb_GeneratorData gdata = {
+		.format = writer.steps_format,
+		.bwidth = bwidth,
+		.max_steps = max_steps,
+		.swidth = bwidth * pixel,
+		.has_hp_center = true,
+		.options = options,
+		.stats = NULL,
+	};
+
+	size_t elem = mb_steps_size(gdata.format);
+	size_t strip_rows = ((size_t) strip_mb << 20) / (bwidth * (elem + sizeof(ARGB) + 3));
+	if (strip_rows < 1)
+		strip_rows = 1;
+	if (strip_rows > (size_t) height)
+		strip_rows = height;
+
+	gdata.exit_steps = aligned_alloc(32, (bwidth * strip_rows * elem + 31) / 32 * 32);
+	ARGB *colors = malloc(width * strip_rows * sizeof(*colors));
+
+	struct Mb_Pool *pool = mb_pool_create(threads);
+	struct Mb_Palette palette = { 0 };
+	color_palette_update(&palette, &colorizers[color_idx], max_steps);
+
+	// Pixel size is the same for all strips, and so is the generator
+	gdata.bheight = strip_rows;
+	int active = mb_pick_generator(gen_idx, &gdata);
+	printf(
+		"Rendering %dx%d with %s in strips of %zu rows\n",
+		width, height, generators[active].name, strip_rows
+	);
+
+	struct Mb_Big shift_x = mb_big_from_double((bwidth - width) / 2.0 * pixel);
+	gdata.xc_hp = mb_big_add(&xc, &shift_x);
+	gdata.xc = mb_big_to_double(&gdata.xc_hp);
+
+	double begin = wall_time_ms();
+	int first_row = ckpt.rows_done;
+	for (int y = first_row; y < height; y += strip_rows) {
+		int rows = height - y < (int) strip_rows ? height - y : (int) strip_rows;
+
+		struct Mb_Big shift_y = mb_big_from_double((y + rows / 2.0 - height / 2.0) * pixel);
+		gdata.yc_hp = mb_big_add(&yc, &shift_y);
+		gdata.yc = mb_big_to_double(&gdata.yc_hp);
+		gdata.bheight = rows;
+		gdata.rect = mb_full_rect(&gdata);
+
+		mb_render_tiled(pool, &generators[active], &gdata);
+
+		if (format == IMG_RAW) {
+			// Rows are packed in place, without the extra pixels
+			for (int r = 1; r < rows && bwidth != width; ++r)
+				memmove(
+					(char*) gdata.exit_steps + (size_t) r * width * elem,
+					(char*) gdata.exit_steps + (size_t) r * bwidth * elem,
+					width * elem
+				);
+		} else {
+			struct ColorJob job = {
+				&palette, colors, gdata.exit_steps, gdata.format, width, bwidth
+			};
+			mb_pool_run(pool, rows, (void (*)(void*, int)) color_row, &job);
+		}
+
+		if (!img_write_rows(&writer, colors, gdata.exit_steps, rows)
+				|| fdatasync(writer.fd) < 0) {
+			printf("\nError: failed to write `%s`: %s\n", path, strerror(errno));
+			return -1;
+		}
+
+		ckpt.rows_done = y + rows;
+		ckpt.offset = writer.offset;
+		ckpt.adler = writer.adler;
+		if (!save_checkpoint(ckpt_path, &ckpt)) {
+			printf("\nError: failed to save `%s`: %s\n", ckpt_path, strerror(errno));
+			return -1;
+		}
+
+		double elapsed = wall_time_ms() - begin;
+		int done = y + rows - first_row;
+		printf(
+			"\rRow %d of %d, %.1f%%, %.0f s left   ",
+			y + rows, height, 100.0 * (y + rows) / height,
+			elapsed / done * (height - y - rows) / 1000
+		);
+		fflush(stdout);
+	}
+	printf("\n");
+
+	if (!img_finish(&writer) || fsync(writer.fd) < 0) {
+		printf("Error: failed to write `%s`: %s\n", path, strerror(errno));
+		return -1;
+	}
+	close(writer.fd);
+	unlink(ckpt_path);
+
+	printf("Done in %.1f s, %.2f MiB\n", (wall_time_ms() - begin) / 1000, writer.offset / 1048576.0);
+
+	free(gdata.exit_steps);
+	free(colors);
+	color_palette_free(&palette);
+	mb_pool_destroy(pool);
+	return 0;
+}
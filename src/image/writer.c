@@ -0,0 +1,200 @@
+///
+/// PNG is written without compression: pixel data go in stored deflate
+/// blocks, one IDAT chunk per call. It is large, but needs no zlib and
+/// every strip is written independently of others.
+///
+#include "image/image.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/// Largest stored deflate block
+#define DEFLATE_BLOCK 65535
+
+static bool write_all(struct Img_Writer *w, const void *data, size_t size)
+{
+	const char *p = data;
+	while (size) {
+		ssize_t n = pwrite(w->fd, p, size, w->offset);
+		if (n <= 0)
+			return false;
+		p += n;
+		size -= n;
+		w->offset += n;
+	}
+	return true;
+}
+
+static uint32_t crc32_update(uint32_t crc, const uint8_t *data, size_t size)
+{
+	static uint32_t table[256];
+	if (!table[1]) {
+		for (uint32_t i = 0; i < 256; ++i) {
+			uint32_t c = i;
+			for (int k = 0; k < 8; ++k)
+				c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+			table[i] = c;
+		}
+	}
+
+	crc = ~crc;
+	for (size_t i = 0; i < size; ++i)
+		crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+	return ~crc;
+}
+
+static uint32_t adler32_update(uint32_t adler, const uint8_t *data, size_t size)
+{
+	uint32_t a = adler & 0xffff, b = adler >> 16;
+	while (size) {
+		// Sums can not overflow in this many bytes
+		size_t n = size < 5552 ? size : 5552;
+		for (size_t i = 0; i < n; ++i) {
+			a += data[i];
+			b += a;
+		}
+		a %= 65521;
+		b %= 65521;
+		data += n;
+		size -= n;
+	}
+	return b << 16 | a;
+}
+
+static void put_be32(uint8_t *out, uint32_t val)
+{
+	out[0] = val >> 24;
+	out[1] = val >> 16;
+	out[2] = val >> 8;
+	out[3] = val;
+}
+
+static bool write_chunk(struct Img_Writer *w, const char *type, const uint8_t *data, uint32_t size)
+{
+	uint8_t head[8], tail[4];
+	put_be32(head, size);
+	memcpy(head + 4, type, 4);
+	uint32_t crc = crc32_update(crc32_update(0, head + 4, 4), data, size);
+	put_be32(tail, crc);
+
+	return write_all(w, head, sizeof(head))
+		&& write_all(w, data, size)
+		&& write_all(w, tail, sizeof(tail));
+}
+
+bool img_begin(struct Img_Writer *w)
+{
+	w->offset = 0;
+	w->adler = 1;
+
+	switch (w->format) {
+	case IMG_PNG: {
+		static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+		uint8_t ihdr[13] = {
+			[8] = 8,        // bits per channel
+			[9] = 2,        // RGB
+		};
+		put_be32(ihdr, w->width);
+		put_be32(ihdr + 4, w->height);
+
+		// zlib header: deflate, 32K window, no dictionary
+		static const uint8_t zlib[2] = { 0x78, 0x01 };
+
+		return write_all(w, signature, sizeof(signature))
+			&& write_chunk(w, "IHDR", ihdr, sizeof(ihdr))
+			&& write_chunk(w, "IDAT", zlib, sizeof(zlib));
+	}
+	case IMG_PPM: {
+		char header[64];
+		int n = snprintf(header, sizeof(header), "P6\n%d %d\n255\n", w->width, w->height);
+		return write_all(w, header, n);
+	}
+	case IMG_RAW:
+		return true;
+	}
+	return false;
+}
+
+static void pack_rgb(uint8_t *out, const ARGB *colors, int n)
+{
+	for (int i = 0; i < n; ++i) {
+		out[3*i] = colors[i].r;
+		out[3*i + 1] = colors[i].g;
+		out[3*i + 2] = colors[i].b;
+	}
+}
+
+static bool write_png_rows(struct Img_Writer *w, const ARGB *colors, int rows)
+{
+	// Every row starts with its filter type, 0 is none
+	size_t row_size = 1 + 3 * (size_t) w->width;
+	size_t raw_size = row_size * rows;
+	size_t blocks = (raw_size + DEFLATE_BLOCK - 1) / DEFLATE_BLOCK;
+
+	uint8_t *raw = malloc(raw_size);
+	uint8_t *idat = malloc(raw_size + 5 * blocks);
+	if (!raw || !idat) {
+		free(raw);
+		free(idat);
+		return false;
+	}
+
+	for (int y = 0; y < rows; ++y) {
+		raw[y * row_size] = 0;
+		pack_rgb(raw + y * row_size + 1, colors + (size_t) y * w->width, w->width);
+	}
+	w->adler = adler32_update(w->adler, raw, raw_size);
+
+	// Blocks are never final, the last empty one is written by img_finish
+	uint8_t *out = idat;
+	for (size_t at = 0; at < raw_size; at += DEFLATE_BLOCK) {
+		uint16_t len = raw_size - at < DEFLATE_BLOCK ? raw_size - at : DEFLATE_BLOCK;
+		*out++ = 0;
+		*out++ = len;
+		*out++ = len >> 8;
+		*out++ = ~len;
+		*out++ = ~len >> 8;
+		memcpy(out, raw + at, len);
+		out += len;
+	}
+
+	bool ok = write_chunk(w, "IDAT", idat, out - idat);
+	free(raw);
+	free(idat);
+	return ok;
+}
+
+bool img_write_rows(struct Img_Writer *w, const ARGB *colors, const void *steps, int rows)
+{
+	switch (w->format) {
+	case IMG_PNG:
+		return write_png_rows(w, colors, rows);
+	case IMG_PPM: {
+		size_t size = 3 * (size_t) w->width * rows;
+		uint8_t *rgb = malloc(size);
+		if (!rgb)
+			return false;
+		pack_rgb(rgb, colors, w->width * rows);
+		bool ok = write_all(w, rgb, size);
+		free(rgb);
+		return ok;
+	}
+	case IMG_RAW:
+		return write_all(w, steps, (size_t) w->width * rows * mb_steps_size(w->steps_format));
+	}
+	return false;
+}
+
+bool img_finish(struct Img_Writer *w)
+{
+	if (w->format != IMG_PNG)
+		return true;
+
+	// Final empty stored block and checksum of the zlib stream
+	uint8_t end[9] = { 1, 0x00, 0x00, 0xff, 0xff };
+	put_be32(end + 5, w->adler);
+
+	return write_chunk(w, "IDAT", end, sizeof(end))
+		&& write_chunk(w, "IEND", NULL, 0);
+}
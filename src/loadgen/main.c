@@ -0,0 +1,409 @@
+///
+/// Load generator for the tile server. Clients behave like map front
+/// ends: each looks at a view of VIEW_TILES x VIEW_TILES tiles and asks
+/// for its tiles over several keep-alive connections, then moves the
+/// view somewhere else. Tiles of a view are asked by connections of
+/// the client at once, so duplicates are coalesced by the server, and
+/// tiles of recent views are hot in its cache.
+///
+#include "common.h"
+#include <errno.h>
+#include <getopt.h>
+#include <math.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/// Side of the view, tiles
+#define VIEW_TILES 4
+
+/// Longest response head
+#define HEAD_MAX 4096
+
+#define DEFAULT_PORT 8080
+
+struct Client {
+	// View number and its corner, moved by whoever finished it
+	pthread_mutex_t mutex;
+	uint64_t view;
+	int64_t vx, vy;
+	int asked;          // requests of the current view
+	uint64_t rng;
+};
+
+struct Options {
+	const char *unix_path;
+	int port;
+	int zoom;
+	const char *format;
+	int max_steps;      // 0 to not send it
+	int per_view;       // requests before the view moves
+	bool tag_views;     // send client and view, so old ones are superseded
+};
+
+struct Worker {
+	const struct Options *opts;
+	struct Client *client;
+	int client_idx;
+	atomic_int *left;   // requests left to send, for all workers
+
+	float *latencies;   // of tiles received, ms
+	int count, cap;
+	int statuses[6];    // by hundreds
+	int hits, computed, coalesced, superseded, failed;
+	uint64_t bytes;
+};
+
+static uint64_t xorshift(uint64_t *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+static int connect_to(const struct Options *opts)
+{
+	int fd;
+	if (opts->unix_path) {
+		struct sockaddr_un addr = { .sun_family = AF_UNIX };
+		snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", opts->unix_path);
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd >= 0 && connect(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+			close(fd);
+			return -1;
+		}
+	} else {
+		struct sockaddr_in addr = {
+			.sin_family = AF_INET,
+			.sin_port = htons(opts->port),
+			.sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+		};
+		fd = socket(AF_INET, SOCK_STREAM, 0);
+		if (fd >= 0 && connect(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+			close(fd);
+			return -1;
+		}
+		int one = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	}
+	return fd;
+}
+
+/// Picks the next tile of the client, moving the view when it is done
+static void next_tile(
+		const struct Options *opts, struct Client *client,
+		uint64_t *view, int64_t *x, int64_t *y
+)
+{
+	int64_t tiles = (int64_t) 1 << opts->zoom;
+	int64_t span = tiles < VIEW_TILES ? tiles : VIEW_TILES;
+
+	pthread_mutex_lock(&client->mutex);
+	if (client->asked == opts->per_view) {
+		client->view++;
+		client->vx = xorshift(&client->rng) % (tiles - span + 1);
+		client->vy = xorshift(&client->rng) % (tiles - span + 1);
+		client->asked = 0;
+	}
+	client->asked++;
+	*view = client->view;
+	*x = client->vx + xorshift(&client->rng) % span;
+	*y = client->vy + xorshift(&client->rng) % span;
+	pthread_mutex_unlock(&client->mutex);
+}
+
+static bool send_request(int fd, const char *req, size_t len)
+{
+	while (len) {
+		ssize_t n = send(fd, req, len, MSG_NOSIGNAL);
+		if (n <= 0)
+			return false;
+		req += n;
+		len -= n;
+	}
+	return true;
+}
+
+/// Reads the response, returns its status, -1 if the connection failed.
+/// Value of `X-Tile` goes to `tile`.
+static int read_response(int fd, char tile[32], uint64_t *bytes)
+{
+	char head[HEAD_MAX + 1];
+	size_t have = 0, head_len = 0;
+	while (!head_len) {
+		if (have == HEAD_MAX)
+			return -1;
+		ssize_t n = recv(fd, head + have, HEAD_MAX - have, 0);
+		if (n <= 0)
+			return -1;
+		have += n;
+		head[have] = '\0';
+		char *end = strstr(head, "\r\n\r\n");
+		if (end)
+			head_len = end + 4 - head;
+	}
+
+	int status;
+	if (sscanf(head, "HTTP/1.%*d %d", &status) != 1)
+		return -1;
+
+	size_t length = 0;
+	tile[0] = '\0';
+	for (char *line = strstr(head, "\r\n"); line && line < head + head_len; line = strstr(line + 2, "\r\n")) {
+		char *name = line + 2;
+		if (strncasecmp(name, "Content-Length:", 15) == 0)
+			length = strtoull(name + 15, NULL, 10);
+		else if (strncasecmp(name, "X-Tile:", 7) == 0)
+			sscanf(name + 7, " %31[a-z]", tile);
+	}
+
+	// Body is only counted
+	size_t body = have - head_len;
+	char sink[65536];
+	while (body < length) {
+		ssize_t n = recv(fd, sink, length - body < sizeof(sink) ? length - body : sizeof(sink), 0);
+		if (n <= 0)
+			return -1;
+		body += n;
+	}
+	*bytes += length;
+	return status;
+}
+
+static void record(struct Worker *w, float ms)
+{
+	if (w->count == w->cap) {
+		w->cap = w->cap ? w->cap * 2 : 1024;
+		w->latencies = realloc(w->latencies, w->cap * sizeof(*w->latencies));
+	}
+	w->latencies[w->count++] = ms;
+}
+
+static void worker_main(struct Worker *w)
+{
+	const struct Options *opts = w->opts;
+	int fd = -1;
+
+	while (atomic_fetch_sub(w->left, 1) > 0) {
+		if (fd < 0 && (fd = connect_to(opts)) < 0) {
+			w->failed++;
+			continue;
+		}
+
+		uint64_t view;
+		int64_t x, y;
+		next_tile(opts, w->client, &view, &x, &y);
+
+		char req[512];
+		int len = snprintf(req, sizeof(req), "GET /%d/%ld/%ld.%s?", opts->zoom, x, y, opts->format);
+		if (opts->max_steps)
+			len += snprintf(req + len, sizeof(req) - len, "max_steps=%d&", opts->max_steps);
+		if (opts->tag_views)
+			len += snprintf(req + len, sizeof(req) - len, "client=lg%d&view=%lu&", w->client_idx, view);
+		req[len - 1] = ' ';
+		len += snprintf(req + len, sizeof(req) - len, "HTTP/1.1\r\nHost: localhost\r\n\r\n");
+
+		char tile[32];
+		double begin = wall_time_ms();
+		int status = send_request(fd, req, len)
+			? read_response(fd, tile, &w->bytes) : -1;
+		double ms = wall_time_ms() - begin;
+
+		if (status < 0) {
+			w->failed++;
+			close(fd);
+			fd = -1;
+			continue;
+		}
+		w->statuses[status / 100 < 6 ? status / 100 : 5]++;
+		if (status == 410)
+			w->superseded++;
+		if (status != 200)
+			continue;
+
+		record(w, ms);
+		w->hits += strcmp(tile, "hit") == 0;
+		w->computed += strcmp(tile, "computed") == 0;
+		w->coalesced += strcmp(tile, "coalesced") == 0;
+	}
+
+	if (fd >= 0)
+		close(fd);
+}
+
+static int cmp_float(const void *pa, const void *pb)
+{
+	float a = *(const float*) pa, b = *(const float*) pb;
+	return (a > b) - (a < b);
+}
+
+/// Nearest rank percentile of sorted values
+static float percentile(const float *sorted, int n, double p)
+{
+	int rank = ceil(p / 100 * n);
+	return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+static void print_usage(const char *name)
+{
+	printf(
+			"Usage: %s [-p PORT | -u PATH] [-n REQUESTS] [-c CONNECTIONS] [-C CLIENTS]\n"
+			"       [-z ZOOM] [-f FORMAT] [-m MAX_STEPS] [-v REQUESTS] [-s] [-h]\n", name
+	);
+	printf(
+			"  -h              Prints this help message\n"
+			"  -p PORT         TCP port of the server on 127.0.0.1, %d by default\n"
+			"  -u PATH         Unix socket of the server instead\n"
+			"  -n REQUESTS     Number of requests to send, 1000 by default\n"
+			"  -c CONNECTIONS  Connections sending requests at once, 8 by default\n"
+			"  -C CLIENTS      Clients the connections are split between, each\n"
+			"                  looks at its own view, 2 by default\n"
+			"  -z ZOOM         Level of the tiles, 4 by default\n"
+			"  -f FORMAT       Tile format, `png`, `ppm` or `raw`, `png` by default\n"
+			"  -m MAX_STEPS    Iteration limit, server's default if not given\n"
+			"  -v REQUESTS     Requests of a client before its view moves, 32 by default\n"
+			"  -s              Tag requests with client and view, so the server\n"
+			"                  drops ones of views which were moved away from\n",
+			DEFAULT_PORT
+	);
+}
+
+int main(int argc, char **argv)
+{
+	struct Options opts = {
+		.port = DEFAULT_PORT,
+		.zoom = 4,
+		.format = "png",
+		.per_view = 32,
+	};
+	int requests = 1000, connections = 8, nclients = 2;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "p:u:n:c:C:z:f:m:v:sh")) != -1) {
+		switch (opt) {
+		case 'h':
+			print_usage(argv[0]);
+			return 0;
+		case 'p':
+			opts.port = atoi(optarg);
+			break;
+		case 'u':
+			opts.unix_path = optarg;
+			break;
+		case 'n':
+			requests = atoi(optarg);
+			break;
+		case 'c':
+			connections = atoi(optarg);
+			break;
+		case 'C':
+			nclients = atoi(optarg);
+			break;
+		case 'z':
+			opts.zoom = atoi(optarg);
+			break;
+		case 'f':
+			opts.format = optarg;
+			break;
+		case 'm':
+			opts.max_steps = atoi(optarg);
+			break;
+		case 'v':
+			opts.per_view = atoi(optarg);
+			break;
+		case 's':
+			opts.tag_views = true;
+			break;
+		default:
+			print_usage(argv[0]);
+			return -1;
+		}
+	}
+
+	if (requests < 1 || connections < 1 || nclients < 1 || nclients > connections
+			|| opts.zoom < 0 || opts.zoom > 48 || opts.max_steps < 0 || opts.per_view < 1) {
+		printf("Error: invalid numeric argument\n");
+		return -1;
+	}
+
+	struct Client *clients = calloc(nclients, sizeof(*clients));
+	for (int i = 0; i < nclients; ++i) {
+		pthread_mutex_init(&clients[i].mutex, NULL);
+		clients[i].rng = 0x9e3779b97f4a7c15ull * (i + 1);
+		// First request picks the first view
+		clients[i].asked = opts.per_view;
+	}
+
+	atomic_int left = requests;
+	struct Worker *workers = calloc(connections, sizeof(*workers));
+	pthread_t *threads = calloc(connections, sizeof(*threads));
+
+	double begin = wall_time_ms();
+	for (int i = 0; i < connections; ++i) {
+		workers[i] = (struct Worker) {
+			.opts = &opts,
+			.client = &clients[i % nclients],
+			.client_idx = i % nclients,
+			.left = &left,
+		};
+		pthread_create(&threads[i], NULL, (void*(*)(void*)) worker_main, &workers[i]);
+	}
+	for (int i = 0; i < connections; ++i)
+		pthread_join(threads[i], NULL);
+	double seconds = (wall_time_ms() - begin) / 1000;
+
+	// Totals of all connections
+	struct Worker total = { 0 };
+	for (int i = 0; i < connections; ++i) {
+		struct Worker *w = &workers[i];
+		for (int j = 0; j < w->count; ++j)
+			record(&total, w->latencies[j]);
+		for (int j = 0; j < 6; ++j)
+			total.statuses[j] += w->statuses[j];
+		total.hits += w->hits;
+		total.computed += w->computed;
+		total.coalesced += w->coalesced;
+		total.superseded += w->superseded;
+		total.failed += w->failed;
+		total.bytes += w->bytes;
+		free(w->latencies);
+	}
+
+	printf("Requests:    %d over %d connections of %d clients, level %d, %s\n",
+			requests, connections, nclients, opts.zoom, opts.format);
+	printf("Responses:   %d ok, %d superseded, %d other errors, %d failed to send\n",
+			total.statuses[2], total.superseded,
+			total.statuses[4] + total.statuses[5] - total.superseded, total.failed);
+	printf("Tiles:       %d from cache, %d computed, %d coalesced\n",
+			total.hits, total.computed, total.coalesced);
+	printf("Throughput:  %.1f tiles/s, %.1f MiB/s\n",
+			total.count / seconds, total.bytes / 1048576.0 / seconds);
+
+	if (total.count) {
+		qsort(total.latencies, total.count, sizeof(*total.latencies), cmp_float);
+		printf("Latency:     p50 %.2f ms, p90 %.2f ms, p99 %.2f ms, max %.2f ms\n",
+				percentile(total.latencies, total.count, 50),
+				percentile(total.latencies, total.count, 90),
+				percentile(total.latencies, total.count, 99),
+				total.latencies[total.count - 1]);
+	}
+
+	free(total.latencies);
+	for (int i = 0; i < nclients; ++i)
+		pthread_mutex_destroy(&clients[i].mutex);
+	free(clients);
+	free(workers);
+	free(threads);
+	return total.failed ? -1 : 0;
+}
@@ -0,0 +1,251 @@
+///
+/// Parallel rendering: a persistent thread pool and
+/// a tiled renderer running any generator on top of it
+///
+#ifndef I_RENDER_API
+#define I_RENDER_API
+
+#include "gen/api.h"
+
+#define TILE_WIDTH   64
+#define TILE_HEIGHT  16
+
+/// Side of tiles of the world grid kept by the viewer and the tile store
+#define CACHE_TILE_SIZE 64
+
+/// Mariani-Silver starts from squares of this size
+#define MS_TILE_SIZE 64
+/// Rectangles this small are computed directly
+#define MS_MIN_SIZE  12
+
+struct Mb_Pool;
+struct Mb_Palette;
+struct ARGB;
+
+/// Creates pool which runs tasks on `nthreads` threads, including
+/// the one calling `mb_pool_run`. So with 1 thread nothing is spawned.
+struct Mb_Pool *mb_pool_create(int nthreads);
+void mb_pool_destroy(struct Mb_Pool *pool);
+int mb_pool_threads(const struct Mb_Pool *pool);
+
+/// Runs `task(ctx, i)` for every i in [0, ntasks) and waits
+/// until all of them are done. Tasks are split between threads
+/// evenly, threads which finished their part steal from others.
+void mb_pool_run(
+		struct Mb_Pool *pool, int ntasks,
+		void (*task)(void *ctx, int i), void *ctx
+);
+
+/// Time pool threads have spent running tasks, summed over threads
+struct Mb_PoolTimes {
+	double cpu_ms;          // CPU time of the threads
+	uint64_t tsc_cycles;    // time stamp counter ticks
+};
+
+/// Totals since the pool was created, may be read between runs
+struct Mb_PoolTimes mb_pool_times(const struct Mb_Pool *pool);
+
+/// Same as `mb_pool_times`, for every thread of the pool separately
+void mb_pool_worker_times(const struct Mb_Pool *pool, struct Mb_PoolTimes *times);
+
+/// Pins thread `i` of the pool to CPU `cpus[i]`, worker 0 is the calling
+/// thread, its previous affinity is restored by `mb_pool_destroy`.
+/// Returns false if some of the CPUs can not be used.
+bool mb_pool_pin(struct Mb_Pool *pool, const int *cpus);
+
+/// Kernel thread ids of the pool threads, `mb_pool_threads` of them,
+/// for attaching profilers. Worker 0 is the calling thread.
+void mb_pool_thread_ids(struct Mb_Pool *pool, int *tids);
+
+/// Number of CPUs currently online
+int mb_cpu_count(void);
+
+/// Splits `gen->rect` into tiles and computes them with
+/// `generator` on all threads of the pool.
+void mb_render_tiled(
+		struct Mb_Pool *pool,
+		const struct Mb_Generator *generator,
+		struct Mb_GeneratorData *gen
+);
+
+/// Mariani-Silver subdivision: computes only the border of a
+/// rectangle, and if all of it is `max_steps` and the inside is known
+/// to be in the set, fills the inside. Otherwise splits it in four and
+/// recurses. The frame is the same as the generator gives.
+void mb_render_mariani(
+		struct Mb_Pool *pool,
+		const struct Mb_Generator *generator,
+		struct Mb_GeneratorData *gen
+);
+
+/// Computes the whole frame tile by tile and colors every tile right
+/// away into `out` (`pitch` pixels per row), so `gen->exit_steps` is
+/// not used. Returns false without doing anything for generators which
+/// can not compute a tile as a frame of its own (deep zoom ones).
+bool mb_render_fused(
+		struct Mb_Pool *pool,
+		const struct Mb_Generator *generator,
+		struct Mb_GeneratorData *gen,
+		const struct Mb_Palette *palette,
+		struct ARGB *out, int pitch
+);
+
+struct Mb_Renderer {
+	void (*render)(
+		struct Mb_Pool *pool,
+		const struct Mb_Generator *generator,
+		struct Mb_GeneratorData *gen
+	);
+	const char *name;
+};
+
+static const struct Mb_Renderer renderers[] = {
+	{ mb_render_tiled, "tiled" },
+	{ mb_render_mariani, "mariani-silver" },
+};
+
+#define DEFAULT_RENDERER 0
+
+/// Last frame rendered with `mb_render_incremental`, zero
+/// initialized one is empty
+struct Mb_PanCache {
+	void *exit_steps;
+	size_t bytes;
+	struct Mb_GeneratorData gen;
+	const struct Mb_Generator *generator;
+};
+
+void mb_pan_cache_free(struct Mb_PanCache *cache);
+
+/// Renders the whole frame (`gen->rect` is ignored) with `renderer`.
+/// If it is the cached one moved by a whole number of pixels,
+/// shifts the cached step counts and computes only the strips which
+/// came into view. Returns true in that case. Then stores the frame
+/// in the cache.
+bool mb_render_incremental(
+		struct Mb_PanCache *cache,
+		struct Mb_Pool *pool,
+		const struct Mb_Renderer *renderer,
+		const struct Mb_Generator *generator,
+		struct Mb_GeneratorData *gen
+);
+
+/// Raises iteration limit of the frame in `gen->exit_steps`, computed
+/// with `gen->max_steps`, to `max_steps`. Only pixels which have not
+/// escaped are iterated, from where `orbits` left them. Orbits iterated
+/// up to `gen->max_steps` are taken as ones of this frame, otherwise they
+/// are collected from it, so they must be reset (`steps = -1`) for every
+/// new frame. Float precision only, `gen->rect` is ignored. Interior
+/// options of `gen->options` are used like generators use them. The
+/// result is the frame computed with `max_steps` directly only if the
+/// frame is of a generator for which `mb_deepens_exactly` holds.
+void mb_render_deepen(
+		struct Mb_Pool *pool,
+		struct Mb_GeneratorData *gen,
+		struct Mb_Orbits *orbits,
+		int max_steps
+);
+
+/// Tile of the world grid, see `mb_render_cached`. Keys are only
+/// compared, so tiles of `mb_tile_cache_put` may be numbered otherwise.
+struct Mb_TileKey {
+	double pixel;
+	int64_t tx, ty;
+	int max_steps;
+	enum Mb_Precision precision;
+	unsigned options;
+};
+
+static inline uint64_t mb_tile_key_hash(const struct Mb_TileKey *key)
+{
+	uint64_t pixel_bits;
+	memcpy(&pixel_bits, &key->pixel, sizeof(pixel_bits));
+
+	uint64_t h = 0xcbf29ce484222325ull;
+	uint64_t parts[] = {
+		pixel_bits, key->tx, key->ty,
+		key->max_steps, key->precision, key->options
+	};
+	for (size_t i = 0; i < sizeof(parts) / sizeof(parts[0]); ++i)
+		h = (h ^ parts[i]) * 0x100000001b3ull;
+	return h ^ (h >> 29);
+}
+
+static inline bool mb_tile_key_equal(const struct Mb_TileKey *a, const struct Mb_TileKey *b)
+{
+	return a->pixel == b->pixel
+		&& a->tx == b->tx && a->ty == b->ty
+		&& a->max_steps == b->max_steps
+		&& a->precision == b->precision
+		&& a->options == b->options;
+}
+
+struct Mb_TileCache;
+struct Mb_TileStore;
+
+struct Mb_TileCacheStats {
+	uint64_t hits, misses;                // tiles, since the cache was created
+	uint64_t frame_hits, frame_misses;    // tiles of the last frame
+	uint64_t loads, frame_loads;          // misses found in the store
+	size_t bytes, max_bytes;
+};
+
+/// Cache of `tile_size` x `tile_size` tiles, least recently used ones are
+/// evicted when `max_bytes` is reached. Steps are kept in `format`, or in
+/// the smallest one which holds `max_steps` of the tile. Not thread safe.
+struct Mb_TileCache *mb_tile_cache_create(size_t max_bytes, int tile_size, enum Mb_StepsFormat format);
+void mb_tile_cache_destroy(struct Mb_TileCache *cache);
+struct Mb_TileCacheStats mb_tile_cache_stats(const struct Mb_TileCache *cache);
+
+/// Format steps of the tile are kept in
+enum Mb_StepsFormat mb_tile_cache_format(const struct Mb_TileCache *cache, const struct Mb_TileKey *key);
+
+/// Copies steps of the tile to `steps` if it is cached
+bool mb_tile_cache_get(struct Mb_TileCache *cache, const struct Mb_TileKey *key, void *steps);
+
+/// Keeps a copy of steps of the tile computed elsewhere, unless it is
+/// cached already
+void mb_tile_cache_put(struct Mb_TileCache *cache, const struct Mb_TileKey *key, const void *steps);
+
+/// Store to load missing tiles from and to save computed ones to,
+/// NULL to detach. It is not owned by the cache, which must have
+/// tiles of CACHE_TILE_SIZE.
+void mb_tile_cache_set_store(struct Mb_TileCache *cache, struct Mb_TileStore *store);
+
+/// Assembles the frame from tiles of the cache, computing missing ones
+/// on the pool. The frame is snapped to the nearest pixel of the grid,
+/// which starts at (0, 0). Returns false without doing anything if the
+/// frame cannot be cached (bignum precision or too far from 0 for the
+/// grid coordinates to be exact).
+bool mb_render_cached(
+		struct Mb_TileCache *cache,
+		struct Mb_Pool *pool,
+		const struct Mb_Generator *generator,
+		struct Mb_GeneratorData *gen
+);
+
+struct Mb_TileStoreStats {
+	uint64_t tiles;
+	size_t bytes;
+	bool writable;
+};
+
+/// Opens the tile store file, see `src/render/store.c` for its format.
+/// With `writable` creates it if needed, and becomes the writer unless
+/// another process already is one. Returns NULL and sets errno on failure.
+struct Mb_TileStore *mb_tile_store_open(const char *path, bool writable);
+void mb_tile_store_close(struct Mb_TileStore *store);
+struct Mb_TileStoreStats mb_tile_store_stats(const struct Mb_TileStore *store);
+
+/// Picks up records appended since the last call (by anyone)
+bool mb_tile_store_refresh(struct Mb_TileStore *store);
+
+/// Decodes the tile into `steps` (CACHE_TILE_SIZE^2 of them), returns
+/// false if it is not stored. May be called from several threads at
+/// once, but not together with `refresh` or `append`.
+bool mb_tile_store_load(const struct Mb_TileStore *store, const struct Mb_TileKey *key, int *steps);
+
+/// Only for the writer
+bool mb_tile_store_append(struct Mb_TileStore *store, const struct Mb_TileKey *key, const int *steps);
+
+#endif
@@ -0,0 +1,410 @@
+///
+/// Cache of step counts in world coordinates.
+///
+/// For every pixel size the plane is cut into a grid of pixels, starting
+/// at (0, 0), and the grid into squares of the cache's tile size. A frame is
+/// snapped to the grid, taken from the tiles which are already computed,
+/// and only missing ones are computed. So when the view goes back
+/// to the place it has been at, nothing has to be computed again.
+///
+/// Zoom steps are not powers of 2, so tiles of different levels do not
+/// nest as a quadtree, they are simply looked up in a hash table.
+/// Least recently used ones are evicted when the memory cap is reached.
+///
+/// Missing tiles are looked up in the tile store (if there is one)
+/// before computing them, and computed ones are appended to it.
+///
+/// Tiles which are computed elsewhere (the server has its own grid)
+/// are kept with `mb_tile_cache_get` and `mb_tile_cache_put`.
+///
+#include "render/api.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/// Grid coordinates must be exact in double
+#define MAX_GRID_COORD 0x1p52
+
+struct Tile {
+	struct Mb_TileKey key;
+	void *steps;
+	struct Tile *hash_next;
+	struct Tile *lru_prev, *lru_next;   // most recently used is the first
+	bool loaded;                        // came from the store
+	bool complete;                      // false if the frame was cancelled
+};
+
+struct Mb_TileCache {
+	size_t max_bytes;
+	struct Mb_TileCacheStats stats;
+	int tile_size;
+	enum Mb_StepsFormat format;         // widest one tiles are kept in
+
+	struct Tile **buckets;
+	size_t nbuckets;                    // power of 2
+	struct Tile *lru_first, *lru_last;
+
+	struct Mb_TileStore *store;
+};
+
+enum Mb_StepsFormat mb_tile_cache_format(const struct Mb_TileCache *cache, const struct Mb_TileKey *key)
+{
+	enum Mb_StepsFormat compact = mb_compact_format(key->max_steps);
+	return mb_steps_size(compact) < mb_steps_size(cache->format) ? compact : cache->format;
+}
+
+static size_t steps_bytes(const struct Mb_TileCache *cache, const struct Mb_TileKey *key)
+{
+	size_t pixels = (size_t) cache->tile_size * cache->tile_size;
+	return pixels * mb_steps_size(mb_tile_cache_format(cache, key));
+}
+
+static size_t tile_bytes(const struct Mb_TileCache *cache, const struct Mb_TileKey *key)
+{
+	return sizeof(struct Tile) + steps_bytes(cache, key);
+}
+
+struct Mb_TileCache *mb_tile_cache_create(size_t max_bytes, int tile_size, enum Mb_StepsFormat format)
+{
+	struct Mb_TileCache *cache = calloc(1, sizeof(*cache));
+	cache->max_bytes = max_bytes;
+	cache->stats.max_bytes = max_bytes;
+	cache->tile_size = tile_size;
+	cache->format = format;
+
+	// About two buckets per tile of 8-bit steps which fits
+	size_t tile = sizeof(struct Tile) + (size_t) tile_size * tile_size;
+	cache->nbuckets = 64;
+	while (cache->nbuckets < 2 * max_bytes / tile)
+		cache->nbuckets *= 2;
+	cache->buckets = calloc(cache->nbuckets, sizeof(*cache->buckets));
+
+	return cache;
+}
+
+void mb_tile_cache_destroy(struct Mb_TileCache *cache)
+{
+	for (struct Tile *t = cache->lru_first, *next; t; t = next) {
+		next = t->lru_next;
+		free(t->steps);
+		free(t);
+	}
+	free(cache->buckets);
+	free(cache);
+}
+
+void mb_tile_cache_set_store(struct Mb_TileCache *cache, struct Mb_TileStore *store)
+{
+	cache->store = store;
+}
+
+struct Mb_TileCacheStats mb_tile_cache_stats(const struct Mb_TileCache *cache)
+{
+	return cache->stats;
+}
+
+static void lru_unlink(struct Mb_TileCache *cache, struct Tile *t)
+{
+	if (t->lru_prev)
+		t->lru_prev->lru_next = t->lru_next;
+	else
+		cache->lru_first = t->lru_next;
+
+	if (t->lru_next)
+		t->lru_next->lru_prev = t->lru_prev;
+	else
+		cache->lru_last = t->lru_prev;
+}
+
+static void lru_push_front(struct Mb_TileCache *cache, struct Tile *t)
+{
+	t->lru_prev = NULL;
+	t->lru_next = cache->lru_first;
+	if (cache->lru_first)
+		cache->lru_first->lru_prev = t;
+	else
+		cache->lru_last = t;
+	cache->lru_first = t;
+}
+
+static struct Tile *cache_find(struct Mb_TileCache *cache, const struct Mb_TileKey *key)
+{
+	struct Tile *t = cache->buckets[mb_tile_key_hash(key) & (cache->nbuckets - 1)];
+	while (t && !mb_tile_key_equal(&t->key, key))
+		t = t->hash_next;
+	return t;
+}
+
+static struct Tile *cache_insert(struct Mb_TileCache *cache, const struct Mb_TileKey *key)
+{
+	struct Tile *t = calloc(1, sizeof(*t));
+	t->key = *key;
+	t->steps = aligned_alloc(32, (steps_bytes(cache, key) + 31) / 32 * 32);
+
+	struct Tile **bucket = &cache->buckets[mb_tile_key_hash(key) & (cache->nbuckets - 1)];
+	t->hash_next = *bucket;
+	*bucket = t;
+
+	lru_push_front(cache, t);
+	cache->stats.bytes += tile_bytes(cache, key);
+	return t;
+}
+
+static void cache_remove(struct Mb_TileCache *cache, struct Tile *t)
+{
+	lru_unlink(cache, t);
+
+	struct Tile **p = &cache->buckets[mb_tile_key_hash(&t->key) & (cache->nbuckets - 1)];
+	while (*p != t)
+		p = &(*p)->hash_next;
+	*p = t->hash_next;
+
+	cache->stats.bytes -= tile_bytes(cache, &t->key);
+	free(t->steps);
+	free(t);
+}
+
+static void cache_evict(struct Mb_TileCache *cache)
+{
+	while (cache->stats.bytes > cache->max_bytes && cache->lru_last)
+		cache_remove(cache, cache->lru_last);
+}
+
+bool mb_tile_cache_get(struct Mb_TileCache *cache, const struct Mb_TileKey *key, void *steps)
+{
+	struct Tile *t = cache_find(cache, key);
+	if (!t) {
+		cache->stats.misses++;
+		return false;
+	}
+
+	lru_unlink(cache, t);
+	lru_push_front(cache, t);
+	memcpy(steps, t->steps, steps_bytes(cache, key));
+	cache->stats.hits++;
+	return true;
+}
+
+void mb_tile_cache_put(struct Mb_TileCache *cache, const struct Mb_TileKey *key, const void *steps)
+{
+	if (cache_find(cache, key) || tile_bytes(cache, key) > cache->max_bytes)
+		return;
+
+	struct Tile *t = cache_insert(cache, key);
+	memcpy(t->steps, steps, steps_bytes(cache, key));
+	t->complete = true;
+	cache_evict(cache);
+}
+
+// The store keeps tiles as ints, cached ones may be narrower
+
+static bool store_load(
+		const struct Mb_TileStore *store, const struct Mb_TileKey *key,
+		void *steps, enum Mb_StepsFormat format
+)
+{
+	if (format == MB_STEPS_I32)
+		return mb_tile_store_load(store, key, steps);
+
+	int ints[CACHE_TILE_SIZE * CACHE_TILE_SIZE];
+	if (!mb_tile_store_load(store, key, ints))
+		return false;
+	for (int i = 0; i < CACHE_TILE_SIZE * CACHE_TILE_SIZE; ++i)
+		mb_steps_set(steps, format, i, ints[i]);
+	return true;
+}
+
+static void store_append(
+		struct Mb_TileStore *store, const struct Mb_TileKey *key,
+		const void *steps, enum Mb_StepsFormat format
+)
+{
+	if (format == MB_STEPS_I32) {
+		mb_tile_store_append(store, key, steps);
+		return;
+	}
+
+	int ints[CACHE_TILE_SIZE * CACHE_TILE_SIZE];
+	for (int i = 0; i < CACHE_TILE_SIZE * CACHE_TILE_SIZE; ++i)
+		ints[i] = mb_steps_get(steps, format, i);
+	mb_tile_store_append(store, key, ints);
+}
+
+struct MissingJob {
+	const struct Mb_TileCache *cache;
+	const struct Mb_Generator *generator;
+	const struct Mb_GeneratorData *gen;
+	struct Tile **tiles;
+};
+
+static void compute_tile(struct MissingJob *job, int i)
+{
+	struct Tile *t = job->tiles[i];
+	const struct Mb_TileStore *store = job->cache->store;
+	enum Mb_StepsFormat format = mb_tile_cache_format(job->cache, &t->key);
+	int size = job->cache->tile_size;
+	double pixel = t->key.pixel;
+
+	t->loaded = store && store_load(store, &t->key, t->steps, format);
+	t->complete = t->loaded;
+	if (t->loaded || mb_cancelled(job->gen))
+		return;
+
+	struct Mb_GeneratorData tile = *job->gen;
+	tile.exit_steps = t->steps;
+	tile.format = format;
+	tile.bwidth = tile.bheight = size;
+	tile.swidth = size * pixel;
+	tile.xc = (t->key.tx * size + size / 2) * pixel;
+	tile.yc = (t->key.ty * size + size / 2) * pixel;
+	tile.has_hp_center = false;
+	tile.rect = mb_full_rect(&tile);
+
+	job->generator->mandelbrot(&tile);
+
+	// Cancellation only moves forward, so if it is not seen
+	// now, no rows were skipped
+	t->complete = !mb_cancelled(&tile);
+}
+
+// Tiles may be kept in another format than the frame
+static void copy_row(
+		struct Mb_GeneratorData *gen, size_t at,
+		const void *src, enum Mb_StepsFormat format, size_t from, int n
+)
+{
+	if (gen->format == format) {
+		size_t size = mb_steps_size(format);
+		memcpy((char*) gen->exit_steps + at * size, (const char*) src + from * size, n * size);
+		return;
+	}
+	for (int i = 0; i < n; ++i)
+		mb_steps_set(gen->exit_steps, gen->format, at + i, mb_steps_get(src, format, from + i));
+}
+
+static int64_t floor_div(int64_t a, int64_t b)
+{
+	return a / b - (a % b != 0 && (a < 0) != (b < 0));
+}
+
+bool mb_render_cached(
+		struct Mb_TileCache *cache,
+		struct Mb_Pool *pool,
+		const struct Mb_Generator *generator,
+		struct Mb_GeneratorData *gen
+)
+{
+	int size = cache->tile_size;
+	if (generator->precision == MB_BIGNUM || size % generator->align != 0)
+		return false;
+
+	// Top left pixel of the frame on the grid
+	double pixel = gen->swidth / gen->bwidth;
+	double fx = gen->xc / pixel - gen->bwidth / 2.0;
+	double fy = gen->yc / pixel - gen->bheight / 2.0;
+	if (!(fabs(fx) < MAX_GRID_COORD && fabs(fy) < MAX_GRID_COORD))
+		return false;
+	int64_t gx = llround(fx), gy = llround(fy);
+
+	int64_t tx0 = floor_div(gx, size);
+	int64_t ty0 = floor_div(gy, size);
+	int64_t tx1 = floor_div(gx + gen->bwidth - 1, size);
+	int64_t ty1 = floor_div(gy + gen->bheight - 1, size);
+	int ntiles = (tx1 - tx0 + 1) * (ty1 - ty0 + 1);
+
+	struct Tile **tiles = malloc(ntiles * sizeof(*tiles));
+	struct Tile **missing = malloc(ntiles * sizeof(*missing));
+	int nmissing = 0;
+
+	// Used tiles are moved to the front, so they are evicted last
+	int n = 0;
+	for (int64_t ty = ty0; ty <= ty1; ++ty) {
+		for (int64_t tx = tx0; tx <= tx1; ++tx) {
+			struct Mb_TileKey key = {
+				.pixel = pixel,
+				.tx = tx, .ty = ty,
+				.max_steps = gen->max_steps,
+				.precision = generator->precision,
+				.options = gen->options,
+			};
+
+			struct Tile *t = cache_find(cache, &key);
+			if (t) {
+				lru_unlink(cache, t);
+				lru_push_front(cache, t);
+			} else {
+				t = cache_insert(cache, &key);
+				missing[nmissing++] = t;
+			}
+			tiles[n++] = t;
+		}
+	}
+
+	// Pick up tiles other processes have written since last frame
+	if (cache->store)
+		mb_tile_store_refresh(cache->store);
+
+	struct MissingJob job = { cache, generator, gen, missing };
+	if (nmissing)
+		mb_pool_run(pool, nmissing, (void (*)(void*, int)) compute_tile, &job);
+
+	// If the frame was cancelled, tiles which were not finished are
+	// dropped, finished ones are kept for the next frames
+	int nloaded = 0;
+	for (int i = 0; i < nmissing; ++i) {
+		if (!missing[i]->complete)
+			cache_remove(cache, missing[i]);
+		else if (missing[i]->loaded)
+			nloaded++;
+		else if (cache->store && mb_tile_store_stats(cache->store).writable)
+			store_append(
+				cache->store, &missing[i]->key, missing[i]->steps,
+				mb_tile_cache_format(cache, &missing[i]->key)
+			);
+	}
+
+	if (mb_cancelled(gen)) {
+		free(tiles);
+		free(missing);
+		return true;
+	}
+
+	// Assemble the frame
+	n = 0;
+	for (int64_t ty = ty0; ty <= ty1; ++ty) {
+		for (int64_t tx = tx0; tx <= tx1; ++tx) {
+			const struct Tile *t = tiles[n++];
+
+			// Part of the tile inside the frame, in frame pixels
+			int x0 = fmax(tx * size - gx, 0);
+			int y0 = fmax(ty * size - gy, 0);
+			int x1 = fmin((tx + 1) * size - gx, gen->bwidth);
+			int y1 = fmin((ty + 1) * size - gy, gen->bheight);
+			enum Mb_StepsFormat format = mb_tile_cache_format(cache, &t->key);
+
+			for (int y = y0; y < y1; ++y) {
+				int tile_x = gx + x0 - tx * size;
+				int tile_y = gy + y - ty * size;
+				copy_row(
+					gen, x0 + y * gen->bwidth,
+					t->steps, format, tile_x + tile_y * size, x1 - x0
+				);
+			}
+		}
+	}
+
+	cache->stats.hits += ntiles - nmissing;
+	cache->stats.misses += nmissing;
+	cache->stats.frame_hits = ntiles - nmissing;
+	cache->stats.frame_misses = nmissing;
+	cache->stats.loads += nloaded;
+	cache->stats.frame_loads = nloaded;
+
+	// Tiles of this frame may make the cache a bit bigger than allowed
+	// for a while, but they are never evicted before being used
+	cache_evict(cache);
+
+	free(tiles);
+	free(missing);
+	return true;
+}
@@ -0,0 +1,64 @@
+///
+/// Progressive deepening: raising the iteration limit of a computed
+/// frame by continuing only the pixels which have not escaped yet.
+///
+/// Orbits are split into chunks for the pool. Every chunk packs its
+/// survivors to its start, then chunks are packed together.
+///
+#include "render/api.h"
+#include <stdlib.h>
+#include <string.h>
+
+/// Orbits per pool task
+#define DEEPEN_CHUNK 2048
+
+struct DeepenJob {
+	struct Mb_GeneratorData *gen;
+	struct Mb_Orbits *orbits;
+	int *kept;
+};
+
+static void deepen_chunk(struct DeepenJob *job, int i)
+{
+	int from = i * DEEPEN_CHUNK;
+	int to = from + DEEPEN_CHUNK < job->orbits->count ? from + DEEPEN_CHUNK : job->orbits->count;
+	job->kept[i] = mb_deepen(job->gen, job->orbits, from, to);
+}
+
+void mb_render_deepen(
+		struct Mb_Pool *pool,
+		struct Mb_GeneratorData *gen,
+		struct Mb_Orbits *orbits,
+		int max_steps
+)
+{
+	if (orbits->steps != gen->max_steps)
+		mb_orbits_collect(gen, orbits);
+
+	gen->max_steps = max_steps;
+	for (int i = 0; i < orbits->ninside; ++i)
+		mb_steps_set(gen->exit_steps, gen->format, orbits->inside[i], max_steps);
+
+	int nchunks = (orbits->count + DEEPEN_CHUNK - 1) / DEEPEN_CHUNK;
+	struct DeepenJob job = { gen, orbits, malloc(nchunks * sizeof(int)) };
+	if (nchunks)
+		mb_pool_run(pool, nchunks, (void (*)(void*, int)) deepen_chunk, &job);
+
+	if (mb_cancelled(gen)) {
+		orbits->steps = -1;
+		free(job.kept);
+		return;
+	}
+
+	int count = 0;
+	for (int i = 0; i < nchunks; ++i) {
+		int from = i * DEEPEN_CHUNK;
+		memmove(&orbits->pixel[count], &orbits->pixel[from], job.kept[i] * sizeof(*orbits->pixel));
+		memmove(&orbits->re[count], &orbits->re[from], job.kept[i] * sizeof(*orbits->re));
+		memmove(&orbits->im[count], &orbits->im[from], job.kept[i] * sizeof(*orbits->im));
+		count += job.kept[i];
+	}
+	orbits->count = count;
+	orbits->steps = max_steps;
+	free(job.kept);
+}
@@ -0,0 +1,84 @@
+///
+/// Renderer which colors every tile right after computing it, so
+/// step counts stay in a small buffer on the stack and only colors
+/// are written to memory
+///
+#include "render/api.h"
+#include "color/api.h"
+
+struct FusedJob {
+	const struct Mb_Generator *generator;
+	const struct Mb_GeneratorData *gen;
+	const struct Mb_Palette *palette;
+	ARGB *out;
+	int pitch;
+	int tiles_x;
+};
+
+static void render_tile(struct FusedJob *job, int i)
+{
+	const struct Mb_GeneratorData *gen = job->gen;
+	struct Mb_Rect r = {
+		.x = (i % job->tiles_x) * TILE_WIDTH,
+		.y = (i / job->tiles_x) * TILE_HEIGHT,
+		.w = TILE_WIDTH,
+		.h = TILE_HEIGHT,
+	};
+	if (r.x + r.w > gen->bwidth)
+		r.w = gen->bwidth - r.x;
+	if (r.y + r.h > gen->bheight)
+		r.h = gen->bheight - r.y;
+
+	int steps[TILE_WIDTH * TILE_HEIGHT] __attribute__((aligned(32)));
+
+	// The tile is a frame of its own, with the same pixels
+	double pixel = gen->swidth / gen->bwidth;
+	struct Mb_GeneratorData tile = *gen;
+	tile.exit_steps = steps;
+	tile.format = MB_STEPS_I32;
+	tile.bwidth = r.w;
+	tile.bheight = r.h;
+	tile.swidth = r.w * pixel;
+	tile.xc = gen->xc + (r.x + r.w / 2.0 - gen->bwidth / 2.0) * pixel;
+	tile.yc = gen->yc + (r.y + r.h / 2.0 - gen->bheight / 2.0) * pixel;
+	tile.has_hp_center = false;
+	tile.rect = mb_full_rect(&tile);
+
+	job->generator->mandelbrot(&tile);
+
+	for (int y = 0; y < r.h; ++y)
+		color_fill(
+			job->palette, job->out + (r.y + y) * job->pitch + r.x,
+			&steps[y * r.w], MB_STEPS_I32, r.w
+		);
+}
+
+bool mb_render_fused(
+		struct Mb_Pool *pool,
+		const struct Mb_Generator *generator,
+		struct Mb_GeneratorData *gen,
+		const struct Mb_Palette *palette,
+		ARGB *out, int pitch
+)
+{
+	// Tiles are computed around their own centers, which needs
+	// their own reference orbits for deep zoom ones
+	if (generator->precision == MB_BIGNUM || TILE_WIDTH % generator->align != 0)
+		return false;
+
+	struct FusedJob job = {
+		.generator = generator,
+		.gen = gen,
+		.palette = palette,
+		.out = out,
+		.pitch = pitch,
+		.tiles_x = (gen->bwidth + TILE_WIDTH - 1) / TILE_WIDTH,
+	};
+	int tiles_y = (gen->bheight + TILE_HEIGHT - 1) / TILE_HEIGHT;
+
+	mb_pool_run(
+		pool, job.tiles_x * tiles_y,
+		(void (*)(void*, int)) render_tile, &job
+	);
+	return true;
+}
@@ -0,0 +1,173 @@
+///
+/// Mariani-Silver renderer. Generators may need `rect.x` and `rect.w`
+/// to be aligned, so instead of one pixel wide columns, left and right
+/// borders of rectangles are `align` pixels wide strips. Rows are
+/// 1 pixel high.
+///
+#include "render/api.h"
+#include <stdbool.h>
+
+struct MarianiJob {
+	const struct Mb_Generator *generator;
+	const struct Mb_GeneratorData *gen;
+	int align;
+	int tiles_x;
+};
+
+static void compute(const struct MarianiJob *job, int x, int y, int w, int h)
+{
+	if (w <= 0 || h <= 0)
+		return;
+
+	struct Mb_GeneratorData part = *job->gen;
+	part.rect = (struct Mb_Rect) { x, y, w, h };
+	job->generator->mandelbrot(&part);
+}
+
+static bool border_uniform(const struct MarianiJob *job, struct Mb_Rect r, int *value)
+{
+	const void *steps = job->gen->exit_steps;
+	enum Mb_StepsFormat fmt = job->gen->format;
+	int stride = job->gen->bwidth;
+	int a = job->align;
+	int v = mb_steps_get(steps, fmt, r.x + r.y * stride);
+
+	for (int ix = r.x; ix < r.x + r.w; ++ix)
+		if (mb_steps_get(steps, fmt, ix + r.y * stride) != v
+				|| mb_steps_get(steps, fmt, ix + (r.y + r.h - 1) * stride) != v)
+			return false;
+
+	for (int iy = r.y + 1; iy < r.y + r.h - 1; ++iy) {
+		for (int i = 0; i < a; ++i) {
+			if (mb_steps_get(steps, fmt, r.x + i + iy * stride) != v)
+				return false;
+			if (mb_steps_get(steps, fmt, r.x + r.w - a + i + iy * stride) != v)
+				return false;
+		}
+	}
+
+	*value = v;
+	return true;
+}
+
+/// A border of `max_steps` does not prove the inside is in the set:
+/// channels of the outside may pass between its pixels. So the inside
+/// is filled only if all of it is in the main cardioid or period-2 bulb.
+static bool known_inside(const struct MarianiJob *job, int x, int y, int w, int h)
+{
+	const struct Mb_GeneratorData *gen = job->gen;
+	double pixel = gen->swidth / gen->bwidth;
+	for (int iy = y; iy < y + h; ++iy) {
+		double Im = gen->yc + (iy - gen->bheight / 2.0) * pixel;
+		for (int ix = x; ix < x + w; ++ix) {
+			double Re = gen->xc + (ix - gen->bwidth / 2.0) * pixel;
+			if (!mb_interior(Re, Im))
+				return false;
+		}
+	}
+	return true;
+}
+
+static void fill(const struct MarianiJob *job, int x, int y, int w, int h, int value)
+{
+	void *steps = job->gen->exit_steps;
+	enum Mb_StepsFormat fmt = job->gen->format;
+	for (int iy = y; iy < y + h; ++iy)
+		for (int ix = x; ix < x + w; ++ix)
+			mb_steps_set(steps, fmt, ix + iy * job->gen->bwidth, value);
+}
+
+// Border of `r` must already be computed
+static void subdivide(const struct MarianiJob *job, struct Mb_Rect r)
+{
+	int a = job->align;
+
+	// Inside of the rectangle
+	int x = r.x + a, y = r.y + 1;
+	int w = r.w - 2*a, h = r.h - 2;
+	if (w <= 0 || h <= 0 || mb_cancelled(job->gen))
+		return;
+
+	// Uniform bands of the outside are split further, they may
+	// hold filaments of the set thinner than a pixel
+	int value;
+	if (border_uniform(job, r, &value) && value == job->gen->max_steps
+			&& known_inside(job, x, y, w, h)) {
+		fill(job, x, y, w, h, value);
+		return;
+	}
+
+	if (r.w < 4*a || r.w < MS_MIN_SIZE || r.h < MS_MIN_SIZE) {
+		compute(job, x, y, w, h);
+		return;
+	}
+
+	// Split with a row and a strip, which become borders of four parts
+	int xm = r.x + (r.w / 2) / a * a;
+	int ym = r.y + r.h / 2;
+
+	compute(job, x, ym, w, 1);
+	compute(job, xm, y, a, ym - y);
+	compute(job, xm, ym + 1, a, r.y + r.h - 1 - (ym + 1));
+
+	int lw = xm + a - r.x, rw = r.x + r.w - xm;
+	int th = ym - r.y + 1, bh = r.y + r.h - ym;
+
+	subdivide(job, (struct Mb_Rect) { r.x, r.y, lw, th });
+	subdivide(job, (struct Mb_Rect) { xm, r.y, rw, th });
+	subdivide(job, (struct Mb_Rect) { r.x, ym, lw, bh });
+	subdivide(job, (struct Mb_Rect) { xm, ym, rw, bh });
+}
+
+static void render_tile(struct MarianiJob *job, int i)
+{
+	struct Mb_Rect area = job->gen->rect;
+	int a = job->align;
+
+	if (mb_cancelled(job->gen))
+		return;
+
+	struct Mb_Rect r = {
+		.x = area.x + (i % job->tiles_x) * MS_TILE_SIZE,
+		.y = area.y + (i / job->tiles_x) * MS_TILE_SIZE,
+		.w = MS_TILE_SIZE,
+		.h = MS_TILE_SIZE,
+	};
+	if (r.x + r.w > area.x + area.w)
+		r.w = area.x + area.w - r.x;
+	if (r.y + r.h > area.y + area.h)
+		r.h = area.y + area.h - r.y;
+
+	// Too small to have a border and an inside
+	if (r.w < 3*a || r.h < 3) {
+		compute(job, r.x, r.y, r.w, r.h);
+		return;
+	}
+
+	compute(job, r.x, r.y, r.w, 1);
+	compute(job, r.x, r.y + r.h - 1, r.w, 1);
+	compute(job, r.x, r.y + 1, a, r.h - 2);
+	compute(job, r.x + r.w - a, r.y + 1, a, r.h - 2);
+
+	subdivide(job, r);
+}
+
+void mb_render_mariani(
+		struct Mb_Pool *pool,
+		const struct Mb_Generator *generator,
+		struct Mb_GeneratorData *gen
+)
+{
+	struct MarianiJob job = {
+		.generator = generator,
+		.gen = gen,
+		.align = generator->align,
+		.tiles_x = (gen->rect.w + MS_TILE_SIZE - 1) / MS_TILE_SIZE,
+	};
+	int tiles_y = (gen->rect.h + MS_TILE_SIZE - 1) / MS_TILE_SIZE;
+
+	mb_pool_run(
+		pool, job.tiles_x * tiles_y,
+		(void (*)(void*, int)) render_tile, &job
+	);
+}
@@ -0,0 +1,161 @@
+///
+/// Reuse of the previous frame when the view was only moved.
+///
+/// If the new center differs from the old one by a whole number of
+/// pixels (and nothing else changed), most of the pixels are the same
+/// values shifted, so they are copied and only the strips which came
+/// into view are computed.
+///
+#include "render/api.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/// How far from a whole pixel the shift may be
+#define PAN_EPS 1e-3
+
+void mb_pan_cache_free(struct Mb_PanCache *cache)
+{
+	free(cache->exit_steps);
+	cache->exit_steps = NULL;
+	cache->generator = NULL;
+}
+
+static bool same_view(
+		const struct Mb_PanCache *cache,
+		const struct Mb_Generator *generator,
+		const struct Mb_GeneratorData *gen
+)
+{
+	const struct Mb_GeneratorData *old = &cache->gen;
+	return cache->generator == generator
+		&& old->format == gen->format
+		&& old->swidth == gen->swidth
+		&& old->bwidth == gen->bwidth
+		&& old->bheight == gen->bheight
+		&& old->max_steps == gen->max_steps
+		&& old->options == gen->options;
+}
+
+// Shift of the new frame relative to the cached one, in pixels
+static bool pixel_shift(
+		const struct Mb_PanCache *cache,
+		const struct Mb_GeneratorData *gen,
+		int *kx, int *ky
+)
+{
+	struct Mb_Big old_x, old_y, new_x, new_y;
+	mb_hp_center(&cache->gen, &old_x, &old_y);
+	mb_hp_center(gen, &new_x, &new_y);
+
+	struct Mb_Big dx = mb_big_sub(&new_x, &old_x);
+	struct Mb_Big dy = mb_big_sub(&new_y, &old_y);
+
+	double pixel = gen->swidth / gen->bwidth;
+	double px = mb_big_to_double(&dx) / pixel;
+	double py = mb_big_to_double(&dy) / pixel;
+
+	if (fabs(px - round(px)) > PAN_EPS || fabs(py - round(py)) > PAN_EPS)
+		return false;
+	if (fabs(px) >= gen->bwidth || fabs(py) >= gen->bheight)
+		return false;
+
+	*kx = round(px);
+	*ky = round(py);
+	return true;
+}
+
+// dst[x, y] = src[x + kx, y + ky] where it exists
+static void shift_steps(
+		void *dst, const void *src, size_t elem,
+		int w, int h, int kx, int ky
+)
+{
+	int x0 = kx > 0 ? 0 : -kx;
+	int x1 = kx > 0 ? w - kx : w;
+	int y0 = ky > 0 ? 0 : -ky;
+	int y1 = ky > 0 ? h - ky : h;
+
+	for (int y = y0; y < y1; ++y)
+		memcpy(
+			(char*) dst + (x0 + y * w) * elem,
+			(const char*) src + (x0 + kx + (y + ky) * w) * elem,
+			(x1 - x0) * elem
+		);
+}
+
+static void render_rect(
+		struct Mb_Pool *pool,
+		const struct Mb_Renderer *renderer,
+		const struct Mb_Generator *generator,
+		struct Mb_GeneratorData *gen,
+		struct Mb_Rect rect
+)
+{
+	// Strips are widened so generators get aligned ones
+	int a = generator->align;
+	int x1 = (rect.x + rect.w + a - 1) / a * a;
+	rect.x = rect.x / a * a;
+	rect.w = (x1 < gen->bwidth ? x1 : gen->bwidth) - rect.x;
+
+	gen->rect = rect;
+	renderer->render(pool, generator, gen);
+}
+
+bool mb_render_incremental(
+		struct Mb_PanCache *cache,
+		struct Mb_Pool *pool,
+		const struct Mb_Renderer *renderer,
+		const struct Mb_Generator *generator,
+		struct Mb_GeneratorData *gen
+)
+{
+	struct Mb_Rect full = mb_full_rect(gen);
+	int w = gen->bwidth, h = gen->bheight;
+	size_t elem = mb_steps_size(gen->format);
+	int kx, ky;
+
+	// A frame which did not move at all is rendered again,
+	// so its time still tells how fast the generator is
+	bool panned = cache->exit_steps
+		&& same_view(cache, generator, gen)
+		&& pixel_shift(cache, gen, &kx, &ky)
+		&& (kx != 0 || ky != 0);
+
+	gen->rect = full;
+	if (panned) {
+		shift_steps(gen->exit_steps, cache->exit_steps, elem, w, h, kx, ky);
+
+		if (kx > 0)
+			render_rect(pool, renderer, generator, gen, (struct Mb_Rect) { w - kx, 0, kx, h });
+		if (kx < 0)
+			render_rect(pool, renderer, generator, gen, (struct Mb_Rect) { 0, 0, -kx, h });
+		if (ky > 0)
+			render_rect(pool, renderer, generator, gen, (struct Mb_Rect) { 0, h - ky, w, ky });
+		if (ky < 0)
+			render_rect(pool, renderer, generator, gen, (struct Mb_Rect) { 0, 0, w, -ky });
+
+		gen->rect = full;
+	} else {
+		renderer->render(pool, generator, gen);
+	}
+
+	// Partly computed frame must not be shifted into the next ones
+	if (mb_cancelled(gen)) {
+		cache->generator = NULL;
+		return panned;
+	}
+
+	size_t bytes = w * h * elem;
+	if (!cache->exit_steps || cache->bytes != bytes) {
+		free(cache->exit_steps);
+		cache->exit_steps = aligned_alloc(32, (bytes + 31) / 32 * 32);
+		cache->bytes = bytes;
+	}
+	memcpy(cache->exit_steps, gen->exit_steps, bytes);
+	cache->gen = *gen;
+	cache->gen.exit_steps = cache->exit_steps;
+	cache->generator = generator;
+
+	return panned;
+}
@@ -0,0 +1,254 @@
+#define _GNU_SOURCE
+
+#include "render/api.h"
+#include "common.h"
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include <x86intrin.h>
+
+struct Mb_Worker {
+	struct Mb_Pool *pool;
+	pthread_t thread;
+	int id;
+
+	// Tasks [head, tail) are queued on this worker. Owner takes
+	// them from the head, thieves from the tail.
+	pthread_mutex_t lock;
+	int head, tail;
+
+	// Only this worker writes them, others read after the job
+	struct Mb_PoolTimes times;
+	int tid;    // kernel id of the thread which ran the last job
+};
+
+struct Mb_Pool {
+	int nthreads;
+	struct Mb_Worker *workers;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t job_posted, job_done;
+
+	unsigned long job_id;
+	int running;    // spawned workers which did not finish current job
+	bool shutdown;
+
+	void (*task)(void *ctx, int i);
+	void *ctx;
+
+	// Worker 0 is not ours, so `mb_pool_pin` saves what the
+	// thread had before, and `mb_pool_destroy` gives it back
+	bool caller_pinned;
+	pthread_t caller;
+	cpu_set_t caller_cpus;
+};
+
+static bool take_task(struct Mb_Worker *w, bool steal, int *task)
+{
+	bool ok = false;
+	pthread_mutex_lock(&w->lock);
+	if (w->head < w->tail) {
+		*task = steal ? --w->tail : w->head++;
+		ok = true;
+	}
+	pthread_mutex_unlock(&w->lock);
+	return ok;
+}
+
+static double thread_cpu_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+static void work(struct Mb_Worker *self)
+{
+	struct Mb_Pool *pool = self->pool;
+	int task;
+
+	self->tid = syscall(SYS_gettid);
+	double cpu_begin = thread_cpu_ms();
+	uint64_t tsc_begin = __rdtsc();
+
+	while (take_task(self, false, &task))
+		pool->task(pool->ctx, task);
+
+	// Nobody adds tasks while job runs, so when all queues are
+	// empty, we are done.
+	for (int i = 1; i < pool->nthreads; ++i) {
+		struct Mb_Worker *victim = &pool->workers[(self->id + i) % pool->nthreads];
+		while (take_task(victim, true, &task))
+			pool->task(pool->ctx, task);
+	}
+
+	self->times.tsc_cycles += __rdtsc() - tsc_begin;
+	self->times.cpu_ms += thread_cpu_ms() - cpu_begin;
+}
+
+static void *worker_main(struct Mb_Worker *self)
+{
+	struct Mb_Pool *pool = self->pool;
+	unsigned long seen_job = 0;
+
+	pthread_mutex_lock(&pool->mutex);
+	while (true) {
+		while (!pool->shutdown && pool->job_id == seen_job)
+			pthread_cond_wait(&pool->job_posted, &pool->mutex);
+		if (pool->shutdown)
+			break;
+		seen_job = pool->job_id;
+		pthread_mutex_unlock(&pool->mutex);
+
+		work(self);
+
+		pthread_mutex_lock(&pool->mutex);
+		if (--pool->running == 0)
+			pthread_cond_signal(&pool->job_done);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+	return NULL;
+}
+
+struct Mb_Pool *mb_pool_create(int nthreads)
+{
+	assert(nthreads >= 1);
+
+	struct Mb_Pool *pool = calloc(1, sizeof(*pool));
+	pool->nthreads = nthreads;
+	pool->workers = calloc(nthreads, sizeof(*pool->workers));
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->job_posted, NULL);
+	pthread_cond_init(&pool->job_done, NULL);
+
+	for (int i = 0; i < nthreads; ++i) {
+		pool->workers[i].pool = pool;
+		pool->workers[i].id = i;
+		pthread_mutex_init(&pool->workers[i].lock, NULL);
+	}
+
+	// Worker 0 is whoever calls mb_pool_run
+	for (int i = 1; i < nthreads; ++i) {
+		int err = pthread_create(
+			&pool->workers[i].thread, NULL,
+			(void*(*)(void*)) worker_main, &pool->workers[i]
+		);
+		if (err)
+			DIE("Failed to create worker thread #%d", i);
+	}
+
+	return pool;
+}
+
+void mb_pool_destroy(struct Mb_Pool *pool)
+{
+	pthread_mutex_lock(&pool->mutex);
+	pool->shutdown = true;
+	pthread_cond_broadcast(&pool->job_posted);
+	pthread_mutex_unlock(&pool->mutex);
+
+	for (int i = 1; i < pool->nthreads; ++i)
+		pthread_join(pool->workers[i].thread, NULL);
+
+	if (pool->caller_pinned)
+		pthread_setaffinity_np(pool->caller, sizeof(pool->caller_cpus), &pool->caller_cpus);
+
+	for (int i = 0; i < pool->nthreads; ++i)
+		pthread_mutex_destroy(&pool->workers[i].lock);
+	pthread_cond_destroy(&pool->job_done);
+	pthread_cond_destroy(&pool->job_posted);
+	pthread_mutex_destroy(&pool->mutex);
+	free(pool->workers);
+	free(pool);
+}
+
+int mb_pool_threads(const struct Mb_Pool *pool)
+{
+	return pool->nthreads;
+}
+
+void mb_pool_run(
+		struct Mb_Pool *pool, int ntasks,
+		void (*task)(void *ctx, int i), void *ctx
+)
+{
+	pthread_mutex_lock(&pool->mutex);
+
+	pool->task = task;
+	pool->ctx = ctx;
+	for (int i = 0; i < pool->nthreads; ++i) {
+		struct Mb_Worker *w = &pool->workers[i];
+		pthread_mutex_lock(&w->lock);
+		w->head = (long) ntasks * i / pool->nthreads;
+		w->tail = (long) ntasks * (i+1) / pool->nthreads;
+		pthread_mutex_unlock(&w->lock);
+	}
+	pool->running = pool->nthreads - 1;
+	pool->job_id++;
+	pthread_cond_broadcast(&pool->job_posted);
+
+	pthread_mutex_unlock(&pool->mutex);
+
+	work(&pool->workers[0]);
+
+	pthread_mutex_lock(&pool->mutex);
+	while (pool->running > 0)
+		pthread_cond_wait(&pool->job_done, &pool->mutex);
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+struct Mb_PoolTimes mb_pool_times(const struct Mb_Pool *pool)
+{
+	struct Mb_PoolTimes sum = { 0 };
+	for (int i = 0; i < pool->nthreads; ++i) {
+		sum.cpu_ms += pool->workers[i].times.cpu_ms;
+		sum.tsc_cycles += pool->workers[i].times.tsc_cycles;
+	}
+	return sum;
+}
+
+int mb_cpu_count(void)
+{
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n < 1 ? 1 : n;
+}
+
+void mb_pool_thread_ids(struct Mb_Pool *pool, int *tids)
+{
+	// Spawned workers may not have run anything yet
+	mb_pool_run(pool, 0, NULL, NULL);
+	for (int i = 0; i < pool->nthreads; ++i)
+		tids[i] = pool->workers[i].tid;
+}
+
+void mb_pool_worker_times(const struct Mb_Pool *pool, struct Mb_PoolTimes *times)
+{
+	for (int i = 0; i < pool->nthreads; ++i)
+		times[i] = pool->workers[i].times;
+}
+
+bool mb_pool_pin(struct Mb_Pool *pool, const int *cpus)
+{
+	if (!pool->caller_pinned) {
+		pool->caller = pthread_self();
+		pool->caller_pinned = pthread_getaffinity_np(
+			pool->caller, sizeof(pool->caller_cpus), &pool->caller_cpus
+		) == 0;
+	}
+
+	bool ok = true;
+	for (int i = 0; i < pool->nthreads; ++i) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(cpus[i], &set);
+		pthread_t thread = i == 0 ? pthread_self() : pool->workers[i].thread;
+		ok &= pthread_setaffinity_np(thread, sizeof(set), &set) == 0;
+	}
+	return ok;
+}
@@ -0,0 +1,379 @@
+///
+/// Persistent tile store: one append-only file, which is mmap-ed and
+/// read in place, so tiles computed once (for example overnight by
+/// the `tiles` tool) are loaded instead of being computed again.
+///
+/// Format, all numbers are little endian:
+///
+///     Header, 64 bytes
+///         char     magic[8]      "MBTILES1"
+///         uint32   tile_size     side of tiles, CACHE_TILE_SIZE
+///         uint32   reserved
+///         uint64   committed     bytes from the start of the file
+///                                which hold complete records
+///         ...      zeroes
+///
+///     Records, each one padded to 8 bytes
+///         uint32   magic         "TILE"
+///         uint32   size          bytes of data after this header
+///         double   pixel         fields of struct Mb_TileKey
+///         int64    tx, ty
+///         int32    max_steps
+///         int32    precision
+///         uint32   options
+///         uint32   encoding      STORE_RAW or STORE_RLE
+///         ...      data
+///
+/// STORE_RAW data are tile_size^2 int32 step counts, row by row.
+/// STORE_RLE are pairs of LEB128 numbers (run length, step count).
+///
+/// Records are never changed. Writer appends a record past `committed`
+/// and only then moves `committed`, so readers (which look only below
+/// it) always see complete records. Only one process can write at a time,
+/// it holds an exclusive flock on the file. The index is not stored:
+/// readers build it in memory from record headers and extend it when
+/// `committed` grows.
+///
+#define _GNU_SOURCE
+#include "render/api.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define STORE_MAGIC  "MBTILES1"
+#define RECORD_MAGIC 0x454c4954 // "TILE"
+
+#define STORE_RAW 0
+#define STORE_RLE 1
+
+#define TILE_PIXELS (CACHE_TILE_SIZE * CACHE_TILE_SIZE)
+
+struct StoreHeader {
+	char magic[8];
+	uint32_t tile_size;
+	uint32_t reserved;
+	uint64_t committed;
+	char padding[40];
+};
+
+struct StoreRecord {
+	uint32_t magic;
+	uint32_t size;
+	double pixel;
+	int64_t tx, ty;
+	int32_t max_steps;
+	int32_t precision;
+	uint32_t options;
+	uint32_t encoding;
+};
+
+_Static_assert(sizeof(struct StoreHeader) == 64, "store header must be 64 bytes");
+_Static_assert(sizeof(struct StoreRecord) == 48, "record header must be 48 bytes");
+
+struct IndexEntry {
+	struct Mb_TileKey key;
+	uint64_t offset;            // of the record, 0 for empty entries
+};
+
+struct Mb_TileStore {
+	int fd;
+	bool writable;
+
+	const char *map;
+	size_t map_size;
+	uint64_t indexed;           // records below this are in the index
+
+	struct IndexEntry *index;   // open addressing
+	size_t index_cap, index_count;
+
+	struct Mb_TileStoreStats stats;
+};
+
+static uint64_t committed(const struct Mb_TileStore *store)
+{
+	const struct StoreHeader *hdr = (const void*) store->map;
+	return __atomic_load_n(&hdr->committed, __ATOMIC_ACQUIRE);
+}
+
+static void index_put(struct Mb_TileStore *store, const struct Mb_TileKey *key, uint64_t offset)
+{
+	if ((store->index_count + 1) * 2 > store->index_cap) {
+		struct IndexEntry *old = store->index;
+		size_t old_cap = store->index_cap;
+
+		store->index_cap = old_cap ? old_cap * 2 : 1024;
+		store->index = calloc(store->index_cap, sizeof(*store->index));
+		store->index_count = 0;
+		for (size_t i = 0; i < old_cap; ++i)
+			if (old[i].offset)
+				index_put(store, &old[i].key, old[i].offset);
+		free(old);
+	}
+
+	size_t i = mb_tile_key_hash(key) & (store->index_cap - 1);
+	while (store->index[i].offset && !mb_tile_key_equal(&store->index[i].key, key))
+		i = (i + 1) & (store->index_cap - 1);
+
+	// Later record of the same tile wins
+	if (!store->index[i].offset)
+		store->index_count++;
+	store->index[i].key = *key;
+	store->index[i].offset = offset;
+}
+
+static uint64_t index_get(const struct Mb_TileStore *store, const struct Mb_TileKey *key)
+{
+	if (!store->index_cap)
+		return 0;
+
+	size_t i = mb_tile_key_hash(key) & (store->index_cap - 1);
+	while (store->index[i].offset) {
+		if (mb_tile_key_equal(&store->index[i].key, key))
+			return store->index[i].offset;
+		i = (i + 1) & (store->index_cap - 1);
+	}
+	return 0;
+}
+
+static size_t record_span(const struct StoreRecord *rec)
+{
+	return (sizeof(*rec) + rec->size + 7) / 8 * 8;
+}
+
+/// Maps everything below `committed` and indexes new records
+bool mb_tile_store_refresh(struct Mb_TileStore *store)
+{
+	uint64_t end = committed(store);
+	if (end <= store->indexed)
+		return true;
+
+	if (end > store->map_size) {
+		void *map = mremap((void*) store->map, store->map_size, end, MREMAP_MAYMOVE);
+		if (map == MAP_FAILED)
+			return false;
+		store->map = map;
+		store->map_size = end;
+	}
+
+	uint64_t pos = store->indexed;
+	while (pos + sizeof(struct StoreRecord) <= end) {
+		const struct StoreRecord *rec = (const void*) (store->map + pos);
+		if (rec->magic != RECORD_MAGIC || pos + record_span(rec) > end) {
+			errno = EINVAL;
+			return false;
+		}
+
+		struct Mb_TileKey key = {
+			.pixel = rec->pixel,
+			.tx = rec->tx, .ty = rec->ty,
+			.max_steps = rec->max_steps,
+			.precision = rec->precision,
+			.options = rec->options,
+		};
+		index_put(store, &key, pos);
+
+		store->stats.tiles++;
+		pos += record_span(rec);
+	}
+	store->indexed = pos;
+	store->stats.bytes = pos;
+	return true;
+}
+
+struct Mb_TileStore *mb_tile_store_open(const char *path, bool writable)
+{
+	struct Mb_TileStore *store = calloc(1, sizeof(*store));
+
+	store->fd = open(path, writable ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+	if (store->fd < 0)
+		goto fail;
+
+	// Second writer becomes a reader
+	if (writable && flock(store->fd, LOCK_EX | LOCK_NB) == 0)
+		store->writable = true;
+
+	struct stat st;
+	if (fstat(store->fd, &st) < 0)
+		goto fail;
+
+	if (st.st_size == 0 && store->writable) {
+		struct StoreHeader hdr = {
+			.magic = STORE_MAGIC,
+			.tile_size = CACHE_TILE_SIZE,
+			.committed = sizeof(hdr),
+		};
+		if (pwrite(store->fd, &hdr, sizeof(hdr), 0) != sizeof(hdr))
+			goto fail;
+		st.st_size = sizeof(hdr);
+	}
+
+	if ((size_t) st.st_size < sizeof(struct StoreHeader)) {
+		errno = EINVAL;
+		goto fail;
+	}
+
+	// Header is mapped shared, so `committed` of the writer is seen
+	store->map_size = sizeof(struct StoreHeader);
+	store->map = mmap(NULL, store->map_size, PROT_READ, MAP_SHARED, store->fd, 0);
+	if (store->map == MAP_FAILED) {
+		store->map = NULL;
+		goto fail;
+	}
+
+	const struct StoreHeader *hdr = (const void*) store->map;
+	if (memcmp(hdr->magic, STORE_MAGIC, sizeof(hdr->magic)) != 0
+			|| hdr->tile_size != CACHE_TILE_SIZE) {
+		errno = EINVAL;
+		goto fail;
+	}
+
+	store->indexed = sizeof(struct StoreHeader);
+	store->stats.writable = store->writable;
+	if (!mb_tile_store_refresh(store))
+		goto fail;
+
+	return store;
+
+fail:;
+	int err = errno;
+	mb_tile_store_close(store);
+	errno = err;
+	return NULL;
+}
+
+void mb_tile_store_close(struct Mb_TileStore *store)
+{
+	if (store->map)
+		munmap((void*) store->map, store->map_size);
+	if (store->fd >= 0)
+		close(store->fd);
+	free(store->index);
+	free(store);
+}
+
+struct Mb_TileStoreStats mb_tile_store_stats(const struct Mb_TileStore *store)
+{
+	return store->stats;
+}
+
+static bool decode_rle(const uint8_t *data, size_t size, int *steps)
+{
+	const uint8_t *end = data + size;
+	int filled = 0;
+
+	while (data < end) {
+		uint64_t num[2] = { 0, 0 };
+		for (int k = 0; k < 2; ++k) {
+			for (int shift = 0; ; shift += 7) {
+				if (data == end || shift > 35)
+					return false;
+				num[k] |= (uint64_t) (*data & 0x7f) << shift;
+				if (!(*data++ & 0x80))
+					break;
+			}
+		}
+
+		if (num[0] > (uint64_t) (TILE_PIXELS - filled))
+			return false;
+		for (uint64_t i = 0; i < num[0]; ++i)
+			steps[filled++] = num[1];
+	}
+	return filled == TILE_PIXELS;
+}
+
+bool mb_tile_store_load(const struct Mb_TileStore *store, const struct Mb_TileKey *key, int *steps)
+{
+	uint64_t offset = index_get(store, key);
+	if (!offset)
+		return false;
+
+	const struct StoreRecord *rec = (const void*) (store->map + offset);
+	const uint8_t *data = (const uint8_t*) (rec + 1);
+
+	switch (rec->encoding) {
+	case STORE_RAW:
+		if (rec->size != TILE_PIXELS * sizeof(*steps))
+			return false;
+		memcpy(steps, data, rec->size);
+		return true;
+	case STORE_RLE:
+		return decode_rle(data, rec->size, steps);
+	default:
+		return false;
+	}
+}
+
+static size_t put_varint(uint8_t *out, uint32_t val)
+{
+	size_t n = 0;
+	do {
+		out[n++] = (val & 0x7f) | (val > 0x7f ? 0x80 : 0);
+		val >>= 7;
+	} while (val);
+	return n;
+}
+
+// Returns size of the encoded data, which is larger than the
+// raw one if RLE did not help. Output must fit 2 * 5 bytes per pixel.
+static size_t encode_rle(const int *steps, uint8_t *out)
+{
+	size_t size = 0;
+	for (int i = 0; i < TILE_PIXELS; ) {
+		int run = 1;
+		while (i + run < TILE_PIXELS && steps[i + run] == steps[i])
+			run++;
+		size += put_varint(out + size, run);
+		size += put_varint(out + size, steps[i]);
+		i += run;
+	}
+	return size;
+}
+
+bool mb_tile_store_append(struct Mb_TileStore *store, const struct Mb_TileKey *key, const int *steps)
+{
+	if (!store->writable) {
+		errno = EBADF;
+		return false;
+	}
+
+	static _Thread_local uint8_t buf[sizeof(struct StoreRecord) + TILE_PIXELS * 10 + 8];
+	struct StoreRecord *rec = (void*) buf;
+	uint8_t *data = buf + sizeof(*rec);
+
+	*rec = (struct StoreRecord) {
+		.magic = RECORD_MAGIC,
+		.pixel = key->pixel,
+		.tx = key->tx, .ty = key->ty,
+		.max_steps = key->max_steps,
+		.precision = key->precision,
+		.options = key->options,
+		.encoding = STORE_RLE,
+	};
+	rec->size = encode_rle(steps, data);
+	if (rec->size >= TILE_PIXELS * sizeof(*steps)) {
+		rec->encoding = STORE_RAW;
+		rec->size = TILE_PIXELS * sizeof(*steps);
+		memcpy(data, steps, rec->size);
+	}
+
+	size_t span = record_span(rec);
+	memset(data + rec->size, 0, span - sizeof(*rec) - rec->size);
+
+	// Anything past `committed` is garbage of an interrupted append
+	uint64_t pos = committed(store);
+	if (pwrite(store->fd, buf, span, pos) != (ssize_t) span)
+		return false;
+
+	uint64_t new_end = pos + span;
+	if (pwrite(store->fd, &new_end, sizeof(new_end), offsetof(struct StoreHeader, committed))
+			!= sizeof(new_end))
+		return false;
+
+	return mb_tile_store_refresh(store);
+}
@@ -0,0 +1,62 @@
+#include "render/api.h"
+
+struct TiledJob {
+	const struct Mb_Generator *generator;
+	const struct Mb_GeneratorData *gen;
+	int tiles_x;
+};
+
+static void render_tile(struct TiledJob *job, int i)
+{
+	// Tiles left after the frame was cancelled are skipped quickly
+	if (mb_cancelled(job->gen))
+		return;
+
+	struct Mb_GeneratorData tile = *job->gen;
+	struct Mb_Rect area = job->gen->rect;
+
+	tile.rect.x = area.x + (i % job->tiles_x) * TILE_WIDTH;
+	tile.rect.y = area.y + (i / job->tiles_x) * TILE_HEIGHT;
+	tile.rect.w = TILE_WIDTH;
+	tile.rect.h = TILE_HEIGHT;
+
+	// Last ones may be cut by the area border
+	if (tile.rect.x + tile.rect.w > area.x + area.w)
+		tile.rect.w = area.x + area.w - tile.rect.x;
+	if (tile.rect.y + tile.rect.h > area.y + area.h)
+		tile.rect.h = area.y + area.h - tile.rect.y;
+
+	job->generator->mandelbrot(&tile);
+}
+
+static void render_whole(struct TiledJob *job, int i)
+{
+	struct Mb_GeneratorData gen = *job->gen;
+	job->generator->mandelbrot(&gen);
+}
+
+void mb_render_tiled(
+		struct Mb_Pool *pool,
+		const struct Mb_Generator *generator,
+		struct Mb_GeneratorData *gen
+)
+{
+	struct TiledJob job = {
+		.generator = generator,
+		.gen = gen,
+		.tiles_x = (gen->rect.w + TILE_WIDTH - 1) / TILE_WIDTH,
+	};
+	int tiles_y = (gen->rect.h + TILE_HEIGHT - 1) / TILE_HEIGHT;
+
+	// Single thread computes everything in one call, but still
+	// through the pool, so its time is counted
+	if (mb_pool_threads(pool) == 1) {
+		mb_pool_run(pool, 1, (void (*)(void*, int)) render_whole, &job);
+		return;
+	}
+
+	mb_pool_run(
+		pool, job.tiles_x * tiles_y,
+		(void (*)(void*, int)) render_tile, &job
+	);
+}
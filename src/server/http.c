@@ -0,0 +1,236 @@
+///
+/// Just enough of HTTP/1.1 for tile requests of browsers and map
+/// libraries: GET with a path and a query, keep-alive connections.
+/// Other headers are ignored, there are no request bodies.
+///
+/// Tiles are at `/Z/X/Y.EXT?palette=NAME&max_steps=N&client=ID&view=N`,
+/// EXT is one of `img_formats`, all of the query is optional.
+/// `/stats` gives counters of the server as text.
+///
+#include "server/server.h"
+#include "color/api.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+int srv_http_read(int fd, char *buf, size_t size, size_t *have)
+{
+	while (true) {
+		for (size_t i = 3; i < *have; ++i)
+			if (memcmp(buf + i - 3, "\r\n\r\n", 4) == 0)
+				return i + 1;
+		if (*have == size)
+			return -1;
+
+		ssize_t n = recv(fd, buf + *have, size - *have, 0);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return n == 0 && *have == 0 ? 0 : -1;
+		*have += n;
+	}
+}
+
+/// Parses a decimal number which takes all of `str`
+static bool parse_int(const char *str, int64_t min, int64_t max, int64_t *out)
+{
+	char *end;
+	errno = 0;
+	long long val = strtoll(str, &end, 10);
+	if (errno || end == str || *end || val < min || val > max)
+		return false;
+	*out = val;
+	return true;
+}
+
+static int parse_query(char *query, struct Srv_Request *req)
+{
+	char *param;
+	while ((param = strsep(&query, "&"))) {
+		char *value = strchr(param, '=');
+		if (!value)
+			return 400;
+		*value++ = '\0';
+
+		int64_t num;
+		if (strcmp(param, "palette") == 0) {
+			req->colorizer = -1;
+			for (int i = 0; i < ARRAY_SIZE(colorizers); ++i)
+				if (strcmp(colorizers[i].name, value) == 0)
+					req->colorizer = i;
+			if (req->colorizer < 0)
+				return 404;
+		} else if (strcmp(param, "max_steps") == 0) {
+			if (!parse_int(value, 1, SRV_MAX_STEPS, &num))
+				return 400;
+			req->key.max_steps = num;
+		} else if (strcmp(param, "client") == 0) {
+			if (strlen(value) >= SRV_CLIENT_LEN)
+				return 400;
+			strcpy(req->client, value);
+		} else if (strcmp(param, "view") == 0) {
+			if (!parse_int(value, 0, INT64_MAX, &num))
+				return 400;
+			req->view = num;
+		}
+	}
+	return 200;
+}
+
+static int parse_tile(char *path, struct Srv_Request *req)
+{
+	char *parts[3];
+	for (int i = 0; i < 3; ++i) {
+		parts[i] = strsep(&path, "/");
+		if (!parts[i] || (i < 2) != (path != NULL))
+			return 404;
+	}
+
+	char *ext = strrchr(parts[2], '.');
+	if (!ext)
+		return 404;
+	*ext++ = '\0';
+
+	bool known = false;
+	for (int i = 0; i < ARRAY_SIZE(img_formats); ++i) {
+		if (strcmp(img_formats[i].name, ext) == 0) {
+			req->format = img_formats[i].format;
+			known = true;
+		}
+	}
+
+	int64_t z, x, y;
+	if (!known || !parse_int(parts[0], 0, SRV_MAX_ZOOM, &z))
+		return 404;
+	int64_t tiles = (int64_t) 1 << z;
+	if (!parse_int(parts[1], 0, tiles - 1, &x) || !parse_int(parts[2], 0, tiles - 1, &y))
+		return 404;
+
+	req->kind = SRV_REQ_TILE;
+	req->key.z = z;
+	req->key.x = x;
+	req->key.y = y;
+	return 200;
+}
+
+int srv_http_parse(char *head, int max_steps, struct Srv_Request *req)
+{
+	*req = (struct Srv_Request) {
+		.key.max_steps = max_steps,
+		.colorizer = DEFAULT_COLORIZER,
+		.keep_alive = true,
+	};
+
+	// Request line, then headers
+	char *line = strsep(&head, "\r");
+	char *method = strsep(&line, " ");
+	char *target = strsep(&line, " ");
+	if (!target || !line || strncmp(line, "HTTP/1.", 7) != 0)
+		return 400;
+	req->keep_alive = strcmp(line, "HTTP/1.0") != 0;
+
+	while (head && (line = strsep(&head, "\r"))) {
+		line += *line == '\n';
+		char *value = strchr(line, ':');
+		if (!value)
+			continue;
+		*value++ = '\0';
+		value += strspn(value, " \t");
+		if (strcasecmp(line, "Connection") == 0)
+			req->keep_alive = strncasecmp(value, "close", 5) != 0;
+	}
+
+	if (strcmp(method, "GET") != 0)
+		return 405;
+
+	char *path = strsep(&target, "?");
+	if (path[0] != '/')
+		return 400;
+	if (strcmp(path, "/stats") == 0) {
+		req->kind = SRV_REQ_STATS;
+		return 200;
+	}
+
+	int status = parse_tile(path + 1, req);
+	if (status == 200 && target)
+		status = parse_query(target, req);
+	return status;
+}
+
+static const char *status_text(int status)
+{
+	switch (status) {
+	case 200: return "OK";
+	case 400: return "Bad Request";
+	case 404: return "Not Found";
+	case 405: return "Method Not Allowed";
+	case 410: return "Gone";
+	case 503: return "Service Unavailable";
+	default:  return "Internal Server Error";
+	}
+}
+
+static bool send_all(int fd, const char *data, size_t len)
+{
+	while (len) {
+		ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		data += n;
+		len -= n;
+	}
+	return true;
+}
+
+static bool send_head(
+		int fd, int status, const char *type, const char *headers,
+		size_t len, bool keep_alive
+)
+{
+	char head[512];
+	int n = snprintf(
+		head, sizeof(head),
+		"HTTP/1.1 %d %s\r\n"
+		"Content-Type: %s\r\n"
+		"Content-Length: %zu\r\n"
+		"Connection: %s\r\n"
+		"%s\r\n",
+		status, status_text(status), type, len,
+		keep_alive ? "keep-alive" : "close", headers ? headers : ""
+	);
+	return n < sizeof(head) && send_all(fd, head, n);
+}
+
+bool srv_http_respond_fd(
+		int fd, int status, const char *type, const char *headers,
+		int body_fd, size_t len, bool keep_alive
+)
+{
+	if (!send_head(fd, status, type, headers, len, keep_alive))
+		return false;
+
+	off_t offset = 0;
+	while (offset < len) {
+		ssize_t n = sendfile(fd, body_fd, &offset, len - offset);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+	}
+	return true;
+}
+
+bool srv_http_respond(
+		int fd, int status, const char *type, const char *headers,
+		const char *body, bool keep_alive
+)
+{
+	return send_head(fd, status, type, headers, strlen(body), keep_alive)
+		&& send_all(fd, body, strlen(body));
+}
@@ -0,0 +1,360 @@
+///
+/// Daemon serving tiles to map front ends: step counts (`raw`) or
+/// colored tiles (`png`, `ppm`), see `src/server/http.c` for URLs.
+/// Every connection has a thread of its own, tiles are computed by
+/// the workers of `Srv_Tiles`.
+///
+#define _GNU_SOURCE
+#include "color/api.h"
+#include "render/api.h"
+#include "server/server.h"
+#include <errno.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/// Default memory cap of the tile cache, MiB
+#define CACHE_MB 256
+
+/// Default number of tiles which may wait for workers
+#define QUEUE_CAP 1024
+
+#define DEFAULT_PORT 8080
+
+struct Server {
+	struct Srv_Tiles *tiles;
+	int max_steps;      // for requests which do not give it
+};
+
+struct Connection {
+	struct Server *server;
+	int fd;
+};
+
+static volatile sig_atomic_t shall_quit = false;
+
+static void on_signal(int sig)
+{
+	shall_quit = true;
+}
+
+static const char *content_type(enum Img_Format format)
+{
+	switch (format) {
+	case IMG_PNG: return "image/png";
+	case IMG_PPM: return "image/x-portable-pixmap";
+	default:      return "application/octet-stream";
+	}
+}
+
+static const char *steps_format_name(enum Mb_StepsFormat format)
+{
+	for (int i = 0; i < ARRAY_SIZE(steps_formats); ++i)
+		if (steps_formats[i].format == format)
+			return steps_formats[i].name;
+	return "";
+}
+
+static bool respond_stats(struct Server *server, int fd, bool keep_alive)
+{
+	struct Srv_Stats st = srv_tiles_stats(server->tiles);
+	char body[1024];
+	snprintf(
+		body, sizeof(body),
+		"requests %lu\nhits %lu\ncomputed %lu\ncoalesced %lu\n"
+		"cancelled %lu\nsuperseded %lu\nbusy %lu\ndropped %lu\n"
+		"queued %d\nrunning %d\ncache_bytes %zu\n",
+		st.requests, st.hits, st.computed, st.coalesced,
+		st.cancelled, st.superseded, st.busy, st.dropped,
+		st.queued, st.running, st.cache_bytes
+	);
+	return srv_http_respond(fd, 200, "text/plain", NULL, body, keep_alive);
+}
+
+/// Buffers of a connection, reused for all of its requests
+struct Buffers {
+	void *steps;
+	ARGB *colors;
+	struct Mb_Palette palette;
+	int body_fd;        // memory file the image is written to
+};
+
+static bool respond_tile(
+		struct Server *server, int fd, struct Buffers *buf,
+		const struct Srv_Request *req
+)
+{
+	enum Srv_Result res = srv_tiles_get(
+		server->tiles, &req->key, req->client, req->view, fd, buf->steps
+	);
+
+	switch (res) {
+	case SRV_HIT:
+	case SRV_COMPUTED:
+	case SRV_COALESCED:
+		break;
+	case SRV_CANCELLED:
+		return false;
+	case SRV_SUPERSEDED:
+		return srv_http_respond(fd, 410, "text/plain", NULL, "Superseded by a newer view\n", req->keep_alive);
+	case SRV_BUSY:
+		return srv_http_respond(fd, 503, "text/plain", NULL, "Queue is full\n", req->keep_alive);
+	}
+
+	enum Mb_StepsFormat format = mb_compact_format(req->key.max_steps);
+	if (req->format != IMG_RAW) {
+		color_palette_update(&buf->palette, &colorizers[req->colorizer], req->key.max_steps);
+		color_fill(&buf->palette, buf->colors, buf->steps, format, SRV_TILE_PIXELS);
+	}
+
+	struct Img_Writer w = {
+		.fd = buf->body_fd,
+		.format = req->format,
+		.width = SRV_TILE_SIZE,
+		.height = SRV_TILE_SIZE,
+		.steps_format = format,
+	};
+	if (ftruncate(buf->body_fd, 0) < 0
+			|| !img_begin(&w) || !img_write_rows(&w, buf->colors, buf->steps, SRV_TILE_SIZE)
+			|| !img_finish(&w))
+		return srv_http_respond(fd, 500, "text/plain", NULL, "Failed to write the tile\n", false);
+
+	static const char *sources[] = {
+		[SRV_HIT] = "hit", [SRV_COMPUTED] = "computed", [SRV_COALESCED] = "coalesced",
+	};
+	char headers[128];
+	snprintf(
+		headers, sizeof(headers), "X-Tile: %s\r\nX-Steps-Format: %s\r\n",
+		sources[res], steps_format_name(format)
+	);
+	return srv_http_respond_fd(
+		fd, 200, content_type(req->format), headers,
+		buf->body_fd, w.offset, req->keep_alive
+	);
+}
+
+static void connection_main(struct Connection *conn)
+{
+	struct Buffers buf = {
+		.steps = aligned_alloc(32, SRV_TILE_PIXELS * sizeof(int)),
+		.colors = malloc(SRV_TILE_PIXELS * sizeof(ARGB)),
+		.palette = { 0 },
+		.body_fd = memfd_create("tile", 0),
+	};
+
+	char in[SRV_REQUEST_MAX], head[SRV_REQUEST_MAX + 1];
+	size_t have = 0;
+	bool ok = buf.body_fd >= 0;
+	while (ok) {
+		int len = srv_http_read(conn->fd, in, sizeof(in), &have);
+		if (len <= 0)
+			break;
+
+		// Next request may already be there
+		memcpy(head, in, len);
+		head[len] = '\0';
+		memmove(in, in + len, have - len);
+		have -= len;
+
+		struct Srv_Request req;
+		int status = srv_http_parse(head, conn->server->max_steps, &req);
+		if (status != 200)
+			ok = srv_http_respond(conn->fd, status, "text/plain", NULL, "Bad tile request\n", req.keep_alive);
+		else if (req.kind == SRV_REQ_STATS)
+			ok = respond_stats(conn->server, conn->fd, req.keep_alive);
+		else
+			ok = respond_tile(conn->server, conn->fd, &buf, &req);
+		ok = ok && req.keep_alive;
+	}
+
+	if (buf.body_fd >= 0)
+		close(buf.body_fd);
+	free(buf.steps);
+	free(buf.colors);
+	color_palette_free(&buf.palette);
+	close(conn->fd);
+	free(conn);
+}
+
+/// Returns listening socket, -1 with the message printed on errors
+static int listen_on(const char *unix_path, int port)
+{
+	int fd;
+	if (unix_path) {
+		struct sockaddr_un addr = { .sun_family = AF_UNIX };
+		if (strlen(unix_path) >= sizeof(addr.sun_path)) {
+			printf("Error: socket path `%s` is too long\n", unix_path);
+			return -1;
+		}
+		strcpy(addr.sun_path, unix_path);
+		unlink(unix_path);
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd < 0 || bind(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0)
+			goto fail;
+	} else {
+		// Local only, it is not meant to face the network
+		struct sockaddr_in addr = {
+			.sin_family = AF_INET,
+			.sin_port = htons(port),
+			.sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+		};
+		fd = socket(AF_INET, SOCK_STREAM, 0);
+		int one = 1;
+		if (fd < 0 || setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0
+				|| bind(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0)
+			goto fail;
+	}
+
+	if (listen(fd, SOMAXCONN) < 0)
+		goto fail;
+	return fd;
+
+fail:
+	printf("Error: failed to listen: %s\n", strerror(errno));
+	if (fd >= 0)
+		close(fd);
+	return -1;
+}
+
+static void print_usage(const char *name)
+{
+	printf(
+			"Usage: %s [-p PORT | -u PATH] [-g GENERATOR_NAME] [-t THREADS] [-c MIB]\n"
+			"       [-q TILES] [-m MAX_STEPS] [-h]\n", name
+	);
+	printf(
+			"  -h                 Prints this help message\n"
+			"  -p PORT            TCP port on 127.0.0.1 to listen on, %d by default\n"
+			"  -u PATH            Listen on Unix socket instead\n"
+			"  -g GENERATOR_NAME  Generator to compute with, `%s` by default\n"
+			"  -t THREADS         Number of workers computing tiles, all CPUs by default\n"
+			"  -c MIB             Memory cap of the tile cache, %d by default\n"
+			"  -q TILES           Most tiles waiting for workers, %d by default\n"
+			"  -m MAX_STEPS       Iteration limit of requests which do not give it,\n"
+			"                     %d by default\n",
+			DEFAULT_PORT, generators[DEFAULT_GENERATOR].name, CACHE_MB, QUEUE_CAP,
+			VIEWER_MAX_STEPS
+	);
+}
+
+int main(int argc, char **argv)
+{
+	int port = DEFAULT_PORT;
+	const char *unix_path = NULL;
+	const char *gen_name = generators[DEFAULT_GENERATOR].name;
+	int threads = mb_cpu_count();
+	int cache_mb = CACHE_MB;
+	int queue_cap = QUEUE_CAP;
+	struct Server server = { .max_steps = VIEWER_MAX_STEPS };
+
+	int opt;
+	while ((opt = getopt(argc, argv, "p:u:g:t:c:q:m:h")) != -1) {
+		switch (opt) {
+		case 'h':
+			print_usage(argv[0]);
+			return 0;
+		case 'p':
+			port = atoi(optarg);
+			break;
+		case 'u':
+			unix_path = optarg;
+			break;
+		case 'g':
+			gen_name = optarg;
+			break;
+		case 't':
+			threads = atoi(optarg);
+			break;
+		case 'c':
+			cache_mb = atoi(optarg);
+			break;
+		case 'q':
+			queue_cap = atoi(optarg);
+			break;
+		case 'm':
+			server.max_steps = atoi(optarg);
+			break;
+		default:
+			print_usage(argv[0]);
+			return -1;
+		}
+	}
+
+	int gen_idx = mb_find_generator(gen_name);
+	if (gen_idx < 0) {
+		printf("Error: unknown generator `%s` or the CPU does not support it\n", gen_name);
+		return -1;
+	}
+
+	if (port < 1 || port > 65535 || threads < 1 || cache_mb < 0 || queue_cap < 1
+			|| server.max_steps < 1 || server.max_steps > SRV_MAX_STEPS) {
+		printf("Error: invalid numeric argument\n");
+		return -1;
+	}
+
+	int listen_fd = listen_on(unix_path, port);
+	if (listen_fd < 0)
+		return -1;
+
+	// Clients hanging up must not kill the server, and
+	// signals must interrupt `accept`, so no SA_RESTART
+	signal(SIGPIPE, SIG_IGN);
+	struct sigaction quit_action = { .sa_handler = on_signal };
+	sigaction(SIGINT, &quit_action, NULL);
+	sigaction(SIGTERM, &quit_action, NULL);
+
+	server.tiles = srv_tiles_create(gen_idx, threads, (size_t) cache_mb << 20, queue_cap);
+	if (unix_path)
+		printf("Listening on %s, ", unix_path);
+	else
+		printf("Listening on 127.0.0.1:%d, ", port);
+	printf("%d workers with `%s`, %d MiB of cache\n", threads, gen_name, cache_mb);
+	fflush(stdout);
+
+	while (!shall_quit) {
+		int fd = accept(listen_fd, NULL, NULL);
+		if (fd < 0) {
+			if (errno != EINTR && errno != ECONNABORTED)
+				printf("Error: failed to accept: %s\n", strerror(errno));
+			continue;
+		}
+		if (!unix_path) {
+			int one = 1;
+			setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		}
+
+		struct Connection *conn = malloc(sizeof(*conn));
+		*conn = (struct Connection) { &server, fd };
+		pthread_t thread;
+		pthread_attr_t attr;
+		pthread_attr_init(&attr);
+		pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+		if (pthread_create(&thread, &attr, (void*(*)(void*)) connection_main, conn) != 0) {
+			close(fd);
+			free(conn);
+		}
+		pthread_attr_destroy(&attr);
+	}
+
+	// Connection threads may still wait for tiles, so the
+	// process just exits without tearing the queue down
+	struct Srv_Stats st = srv_tiles_stats(server.tiles);
+	printf(
+		"\n%lu requests: %lu hits, %lu computed, %lu coalesced, "
+		"%lu cancelled, %lu superseded, %lu busy, %lu tiles dropped\n",
+		st.requests, st.hits, st.computed, st.coalesced,
+		st.cancelled, st.superseded, st.busy, st.dropped
+	);
+	close(listen_fd);
+	if (unix_path)
+		unlink(unix_path);
+	return 0;
+}
@@ -0,0 +1,147 @@
+///
+/// Tile server: square tiles of the set, addressed like the ones
+/// of web maps, served over a small subset of HTTP
+///
+#ifndef I_SERVER
+#define I_SERVER
+
+#include "common.h"
+#include "gen/api.h"
+#include "image/image.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+/// Side of a tile, pixels
+#define SRV_TILE_SIZE 256
+#define SRV_TILE_PIXELS (SRV_TILE_SIZE * SRV_TILE_SIZE)
+
+/// Level 0 is one tile covering [-2, 2] x [-2, 2], every next
+/// level splits tiles in four. Tile centers are dyadic numbers,
+/// so they are exact up to this level.
+#define SRV_WORLD_MIN  (-2.0)
+#define SRV_WORLD_SIZE 4.0
+#define SRV_MAX_ZOOM   48
+
+/// Largest `max_steps` a request may ask for
+#define SRV_MAX_STEPS 1000000
+
+/// Longest id of a client, see `srv_tiles_get`
+#define SRV_CLIENT_LEN 32
+
+/// Tile (x, y) of level z, x grows with Re and y with Im,
+/// like columns and rows of a frame
+struct Srv_TileKey {
+	int z;
+	int64_t x, y;
+	int max_steps;
+};
+
+static inline uint64_t srv_tile_key_hash(const struct Srv_TileKey *key)
+{
+	uint64_t h = 0xcbf29ce484222325ull;
+	uint64_t parts[] = { key->z, key->x, key->y, key->max_steps };
+	for (size_t i = 0; i < sizeof(parts) / sizeof(parts[0]); ++i)
+		h = (h ^ parts[i]) * 0x100000001b3ull;
+	return h ^ (h >> 29);
+}
+
+static inline bool srv_tile_key_equal(const struct Srv_TileKey *a, const struct Srv_TileKey *b)
+{
+	return a->z == b->z && a->x == b->x && a->y == b->y && a->max_steps == b->max_steps;
+}
+
+/// Steps of tiles are kept in the smallest format which holds them
+static inline size_t srv_tile_bytes(const struct Srv_TileKey *key)
+{
+	return SRV_TILE_PIXELS * mb_steps_size(mb_compact_format(key->max_steps));
+}
+
+// Tiles: cache in front of the request queue and render workers
+
+struct Srv_Tiles;
+
+enum Srv_Result {
+	SRV_HIT,            // tile was in the cache
+	SRV_COMPUTED,       // request queued the tile and waited for it
+	SRV_COALESCED,      // tile was already queued by another request
+	SRV_CANCELLED,      // client hung up while waiting
+	SRV_SUPERSEDED,     // client asked for a newer view
+	SRV_BUSY,           // queue is full
+};
+
+struct Srv_Stats {
+	uint64_t requests, hits, computed, coalesced;
+	uint64_t cancelled, superseded, busy;
+	uint64_t dropped;   // tiles nobody waited for anymore, not computed
+	int queued, running;
+	size_t cache_bytes;
+};
+
+/// Starts `workers` threads computing tiles with generator `gen_idx`
+/// (or deeper ones, when tiles are small). At most `queue_cap` tiles
+/// wait in the queue.
+struct Srv_Tiles *srv_tiles_create(int gen_idx, int workers, size_t cache_bytes, int queue_cap);
+
+/// Stops the workers, nobody may wait for tiles anymore
+void srv_tiles_destroy(struct Srv_Tiles *tiles);
+
+struct Srv_Stats srv_tiles_stats(struct Srv_Tiles *tiles);
+
+/// Gets steps of the tile into `steps`, waiting until it is computed.
+/// Same tiles asked at once are computed once. Socket `fd` is watched
+/// while waiting, and if it is closed, the request is given up.
+///
+/// Requests of the same `client` (if not empty) with lower `view`
+/// are superseded: ones waiting are given up, new ones are refused.
+/// Tiles nobody waits for anymore are dropped from the queue, or
+/// stop being computed.
+enum Srv_Result srv_tiles_get(
+		struct Srv_Tiles *tiles, const struct Srv_TileKey *key,
+		const char *client, uint64_t view, int fd, void *steps
+);
+
+// HTTP subset: GET requests, keep-alive, Content-Length bodies
+
+/// Largest request head
+#define SRV_REQUEST_MAX 4096
+
+enum Srv_RequestKind {
+	SRV_REQ_TILE,
+	SRV_REQ_STATS,
+};
+
+struct Srv_Request {
+	enum Srv_RequestKind kind;
+	struct Srv_TileKey key;
+	enum Img_Format format;
+	int colorizer;
+	char client[SRV_CLIENT_LEN];
+	uint64_t view;
+	bool keep_alive;
+};
+
+/// Reads until the end of a request head, `*have` bytes are already
+/// in `buf` and bytes after the head are left there. Returns length
+/// of the head, 0 if the connection is closed, -1 on errors.
+int srv_http_read(int fd, char *buf, size_t size, size_t *have);
+
+/// Parses the head, `max_steps` is used if the request does not give
+/// it. Returns HTTP status to answer with if it is not a valid one,
+/// 200 otherwise.
+int srv_http_parse(char *head, int max_steps, struct Srv_Request *req);
+
+/// Writes the response head, `headers` are extra lines ending with
+/// "\r\n" or NULL, then `len` bytes of the body from `body_fd`
+bool srv_http_respond_fd(
+		int fd, int status, const char *type, const char *headers,
+		int body_fd, size_t len, bool keep_alive
+);
+
+/// Same with the body from memory
+bool srv_http_respond(
+		int fd, int status, const char *type, const char *headers,
+		const char *body, bool keep_alive
+);
+
+#endif
@@ -0,0 +1,428 @@
+///
+/// Request queue. Every tile which is not cached becomes a job, and
+/// requests for it wait on the job, so a tile asked by many clients
+/// at once is computed once. Jobs are taken by workers in the order
+/// they came, each worker computes a whole tile on its own.
+///
+/// Waiters leave when their client hangs up or asks for a newer view.
+/// A job nobody waits for is dropped from the queue, or cancelled if
+/// it is being computed (`Mb_GeneratorData::cancel`).
+///
+/// Everything is under one mutex, it is held only for bookkeeping.
+///
+#define _GNU_SOURCE
+#include "server/server.h"
+#include "render/api.h"
+#include <errno.h>
+#include <math.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define JOB_BUCKETS 1024
+
+/// Clients whose views are remembered, least recently seen are forgotten
+#define MAX_CLIENTS 256
+
+/// Waiters check if their client is still there this often
+#define POLL_MS 50
+
+struct Waiter {
+	const char *client;
+	uint64_t view;
+	bool superseded;
+	struct Waiter *next;
+};
+
+enum JobState {
+	JOB_QUEUED,
+	JOB_RUNNING,
+	JOB_DONE,
+};
+
+struct Job {
+	struct Srv_TileKey key;
+	enum JobState state;
+	void *steps;
+	struct Waiter *waiters;
+	int nwaiters;
+	// Nobody waits for it while it runs, it is not in the table
+	// anymore, the worker frees it
+	bool orphan;
+	_Atomic unsigned cancel;
+	pthread_cond_t done;
+	struct Job *hash_next;
+	struct Job *queue_next;
+};
+
+struct Client {
+	char id[SRV_CLIENT_LEN];
+	uint64_t view;
+	uint64_t seen;
+};
+
+struct Srv_Tiles {
+	pthread_mutex_t mutex;
+	pthread_cond_t has_jobs;
+	struct Mb_TileCache *cache;
+	int gen_idx;
+
+	// Queued and running jobs, by their tiles
+	struct Job *buckets[JOB_BUCKETS];
+	struct Job *queue_first, *queue_last;
+	int queue_cap;
+
+	struct Client clients[MAX_CLIENTS];
+	int nclients;
+	uint64_t clock;
+
+	struct Srv_Stats stats;
+
+	pthread_t *workers;
+	int nworkers;
+	bool quit;
+};
+
+/// Tiles are cached under their own numbers, level is told by the pixel
+static struct Mb_TileKey cache_key(const struct Srv_TileKey *key)
+{
+	return (struct Mb_TileKey) {
+		.pixel = ldexp(SRV_WORLD_SIZE / SRV_TILE_SIZE, -key->z),
+		.tx = key->x,
+		.ty = key->y,
+		.max_steps = key->max_steps,
+	};
+}
+
+static struct Job **bucket_of(struct Srv_Tiles *tiles, const struct Srv_TileKey *key)
+{
+	return &tiles->buckets[srv_tile_key_hash(key) % JOB_BUCKETS];
+}
+
+static struct Job *job_find(struct Srv_Tiles *tiles, const struct Srv_TileKey *key)
+{
+	struct Job *job = *bucket_of(tiles, key);
+	while (job && !srv_tile_key_equal(&job->key, key))
+		job = job->hash_next;
+	return job;
+}
+
+static void job_unhash(struct Srv_Tiles *tiles, struct Job *job)
+{
+	struct Job **p = bucket_of(tiles, &job->key);
+	while (*p != job)
+		p = &(*p)->hash_next;
+	*p = job->hash_next;
+}
+
+static void queue_unlink(struct Srv_Tiles *tiles, struct Job *job)
+{
+	struct Job **p = &tiles->queue_first, *prev = NULL;
+	while (*p != job) {
+		prev = *p;
+		p = &(*p)->queue_next;
+	}
+	*p = job->queue_next;
+	if (tiles->queue_last == job)
+		tiles->queue_last = prev;
+	tiles->stats.queued--;
+}
+
+static struct Job *job_create(struct Srv_Tiles *tiles, const struct Srv_TileKey *key)
+{
+	struct Job *job = calloc(1, sizeof(*job));
+	job->key = *key;
+	job->state = JOB_QUEUED;
+	job->steps = aligned_alloc(32, srv_tile_bytes(key));
+	pthread_cond_init(&job->done, NULL);
+
+	struct Job **bucket = bucket_of(tiles, key);
+	job->hash_next = *bucket;
+	*bucket = job;
+
+	if (tiles->queue_last)
+		tiles->queue_last->queue_next = job;
+	else
+		tiles->queue_first = job;
+	tiles->queue_last = job;
+	tiles->stats.queued++;
+	pthread_cond_signal(&tiles->has_jobs);
+	return job;
+}
+
+static void job_free(struct Job *job)
+{
+	pthread_cond_destroy(&job->done);
+	free(job->steps);
+	free(job);
+}
+
+/// Computes the tile, the mutex is not held
+static void render_job(struct Srv_Tiles *tiles, struct Job *job)
+{
+	const struct Srv_TileKey *key = &job->key;
+	double size = ldexp(SRV_WORLD_SIZE, -key->z);
+
+	struct Mb_GeneratorData gdata = {
+		.exit_steps = job->steps,
+		.format = mb_compact_format(key->max_steps),
+		.bwidth = SRV_TILE_SIZE,
+		.bheight = SRV_TILE_SIZE,
+		.max_steps = key->max_steps,
+		.swidth = size,
+		.has_hp_center = true,
+		.options = 0,
+		.stats = NULL,
+		.cancel = &job->cancel,
+		.epoch = 0,
+	};
+
+	// Center is min + (2x + 1) * size / 2, which is exact
+	// both in double and in Mb_Big up to SRV_MAX_ZOOM
+	struct Mb_Big min = mb_big_from_double(SRV_WORLD_MIN);
+	struct Mb_Big dx = mb_big_from_double((2 * key->x + 1) * size / 2);
+	struct Mb_Big dy = mb_big_from_double((2 * key->y + 1) * size / 2);
+	gdata.xc_hp = mb_big_add(&min, &dx);
+	gdata.yc_hp = mb_big_add(&min, &dy);
+	gdata.xc = mb_big_to_double(&gdata.xc_hp);
+	gdata.yc = mb_big_to_double(&gdata.yc_hp);
+	gdata.rect = mb_full_rect(&gdata);
+
+	int active = mb_pick_generator(tiles->gen_idx, &gdata);
+	generators[active].mandelbrot(&gdata);
+}
+
+static void worker_main(struct Srv_Tiles *tiles)
+{
+	pthread_mutex_lock(&tiles->mutex);
+	while (true) {
+		while (!tiles->queue_first && !tiles->quit)
+			pthread_cond_wait(&tiles->has_jobs, &tiles->mutex);
+		if (tiles->quit)
+			break;
+
+		struct Job *job = tiles->queue_first;
+		queue_unlink(tiles, job);
+		job->state = JOB_RUNNING;
+		tiles->stats.running++;
+		pthread_mutex_unlock(&tiles->mutex);
+
+		render_job(tiles, job);
+
+		pthread_mutex_lock(&tiles->mutex);
+		tiles->stats.running--;
+		if (job->orphan) {
+			job_free(job);
+			continue;
+		}
+
+		struct Mb_TileKey ckey = cache_key(&job->key);
+		mb_tile_cache_put(tiles->cache, &ckey, job->steps);
+		job_unhash(tiles, job);
+		job->state = JOB_DONE;
+		tiles->stats.computed++;
+		pthread_cond_broadcast(&job->done);
+	}
+	pthread_mutex_unlock(&tiles->mutex);
+}
+
+struct Srv_Tiles *srv_tiles_create(int gen_idx, int workers, size_t cache_bytes, int queue_cap)
+{
+	struct Srv_Tiles *tiles = calloc(1, sizeof(*tiles));
+	pthread_mutex_init(&tiles->mutex, NULL);
+	pthread_cond_init(&tiles->has_jobs, NULL);
+	// Steps are kept like the jobs compute them, in `mb_compact_format`
+	tiles->cache = mb_tile_cache_create(cache_bytes, SRV_TILE_SIZE, MB_STEPS_I32);
+	tiles->gen_idx = gen_idx;
+	tiles->queue_cap = queue_cap;
+
+	tiles->nworkers = workers;
+	tiles->workers = calloc(workers, sizeof(*tiles->workers));
+	for (int i = 0; i < workers; ++i)
+		pthread_create(&tiles->workers[i], NULL, (void*(*)(void*)) worker_main, tiles);
+	return tiles;
+}
+
+void srv_tiles_destroy(struct Srv_Tiles *tiles)
+{
+	pthread_mutex_lock(&tiles->mutex);
+	tiles->quit = true;
+	pthread_cond_broadcast(&tiles->has_jobs);
+	pthread_mutex_unlock(&tiles->mutex);
+	for (int i = 0; i < tiles->nworkers; ++i)
+		pthread_join(tiles->workers[i], NULL);
+
+	// Nobody waits, so the rest are queued ones
+	while (tiles->queue_first) {
+		struct Job *job = tiles->queue_first;
+		tiles->queue_first = job->queue_next;
+		job_free(job);
+	}
+	mb_tile_cache_destroy(tiles->cache);
+	free(tiles->workers);
+	pthread_mutex_destroy(&tiles->mutex);
+	pthread_cond_destroy(&tiles->has_jobs);
+	free(tiles);
+}
+
+struct Srv_Stats srv_tiles_stats(struct Srv_Tiles *tiles)
+{
+	pthread_mutex_lock(&tiles->mutex);
+	struct Srv_Stats stats = tiles->stats;
+	stats.cache_bytes = mb_tile_cache_stats(tiles->cache).bytes;
+	pthread_mutex_unlock(&tiles->mutex);
+	return stats;
+}
+
+/// Wakes up waiters of `client` with views older than `view`
+static void supersede(struct Srv_Tiles *tiles, const char *client, uint64_t view)
+{
+	for (int i = 0; i < JOB_BUCKETS; ++i) {
+		for (struct Job *job = tiles->buckets[i]; job; job = job->hash_next) {
+			bool woken = false;
+			for (struct Waiter *w = job->waiters; w; w = w->next) {
+				if (w->view < view && strcmp(w->client, client) == 0) {
+					w->superseded = true;
+					woken = true;
+				}
+			}
+			if (woken)
+				pthread_cond_broadcast(&job->done);
+		}
+	}
+}
+
+/// Remembers the view of the client, returns false if it is older
+/// than the one it has already asked for
+static bool client_view(struct Srv_Tiles *tiles, const char *id, uint64_t view)
+{
+	struct Client *client = NULL;
+	for (int i = 0; i < tiles->nclients && !client; ++i)
+		if (strcmp(tiles->clients[i].id, id) == 0)
+			client = &tiles->clients[i];
+
+	if (!client) {
+		if (tiles->nclients < MAX_CLIENTS) {
+			client = &tiles->clients[tiles->nclients++];
+		} else {
+			client = &tiles->clients[0];
+			for (int i = 1; i < MAX_CLIENTS; ++i)
+				if (tiles->clients[i].seen < client->seen)
+					client = &tiles->clients[i];
+		}
+		snprintf(client->id, sizeof(client->id), "%s", id);
+		client->view = view;
+	}
+	client->seen = ++tiles->clock;
+
+	if (view < client->view)
+		return false;
+	if (view > client->view) {
+		client->view = view;
+		supersede(tiles, id, view);
+	}
+	return true;
+}
+
+/// Takes the waiter off the job, drops the job if it was the last one
+static void leave_job(struct Srv_Tiles *tiles, struct Job *job, struct Waiter *waiter)
+{
+	struct Waiter **p = &job->waiters;
+	while (*p != waiter)
+		p = &(*p)->next;
+	*p = waiter->next;
+	if (--job->nwaiters)
+		return;
+
+	switch (job->state) {
+	case JOB_QUEUED:
+		queue_unlink(tiles, job);
+		job_unhash(tiles, job);
+		job_free(job);
+		tiles->stats.dropped++;
+		break;
+	case JOB_RUNNING:
+		job_unhash(tiles, job);
+		job->orphan = true;
+		atomic_fetch_add(&job->cancel, 1);
+		tiles->stats.dropped++;
+		break;
+	case JOB_DONE:
+		job_free(job);
+		break;
+	}
+}
+
+static bool client_gone(int fd)
+{
+	struct pollfd pfd = { .fd = fd, .events = POLLRDHUP };
+	return poll(&pfd, 1, 0) > 0 && (pfd.revents & (POLLRDHUP | POLLHUP | POLLERR));
+}
+
+enum Srv_Result srv_tiles_get(
+		struct Srv_Tiles *tiles, const struct Srv_TileKey *key,
+		const char *client, uint64_t view, int fd, void *steps
+)
+{
+	pthread_mutex_lock(&tiles->mutex);
+	tiles->stats.requests++;
+
+	if (client[0] && !client_view(tiles, client, view)) {
+		tiles->stats.superseded++;
+		pthread_mutex_unlock(&tiles->mutex);
+		return SRV_SUPERSEDED;
+	}
+
+	struct Mb_TileKey ckey = cache_key(key);
+	if (mb_tile_cache_get(tiles->cache, &ckey, steps)) {
+		tiles->stats.hits++;
+		pthread_mutex_unlock(&tiles->mutex);
+		return SRV_HIT;
+	}
+
+	enum Srv_Result res = SRV_COALESCED;
+	struct Job *job = job_find(tiles, key);
+	if (job) {
+		tiles->stats.coalesced++;
+	} else if (tiles->stats.queued >= tiles->queue_cap) {
+		tiles->stats.busy++;
+		pthread_mutex_unlock(&tiles->mutex);
+		return SRV_BUSY;
+	} else {
+		job = job_create(tiles, key);
+		res = SRV_COMPUTED;
+	}
+
+	struct Waiter waiter = { .client = client, .view = view, .next = job->waiters };
+	job->waiters = &waiter;
+	job->nwaiters++;
+
+	while (job->state != JOB_DONE && !waiter.superseded) {
+		struct timespec until;
+		clock_gettime(CLOCK_REALTIME, &until);
+		until.tv_nsec += POLL_MS * 1000000l;
+		until.tv_sec += until.tv_nsec / 1000000000l;
+		until.tv_nsec %= 1000000000l;
+		int err = pthread_cond_timedwait(&job->done, &tiles->mutex, &until);
+		if (err == ETIMEDOUT && job->state != JOB_DONE && client_gone(fd)) {
+			res = SRV_CANCELLED;
+			break;
+		}
+	}
+
+	if (waiter.superseded) {
+		res = SRV_SUPERSEDED;
+		tiles->stats.superseded++;
+	} else if (res == SRV_CANCELLED) {
+		tiles->stats.cancelled++;
+	} else {
+		memcpy(steps, job->steps, srv_tile_bytes(key));
+	}
+	leave_job(tiles, job, &waiter);
+
+	pthread_mutex_unlock(&tiles->mutex);
+	return res;
+}
@@ -0,0 +1,193 @@
+///
+/// Batch tool which fills the tile store with the regions the viewer
+/// will show, so it starts with them instantly
+///
+#include "common.h"
+#include "gen/api.h"
+#include "render/api.h"
+#include <errno.h>
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/// Tiles pass through the cache only for one frame,
+/// so it does not have to be large
+#define CACHE_MB 64
+
+static void print_usage(const char *name)
+{
+	printf(
+			"Usage: %s -f FILE [-g GENERATOR_NAME] [-t THREADS] [-x X] [-y Y]\n"
+			"       [-w WIDTH] [-z LEVELS] [-a AROUND] [-i] [-h]\n", name
+	);
+	printf(
+			"  -h                 Prints this help message\n"
+			"  -f FILE            Tile store to fill, created if it does not exist\n"
+			"  -i                 Only print what is in the store\n"
+			"  -g GENERATOR_NAME  Generator to compute with, `%s` by default\n"
+			"  -t THREADS         Number of threads, all CPUs by default\n"
+			"  -x X, -y Y         Center of the region, (0, 0) by default\n"
+			"  -w WIDTH           Width of the view on level 0, same as `-w` of\n"
+			"                     the viewer, %g by default\n"
+			"  -z LEVELS          Number of zoom levels (viewer's [PgDn] presses)\n"
+			"                     to compute, 1 by default\n"
+			"  -a AROUND          Also compute this many frames in every direction\n"
+			"                     around the center one, 0 by default\n",
+			generators[DEFAULT_GENERATOR].name, (double) INITIAL_SCALE
+	);
+}
+
+static void print_store(const struct Mb_TileStore *store)
+{
+	struct Mb_TileStoreStats st = mb_tile_store_stats(store);
+	size_t raw = st.tiles * CACHE_TILE_SIZE * CACHE_TILE_SIZE * sizeof(int);
+	printf("Tiles:       %lu\n", st.tiles);
+	printf("Size:        %.2f MiB\n", st.bytes / 1048576.0);
+	if (st.tiles)
+		printf("Compression: %.1fx\n", (double) raw / st.bytes);
+}
+
+int main(int argc, char **argv)
+{
+	const char *path = NULL;
+	const char *gen_name = generators[DEFAULT_GENERATOR].name;
+	int threads = mb_cpu_count();
+	double xc = INITIAL_POS_X, yc = INITIAL_POS_Y, swidth = INITIAL_SCALE;
+	int levels = 1, around = 0;
+	bool info_only = false;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "f:ig:t:x:y:w:z:a:h")) != -1) {
+		switch (opt) {
+		case 'h':
+			print_usage(argv[0]);
+			return 0;
+		case 'f':
+			path = optarg;
+			break;
+		case 'i':
+			info_only = true;
+			break;
+		case 'g':
+			gen_name = optarg;
+			break;
+		case 't':
+			threads = atoi(optarg);
+			break;
+		case 'x':
+			xc = atof(optarg);
+			break;
+		case 'y':
+			yc = atof(optarg);
+			break;
+		case 'w':
+			swidth = atof(optarg);
+			break;
+		case 'z':
+			levels = atoi(optarg);
+			break;
+		case 'a':
+			around = atoi(optarg);
+			break;
+		default:
+			print_usage(argv[0]);
+			return -1;
+		}
+	}
+
+	if (!path) {
+		printf("Error: no store file given\n");
+		return -1;
+	}
+
+	int gen_idx = mb_find_generator(gen_name);
+	if (gen_idx < 0) {
+		printf("Error: unknown generator `%s` or the CPU does not support it\n", gen_name);
+		return -1;
+	}
+
+	if (threads < 1 || levels < 1 || around < 0 || !(swidth > 0)) {
+		printf("Error: invalid numeric argument\n");
+		return -1;
+	}
+
+	struct Mb_TileStore *store = mb_tile_store_open(path, !info_only);
+	if (!store) {
+		printf("Error: failed to open `%s`: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	if (info_only) {
+		print_store(store);
+		mb_tile_store_close(store);
+		return 0;
+	}
+
+	if (!mb_tile_store_stats(store).writable) {
+		printf("Error: `%s` is being written by another process\n", path);
+		mb_tile_store_close(store);
+		return -1;
+	}
+
+	struct Mb_Pool *pool = mb_pool_create(threads);
+	struct Mb_TileCache *cache = mb_tile_cache_create(
+			(size_t) CACHE_MB << 20, CACHE_TILE_SIZE, MB_STEPS_I32
+	);
+	mb_tile_cache_set_store(cache, store);
+
+	struct Mb_GeneratorData gdata = {
+		.bwidth = WIN_WIDTH,
+		.bheight = WIN_HEIGHT,
+		.max_steps = VIEWER_MAX_STEPS,
+		.format = MB_STEPS_I32,
+		.has_hp_center = false,
+		.options = 0,
+		.stats = NULL,
+	};
+	gdata.exit_steps = aligned_alloc(32, WIN_WIDTH * WIN_HEIGHT * sizeof(int));
+
+	for (int level = 0; level < levels; ++level) {
+		// Same way as the viewer computes it
+		gdata.swidth = swidth * pow(SCALE_STEP, -level);
+		double sheight = gdata.swidth / WIN_WIDTH * WIN_HEIGHT;
+		int active = mb_pick_generator(gen_idx, &gdata);
+
+		uint64_t loaded = 0, computed = 0;
+		double begin = wall_time_ms();
+
+		for (int fy = -around; fy <= around; ++fy) {
+			for (int fx = -around; fx <= around; ++fx) {
+				gdata.xc = xc + fx * gdata.swidth;
+				gdata.yc = yc + fy * sheight;
+				gdata.rect = mb_full_rect(&gdata);
+
+				if (!mb_render_cached(cache, pool, &generators[active], &gdata)) {
+					printf("Level %d needs `%s`, which can not be stored, stopping\n",
+							level, generators[active].name);
+					goto done;
+				}
+
+				struct Mb_TileCacheStats st = mb_tile_cache_stats(cache);
+				loaded += st.frame_loads;
+				computed += st.frame_misses - st.frame_loads;
+			}
+		}
+
+		printf(
+			"Level %-3d width %-10.4g %-12s %6lu tiles loaded, %6lu computed, %9.1f ms\n",
+			level, gdata.swidth, generators[active].name,
+			loaded, computed, wall_time_ms() - begin
+		);
+	}
+
+done:
+	print_store(store);
+
+	free(gdata.exit_steps);
+	mb_tile_cache_destroy(cache);
+	mb_pool_destroy(pool);
+	mb_tile_store_close(store);
+	return 0;
+}
@@ -13,7 +13,7 @@ void ui_fillrect(struct State *st, int x, int y, int w, int h, ARGB color)
 
 	for (int iy = y; iy < y+h && iy < WIN_HEIGHT; ++iy)
 		for (int ix = x; ix < x+w && ix < WIN_WIDTH; ++ix)
-			st->fb[iy * WIN_WIDTH + ix] = color;
+			st->fb[iy * st->fb_pitch + ix] = color;
 }
 
 void ui_textflow_init(struct UI_TextFlow *flow, struct State *state, int x, int y)
@@ -44,7 +44,7 @@ void ui_textflow_puts(struct UI_TextFlow *flow, ARGB color, const char *text)
 		for (int iy = 0; iy < FONT_SIZE_Y; ++iy)
 			for (int ix = 0; ix < FONT_SIZE_X; ++ix)
 				if (font_bitmap[*text - FONT_FIRST_CHAR][FONT_SIZE_Y-1-iy] & (1 << (FONT_SIZE_X-1-ix)))
-					flow->state->fb[(flow->y + iy) * WIN_WIDTH + (flow->x + ix)] = color;
+					flow->state->fb[(flow->y + iy) * flow->state->fb_pitch + (flow->x + ix)] = color;
 		flow->x += FONT_SIZE_X+1;
 	}
 }
@@ -4,47 +4,99 @@
 #include "viewer.h"
 #include <SDL2/SDL.h>
 #include <math.h>
+#include <errno.h>
 #include <getopt.h>
 #include <pthread.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
 #define ALIGN 32
-#define MAX_STEPS 256
 
+/// Part of the width to move by. Moves are rounded to whole pixels,
+/// so the previous frame can be shifted instead of computed again.
 #define MOVE_STEP 0.2
-#define SCALE_STEP 1.5
 
-static void init_state(struct State *state)
+/// Frame is colored in parts of this many rows
+#define COLOR_ROWS 16
+
+/// Frames are deepened after they are shown, raising iteration limit
+/// by this many steps for every halving of the width, up to DEEPEN_MAX_STEPS
+#define DEEPEN_STEPS_PER_OCTAVE 128
+#define DEEPEN_MAX_STEPS 65535
+
+/// Default memory cap of the tile cache, MiB
+#define TILE_CACHE_MB 256
+
+static void init_state(
+		struct State *state, int threads, size_t cache_mb, const char *store_path,
+		const struct Mb_Big *xc, const struct Mb_Big *yc, double swidth
+)
 {
 	state->fb = calloc(WIN_WIDTH * WIN_HEIGHT, sizeof(*state->fb));
-	state->exit_steps_rendered = aligned_alloc(
-			ALIGN,
-			WIN_WIDTH * WIN_HEIGHT * sizeof(*state->exit_steps_rendered)
-	);
-	state->exit_steps_ready = aligned_alloc(
-			ALIGN,
-			WIN_WIDTH * WIN_HEIGHT * sizeof(*state->exit_steps_ready)
-	);
-	state->gdata.exit_steps = aligned_alloc(
-			ALIGN,
-			WIN_WIDTH * WIN_HEIGHT * sizeof(*state->gdata.exit_steps)
-	);
-	state->gdata.max_steps = MAX_STEPS;
-	state->new_params.xc = state->gdata.xc = INITIAL_POS_X;
-	state->new_params.yc = state->gdata.yc = INITIAL_POS_Y;
-	state->new_params.swidth = state->gdata.swidth = INITIAL_SCALE;
+	state->fb_pitch = WIN_WIDTH;
+	// Steps of deepened frames fit in 16 bits,
+	// which makes frames 2 times smaller than ints
+	state->gdata.format = mb_compact_format(DEEPEN_MAX_STEPS);
+	size_t frame_bytes = WIN_WIDTH * WIN_HEIGHT * mb_steps_size(state->gdata.format);
+	state->exit_steps_rendered = aligned_alloc(ALIGN, frame_bytes);
+	state->exit_steps_ready = aligned_alloc(ALIGN, frame_bytes);
+	state->exit_steps_deep = aligned_alloc(ALIGN, frame_bytes);
+	state->gdata.exit_steps = aligned_alloc(ALIGN, frame_bytes);
+	state->gdata.max_steps = VIEWER_MAX_STEPS;
+	state->rendered_max_steps = state->ready_max_steps = VIEWER_MAX_STEPS;
+	state->orbits = (struct Mb_Orbits) { .steps = -1 };
+	state->deepen = true;
+	state->new_params.xc = state->gdata.xc_hp = *xc;
+	state->new_params.yc = state->gdata.yc_hp = *yc;
+	state->gdata.xc = mb_big_to_double(xc);
+	state->gdata.yc = mb_big_to_double(yc);
+	state->gdata.has_hp_center = true;
+	state->gdata.stats = NULL;
+	state->gdata.cancel = &state->epoch;
+	state->gdata.epoch = 0;
+	state->new_params.options = state->gdata.options = 0;
+	state->new_params.swidth = state->gdata.swidth = swidth;
+	state->new_params.zoom = 0;
+	state->base_swidth = swidth;
 	state->gdata.bheight = WIN_HEIGHT;
 	state->gdata.bwidth = WIN_WIDTH;
+	state->gdata.rect = mb_full_rect(&state->gdata);
 	state->shall_quit = false;
 	state->has_fresh_data = false;
 	state->ms_per_frame = INFINITY;
+	state->epoch = 0;
+	state->input_ms = state->fresh_input_ms = 0;
+	state->latency_ms = NAN;
+	state->deep_steps = state->deep_target = VIEWER_MAX_STEPS;
 
-	state->generator = DEFAULT_GENERATOR;
+	state->generator = state->active_generator = DEFAULT_GENERATOR;
 	state->colorizer = DEFAULT_COLORIZER;
+	state->renderer = DEFAULT_RENDERER;
+	state->pool = mb_pool_create(threads);
+	state->color_pool = mb_pool_create(threads);
+	state->palette = (struct Mb_Palette) { 0 };
+	state->color_ms = 0;
+	state->fused = false;
+	state->pan_cache = (struct Mb_PanCache) { 0 };
+	state->tile_cache = cache_mb
+		? mb_tile_cache_create(cache_mb << 20, CACHE_TILE_SIZE, MB_STEPS_I32)
+		: NULL;
+	state->use_tile_cache = state->tile_cache != NULL;
+	state->tile_store = NULL;
+	if (store_path) {
+		if (!state->tile_cache)
+			DIE("Tile store needs the tile cache, `-c` must not be 0");
+		state->tile_store = mb_tile_store_open(store_path, true);
+		if (!state->tile_store)
+			DIE("Failed to open tile store `%s`: %s", store_path, strerror(errno));
+		mb_tile_cache_set_store(state->tile_cache, state->tile_store);
+	}
+	state->tile_stats = (struct Mb_TileCacheStats) { 0 };
 
 	pthread_mutex_init(&state->data_mutex, NULL);
+	pthread_cond_init(&state->params_changed, NULL);
 }
 
 static void deinit_state(struct State *state)
@@ -52,135 +104,589 @@ static void deinit_state(struct State *state)
 	free(state->fb);
 	free(state->exit_steps_ready);
 	free(state->exit_steps_rendered);
+	free(state->exit_steps_deep);
 	free(state->gdata.exit_steps);
+	mb_orbits_free(&state->orbits);
+	mb_pool_destroy(state->pool);
+	mb_pool_destroy(state->color_pool);
+	color_palette_free(&state->palette);
+	mb_pan_cache_free(&state->pan_cache);
+	if (state->tile_cache)
+		mb_tile_cache_destroy(state->tile_cache);
+	if (state->tile_store)
+		mb_tile_store_close(state->tile_store);
 	pthread_mutex_destroy(&state->data_mutex);
+	pthread_cond_destroy(&state->params_changed);
+}
+
+/// Takes the view the UI asked for, `data_mutex` must be held
+/// while the generator thread runs
+static void load_params(struct State *state)
+{
+	state->gdata.xc_hp = state->new_params.xc;
+	state->gdata.yc_hp = state->new_params.yc;
+	state->gdata.xc = mb_big_to_double(&state->new_params.xc);
+	state->gdata.yc = mb_big_to_double(&state->new_params.yc);
+	state->gdata.swidth = state->new_params.swidth;
+	state->gdata.options = state->new_params.options;
+	state->gdata.epoch = atomic_load(&state->epoch);
+	state->loaded.generator = state->generator;
+	state->loaded.renderer = state->renderer;
+	state->loaded.use_tile_cache = state->use_tile_cache;
+}
+
+/// Tells the generator thread the frame it computes is stale.
+/// `input_ms` is when the user asked for the new one.
+static void cancel_frame(struct State *state, double input_ms)
+{
+	pthread_mutex_lock(&state->data_mutex);
+	atomic_fetch_add(&state->epoch, 1);
+	if (!state->input_ms)
+		state->input_ms = input_ms;
+	pthread_cond_signal(&state->params_changed);
+	pthread_mutex_unlock(&state->data_mutex);
+}
+
+/// Iteration limit deep zooms need: boundary there is finer,
+/// so more pixels stay bounded longer before they escape
+static int deepen_target(double swidth)
+{
+	double octaves = fmax(0, log2(INITIAL_SCALE / swidth));
+	return fmin(DEEPEN_MAX_STEPS, VIEWER_MAX_STEPS + DEEPEN_STEPS_PER_OCTAVE * octaves);
+}
+
+/// Wakes the UI thread up to show the fresh frame
+static void push_frame_event(struct State *state)
+{
+	SDL_Event fresh = { .type = state->frame_event };
+	SDL_PushEvent(&fresh);
 }
 
 static void generator_main(struct State *state)
 {
-	void (*generator)(struct Mb_GeneratorData *gdata)
-		= generators[state->generator].mandelbrot;
+	// Input the frame answers, kept if the frame is cancelled
+	double input_ms = 0;
 
-	while (!state->shall_quit) {
+	while (true) {
+		pthread_mutex_lock(&state->data_mutex);
+		bool quit = state->shall_quit, deepen = state->deepen;
+		load_params(state);
+		if (!input_ms)
+			input_ms = state->input_ms;
+		state->input_ms = 0;
+		pthread_mutex_unlock(&state->data_mutex);
+		if (quit)
+			break;
 
 		// Compute
 		// gdata is only for this thread
-		
-		clock_t begin = clock();
-		generator(&state->gdata);
-		clock_t end = clock();
-		
+
+		// Precise variants are slower, so use them only when zoom needs it
+		int active = mb_pick_generator(state->loaded.generator, &state->gdata);
+
+		double begin = wall_time_ms();
+		bool cached = state->loaded.use_tile_cache && mb_render_cached(
+			state->tile_cache, state->pool, &generators[active], &state->gdata
+		);
+		if (!cached)
+			mb_render_incremental(
+				&state->pan_cache, state->pool,
+				&renderers[state->loaded.renderer], &generators[active], &state->gdata
+			);
+		double end = wall_time_ms();
+
+		// Parameters have changed while it was computed,
+		// the rest of it was skipped
+		if (mb_cancelled(&state->gdata))
+			continue;
+
+		// Deepening starts from this frame, before it is swapped away.
+		// Frames of other generators would not match their own ones
+		// with the higher limit, so they stay at the base one.
+		int target = deepen && mb_deepens_exactly(&generators[active])
+			? deepen_target(state->gdata.swidth) : VIEWER_MAX_STEPS;
+		size_t frame_bytes = WIN_WIDTH * WIN_HEIGHT * mb_steps_size(state->gdata.format);
+		if (target > VIEWER_MAX_STEPS)
+			memcpy(state->exit_steps_deep, state->gdata.exit_steps, frame_bytes);
+
 		pthread_mutex_lock(&state->data_mutex);
 
 		// Here we can safely access shared state
 
 		// Push updates
 		SWAP(state->gdata.exit_steps, state->exit_steps_ready);
+		state->ready_max_steps = VIEWER_MAX_STEPS;
 		state->has_fresh_data = true;
-		state->ms_per_frame = (end - begin) * 1.0f / CLOCKS_PER_SEC * 1000;
+		state->fresh_input_ms = input_ms;
+		state->ms_per_frame = end - begin;
+		state->active_generator = active;
+		state->deep_steps = VIEWER_MAX_STEPS;
+		state->deep_target = target;
+		if (state->tile_cache)
+			state->tile_stats = mb_tile_cache_stats(state->tile_cache);
+		input_ms = 0;
+		push_frame_event(state);
+		pthread_mutex_unlock(&state->data_mutex);
 
-		// Load new params
-		state->gdata.xc = state->new_params.xc;
-		state->gdata.yc = state->new_params.yc;
-		state->gdata.swidth = state->new_params.swidth;
+		// Then the frame is refined while nothing else is asked,
+		// doubling the limit every pass, each pass is shown
+		struct Mb_GeneratorData deep = state->gdata;
+		deep.exit_steps = state->exit_steps_deep;
+		state->orbits.steps = -1;
+		while (deep.max_steps < target && !mb_cancelled(&deep)) {
+			int steps = deep.max_steps * 2 + 1 < target ? deep.max_steps * 2 + 1 : target;
+			mb_render_deepen(state->pool, &deep, &state->orbits, steps);
+			if (mb_cancelled(&deep))
+				break;
 
-		pthread_mutex_unlock(&state->data_mutex);
+			pthread_mutex_lock(&state->data_mutex);
+			memcpy(state->exit_steps_ready, deep.exit_steps, frame_bytes);
+			state->ready_max_steps = steps;
+			state->has_fresh_data = true;
+			state->deep_steps = steps;
+			push_frame_event(state);
+			pthread_mutex_unlock(&state->data_mutex);
+		}
 
-		pthread_testcancel();
+		// Same parameters give the same frame, so
+		// there is nothing to do until they change
+		pthread_mutex_lock(&state->data_mutex);
+		while (!state->shall_quit && atomic_load(&state->epoch) == state->gdata.epoch)
+			pthread_cond_wait(&state->params_changed, &state->data_mutex);
+		pthread_mutex_unlock(&state->data_mutex);
 	}
 }
 
-static void draw_ui(struct State *state)
+static void color_rows(struct State *state, int part)
 {
-	ARGB (*colorizer)(int steps, int max_steps)
-		= colorizers[state->colorizer].color;
-
+	size_t from = (size_t) part * COLOR_ROWS * WIN_WIDTH;
+	size_t to = from + COLOR_ROWS * WIN_WIDTH;
+	if (to > WIN_WIDTH * WIN_HEIGHT)
+		to = WIN_WIDTH * WIN_HEIGHT;
+
+	size_t elem = mb_steps_size(state->gdata.format);
+	color_fill(
+		&state->palette, state->fb + from,
+		(const char*) state->exit_steps_rendered + from * elem,
+		state->gdata.format, to - from
+	);
+}
 
-	// Load step counts
+/// Colors the last frame of the generator thread into state->fb
+static void color_frame(struct State *state)
+{
+	double input_ms = 0;
 	pthread_mutex_lock(&state->data_mutex);
 	if (state->has_fresh_data) {
 		SWAP(state->exit_steps_ready, state->exit_steps_rendered);
+		SWAP(state->ready_max_steps, state->rendered_max_steps);
 		state->has_fresh_data = false;
+		input_ms = state->fresh_input_ms;
+		state->fresh_input_ms = 0;
 	}
-	float ms_per_frame = state->ms_per_frame;
 	pthread_mutex_unlock(&state->data_mutex);
 
-	// Paint the image
-	for (int i = 0; i < WIN_HEIGHT; ++i)
-		for (int j = 0; j < WIN_WIDTH; ++j)
-			state->fb[i * WIN_WIDTH + j]
-					= colorizer(
-							state->exit_steps_rendered[i * WIN_WIDTH + j],
-							MAX_STEPS
-					);
+	double color_begin = wall_time_ms();
+	color_palette_update(&state->palette, &colorizers[state->colorizer], state->rendered_max_steps);
+	mb_pool_run(
+		state->color_pool, (WIN_HEIGHT + COLOR_ROWS - 1) / COLOR_ROWS,
+		(void (*)(void*, int)) color_rows, state
+	);
+	double end = wall_time_ms();
+	state->color_ms = end - color_begin;
+	if (input_ms)
+		state->latency_ms = end - input_ms;
+}
+
+/// Computes and colors a frame on this thread, straight into state->fb.
+/// Generator thread must not be running.
+static void render_fused(struct State *state)
+{
+	load_params(state);
+	int active = mb_pick_generator(state->generator, &state->gdata);
+	const struct Mb_Generator *generator = &generators[active];
+	color_palette_update(&state->palette, &colorizers[state->colorizer], VIEWER_MAX_STEPS);
+
+	double begin = wall_time_ms();
+	bool fused = mb_render_fused(
+		state->pool, generator, &state->gdata,
+		&state->palette, state->fb, state->fb_pitch
+	);
+	double colored = wall_time_ms();
+
+	// Deep zoom frames have to be computed whole first
+	if (!fused) {
+		state->gdata.rect = mb_full_rect(&state->gdata);
+		renderers[state->renderer].render(state->pool, generator, &state->gdata);
+		colored = wall_time_ms();
+
+		size_t row_bytes = WIN_WIDTH * mb_steps_size(state->gdata.format);
+		for (int y = 0; y < WIN_HEIGHT; ++y)
+			color_fill(
+				&state->palette, state->fb + y * state->fb_pitch,
+				(const char*) state->gdata.exit_steps + y * row_bytes,
+				state->gdata.format, WIN_WIDTH
+			);
+	}
+	double end = wall_time_ms();
+
+	pthread_mutex_lock(&state->data_mutex);
+	state->ms_per_frame = end - begin;
+	state->active_generator = active;
+	if (state->input_ms)
+		state->latency_ms = end - state->input_ms;
+	state->input_ms = 0;
+	pthread_mutex_unlock(&state->data_mutex);
+	state->color_ms = end - colored;
+}
+
+static void draw_ui(struct State *state)
+{
+	pthread_mutex_lock(&state->data_mutex);
+	float ms_per_frame = state->ms_per_frame;
+	int active_generator = state->active_generator;
+	struct Mb_TileCacheStats tile_stats = state->tile_stats;
+	int deep_steps = state->deep_steps, deep_target = state->deep_target;
+	pthread_mutex_unlock(&state->data_mutex);
 
-	// Draw text gui
-	
 	struct UI_TextFlow flow;
 	ui_textflow_init(&flow, state, 20, 20);
 	ui_textflow_puts(&flow, C_WHITE, "Mandelbrot set visualizer\n\n");
 	ui_textflow_printf(&flow, C_WHITE, "%-5.2f ms", ms_per_frame);
 	ui_textflow_puts(&flow, C_GRAY, " per frame, ");
 	ui_textflow_printf(&flow, C_WHITE, "%-5.2f fps\n", 1000 / ms_per_frame);
-	ui_textflow_printf(
-			&flow, C_GRAY, "X %-5.3f Y %-5.3f S %-5.3f\n",
-			state->gdata.xc, state->gdata.yc, state->gdata.swidth
-	);
+	ui_textflow_printf(&flow, C_WHITE, "%-5.2f ms", state->color_ms);
+	ui_textflow_puts(&flow, C_GRAY, state->fused ? " to color separately\n" : " to color\n");
+	if (!isnan(state->latency_ms)) {
+		ui_textflow_printf(&flow, C_WHITE, "%-5.2f ms", state->latency_ms);
+		ui_textflow_puts(&flow, C_GRAY, " from input to frame\n");
+	}
+
+	// Enough digits to tell neighbouring pixels apart
+	int digits = fmax(3, ceil(-log10(state->gdata.swidth / WIN_WIDTH)));
+	char xc_str[128], yc_str[128];
+	mb_big_to_str(&state->gdata.xc_hp, xc_str, sizeof(xc_str), digits);
+	mb_big_to_str(&state->gdata.yc_hp, yc_str, sizeof(yc_str), digits);
+	ui_textflow_printf(&flow, C_GRAY, "X %s\nY %s\n", xc_str, yc_str);
+	ui_textflow_printf(&flow, C_GRAY, "S %-5.3g\n", state->gdata.swidth);
 	ui_textflow_puts(&flow, C_GRAY, "Generator: ");
 	ui_textflow_puts(&flow, C_WHITE, generators[state->generator].name);
+	if (active_generator != state->generator)
+		ui_textflow_printf(&flow, C_GRAY, " (%s)", generators[active_generator].name);
 	ui_textflow_puts(&flow, C_DARKER_GRAY, " [g]");
 	ui_textflow_puts(&flow, C_GRAY, "\nColorizer: ");
 	ui_textflow_puts(&flow, C_WHITE, colorizers[state->colorizer].name);
 	ui_textflow_puts(&flow, C_DARKER_GRAY, " [c]\n");
+	ui_textflow_puts(&flow, C_GRAY, "Renderer: ");
+	ui_textflow_puts(&flow, C_WHITE, renderers[state->renderer].name);
+	ui_textflow_puts(&flow, C_DARKER_GRAY, " [m]\n");
+	ui_textflow_puts(&flow, C_GRAY, "Interior checks: ");
+	ui_textflow_puts(&flow, C_WHITE, state->new_params.options ? "on" : "off");
+	ui_textflow_puts(&flow, C_DARKER_GRAY, " [i]\n");
+	ui_textflow_puts(&flow, C_GRAY, "Tile cache: ");
+	if (state->use_tile_cache) {
+		uint64_t frame_tiles = tile_stats.frame_hits + tile_stats.frame_misses;
+		ui_textflow_printf(
+			&flow, C_WHITE, "%.0f%%",
+			frame_tiles ? 100.0 * tile_stats.frame_hits / frame_tiles : 0
+		);
+		ui_textflow_puts(&flow, C_GRAY, " hits, ");
+		if (state->tile_store) {
+			ui_textflow_printf(
+				&flow, C_WHITE, "%.0f%%",
+				frame_tiles ? 100.0 * tile_stats.frame_loads / frame_tiles : 0
+			);
+			ui_textflow_puts(&flow, C_GRAY, " from disk, ");
+		}
+		ui_textflow_printf(
+			&flow, C_WHITE, "%.1f/%.0f MiB",
+			tile_stats.bytes / 1048576.0, tile_stats.max_bytes / 1048576.0
+		);
+	} else {
+		ui_textflow_puts(&flow, C_WHITE, "off");
+	}
+	ui_textflow_puts(&flow, C_DARKER_GRAY, " [k]\n");
+	ui_textflow_puts(&flow, C_GRAY, "Steps: ");
+	if (state->deepen && !state->fused) {
+		ui_textflow_printf(&flow, C_WHITE, "%d", deep_steps);
+		if (deep_steps < deep_target)
+			ui_textflow_printf(&flow, C_GRAY, " of %d", deep_target);
+	} else {
+		ui_textflow_printf(&flow, C_WHITE, "%d", VIEWER_MAX_STEPS);
+		ui_textflow_puts(&flow, C_GRAY, ", deepening off");
+	}
+	ui_textflow_puts(&flow, C_DARKER_GRAY, " [d]\n");
+	ui_textflow_puts(&flow, C_GRAY, "Pipeline: ");
+	ui_textflow_puts(&flow, C_WHITE, state->fused ? "fused" : "separate");
+	ui_textflow_puts(&flow, C_DARKER_GRAY, " [f]\n");
 	ui_textflow_puts(&flow, C_DARKER_GRAY, "Arrows to move, [PgUp]/[PgDn] to zoom");
 
 }
 
-void handle_key(struct State *state, SDL_Keycode key, bool *restart)
+static void move_coord(struct State *state, struct Mb_Big *coord, int dir)
+{
+	double pixel = state->new_params.swidth / WIN_WIDTH;
+	struct Mb_Big big_delta = mb_big_from_double(dir * round(WIN_WIDTH * MOVE_STEP) * pixel);
+	*coord = mb_big_add(coord, &big_delta);
+}
+
+/// Sets `stale` if the key changes what the generator computes
+void handle_key(struct State *state, SDL_Keycode key, bool *stale)
 {
 	switch(key) {
 
 	case SDLK_UP:
-		state->new_params.yc -= state->gdata.swidth * MOVE_STEP;
+		move_coord(state, &state->new_params.yc, -1);
+		*stale = true;
 		break;
 
 	case SDLK_DOWN:
-		state->new_params.yc += state->gdata.swidth * MOVE_STEP;
+		move_coord(state, &state->new_params.yc, 1);
+		*stale = true;
 		break;
 
 	case SDLK_LEFT:
-		state->new_params.xc -= state->gdata.swidth * MOVE_STEP;
+		move_coord(state, &state->new_params.xc, -1);
+		*stale = true;
 		break;
 
 	case SDLK_RIGHT:
-		state->new_params.xc += state->gdata.swidth * MOVE_STEP;
+		move_coord(state, &state->new_params.xc, 1);
+		*stale = true;
 		break;
 
+	// Width is computed from the level, so the same level
+	// always has the same width and cached tiles are found
 	case SDLK_PAGEUP:
-		state->new_params.swidth *= SCALE_STEP;
+		state->new_params.zoom++;
+		state->new_params.swidth = state->base_swidth * pow(SCALE_STEP, state->new_params.zoom);
+		*stale = true;
 		break;
 
 	case SDLK_PAGEDOWN:
-		state->new_params.swidth /= SCALE_STEP;
+		state->new_params.zoom--;
+		state->new_params.swidth = state->base_swidth * pow(SCALE_STEP, state->new_params.zoom);
+		*stale = true;
 		break;
 
-	case SDLK_g:
-		state->generator = (state->generator+1) % ARRAY_SIZE(generators);
-		*restart = true;
+	case SDLK_g: {
+		// Simple generator is always supported, so this stops.
+		// Only a supported one is ever seen by the generator thread.
+		int next = state->generator;
+		do
+			next = (next+1) % ARRAY_SIZE(generators);
+		while (!mb_generator_supported(next));
+		state->generator = next;
+		*stale = true;
 		break;
+	}
 	
 	case SDLK_c:
 		state->colorizer = (state->colorizer+1) % ARRAY_SIZE(colorizers);
 		break;
 
+	case SDLK_m:
+		state->renderer = (state->renderer+1) % ARRAY_SIZE(renderers);
+		*stale = true;
+		break;
+
+	case SDLK_k:
+		state->use_tile_cache = !state->use_tile_cache && state->tile_cache;
+		*stale = true;
+		break;
+
+	case SDLK_i:
+		state->new_params.options ^= MB_OPT_CARDIOID | MB_OPT_PERIODICITY;
+		*stale = true;
+		break;
+
+	case SDLK_d:
+		state->deepen = !state->deepen;
+		*stale = true;
+		break;
+
+	case SDLK_f:
+		state->fused = !state->fused;
+		break;
+
 	}
 
 }
 
-int main(void)
+/// Sets `redraw` if the window has to be drawn again
+static void handle_event(struct State *state, const SDL_Event *evt, bool *redraw, bool *quit)
 {
+	if (evt->type == state->frame_event) {
+		*redraw = true;
+		return;
+	}
+
+	switch (evt->type) {
+	case SDL_QUIT:
+		*quit = true;
+		break;
+
+	case SDL_WINDOWEVENT:
+		if (evt->window.event == SDL_WINDOWEVENT_EXPOSED)
+			*redraw = true;
+		break;
+
+	case SDL_KEYDOWN: {
+		bool stale = false;
+		pthread_mutex_lock(&state->data_mutex);
+		handle_key(state, evt->key.keysym.sym, &stale);
+		pthread_mutex_unlock(&state->data_mutex);
+
+		// Event may have waited in the queue for a while
+		double input_ms = wall_time_ms() - (SDL_GetTicks() - evt->key.timestamp);
+		if (stale)
+			cancel_frame(state, input_ms);
+		*redraw = true;
+		break;
+	}
+	}
+}
+
+static void start_generator(pthread_t *thread, struct State *state)
+{
+	state->shall_quit = false;
+	pthread_create(thread, 0, (void*(*)(void*)) generator_main, state);
+}
+
+/// Cancels the frame being computed, so this takes a row or so
+static void stop_generator(pthread_t thread, struct State *state)
+{
+	pthread_mutex_lock(&state->data_mutex);
+	state->shall_quit = true;
+	atomic_fetch_add(&state->epoch, 1);
+	pthread_cond_signal(&state->params_changed);
+	pthread_mutex_unlock(&state->data_mutex);
+	pthread_join(thread, NULL);
+}
+
+/// Renders frames without a window, to measure the pipeline alone.
+/// Caches are not used, so every frame is computed in full.
+static void run_headless(struct State *state, int frames)
+{
+	printf(
+		"Pipeline: %s, generator %s, %d frames of %dx%d\n",
+		state->fused ? "fused" : "separate", generators[state->generator].name,
+		frames, WIN_WIDTH, WIN_HEIGHT
+	);
+
+	double total = 0, best = INFINITY, color_total = 0;
+	for (int i = 0; i < frames; ++i) {
+		double begin = wall_time_ms();
+		if (state->fused) {
+			render_fused(state);
+		} else {
+			int active = mb_pick_generator(state->generator, &state->gdata);
+			renderers[state->renderer].render(state->pool, &generators[active], &state->gdata);
+			SWAP(state->gdata.exit_steps, state->exit_steps_ready);
+			state->ready_max_steps = VIEWER_MAX_STEPS;
+			state->has_fresh_data = true;
+			color_frame(state);
+		}
+		double ms = wall_time_ms() - begin;
+
+		total += ms;
+		color_total += state->color_ms;
+		if (ms < best)
+			best = ms;
+	}
+
+	printf("Average:  %.2f ms per frame, %.2f ms of it coloring separately\n",
+			total / frames, color_total / frames);
+	printf("Best:     %.2f ms\n", best);
+}
+
+static void print_usage(const char *name)
+{
+	printf(
+			"Usage: %s [-t THREADS] [-c MIB] [-S FILE] [-x X] [-y Y] [-w WIDTH]\n"
+			"       [-F] [-n FRAMES] [-h]\n", name
+	);
+	printf(
+			"  -h          Prints this help message\n"
+			"  -t THREADS  Number of threads to render with, all CPUs by default\n"
+			"  -c MIB      Memory cap of the tile cache, 0 disables it\n"
+			"  -S FILE     Tile store to load tiles from and save computed ones to\n"
+			"  -x X, -y Y  Initial center, may have more digits than double holds\n"
+			"  -w WIDTH    Initial width of the view\n"
+			"  -F          Start with the fused pipeline, which colors tiles right\n"
+			"              after computing them straight into the texture\n"
+			"  -n FRAMES   Do not open a window, render this many frames of the\n"
+			"              initial view and print how long they took\n"
+	);
+}
+
+int main(int argc, char **argv)
+{
+	int threads = mb_cpu_count();
+	struct Mb_Big xc = mb_big_from_double(INITIAL_POS_X);
+	struct Mb_Big yc = mb_big_from_double(INITIAL_POS_Y);
+	double swidth = INITIAL_SCALE;
+	int cache_mb = TILE_CACHE_MB;
+	const char *store_path = NULL;
+	bool fused = false;
+	int headless_frames = 0;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "t:c:S:x:y:w:Fn:h")) != -1) {
+		switch (opt) {
+		case 'h':
+			print_usage(argv[0]);
+			return 0;
+		case 't':
+			threads = atoi(optarg);
+			break;
+		case 'c':
+			cache_mb = atoi(optarg);
+			break;
+		case 'S':
+			store_path = optarg;
+			break;
+		case 'x':
+			if (!mb_big_from_str(&xc, optarg))
+				DIE("`-x` expects a decimal number");
+			break;
+		case 'y':
+			if (!mb_big_from_str(&yc, optarg))
+				DIE("`-y` expects a decimal number");
+			break;
+		case 'w':
+			swidth = atof(optarg);
+			break;
+		case 'F':
+			fused = true;
+			break;
+		case 'n':
+			headless_frames = atoi(optarg);
+			if (headless_frames < 1)
+				DIE("`-n` expects a positive integer number");
+			break;
+		default:
+			print_usage(argv[0]);
+			return -1;
+		}
+	}
+
+	if (threads < 1)
+		DIE("`-t` expects a positive integer number");
+	if (cache_mb < 0)
+		DIE("`-c` expects a non-negative integer number");
+	if (!(swidth > 0))
+		DIE("`-w` expects a positive number");
+
 	struct State state;
-	init_state(&state);
+	init_state(&state, threads, cache_mb, store_path, &xc, &yc, swidth);
+	state.fused = fused;
+
+	if (headless_frames) {
+		run_headless(&state, headless_frames);
+		deinit_state(&state);
+		return 0;
+	}
 
 	if (SDL_Init(SDL_INIT_EVENTS | SDL_INIT_VIDEO) < 0)
 		DIE("Failed to init SDL: %s", SDL_GetError());
@@ -195,7 +701,7 @@ int main(void)
         DIE("Failed to create a window: %s", SDL_GetError());
 
     SDL_Renderer *renderer
-		= SDL_CreateRenderer(win, -1, SDL_RENDERER_ACCELERATED);
+		= SDL_CreateRenderer(win, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
 	if (!renderer)
 		DIE("Failed to init renderer: %s", SDL_GetError());
 
@@ -206,43 +712,71 @@ int main(void)
 	if (!framebuffer)
 		DIE("Failed to init framebuffer: %s", SDL_GetError());
 	
+	state.frame_event = SDL_RegisterEvents(1);
+	if (state.frame_event == (Uint32) -1)
+		DIE("Failed to register an event: %s", SDL_GetError());
+
 	pthread_t generator_thread;
-	pthread_create(
-		&generator_thread, 0, (void*(*)(void*)) generator_main, &state
-	);
+	if (!state.fused)
+		start_generator(&generator_thread, &state);
 
-	bool will_quit = false;
+	bool will_quit = false, redraw = true;
 	SDL_Event evt;
 	while (!will_quit) {
-		bool restart = false;
-		while (SDL_PollEvent(&evt) != 0) {
-			switch (evt.type) {
-			case SDL_QUIT:
-				will_quit = true;
-				break;
-			case SDL_KEYDOWN:
-				handle_key(&state, evt.key.keysym.sym, &restart);
-			}
+		bool was_fused = state.fused;
+
+		// Nothing on the screen changes until an event comes: input,
+		// a fresh frame from the generator thread or the window system
+		if (!redraw) {
+			if (!SDL_WaitEvent(&evt))
+				DIE("Failed to wait for events: %s", SDL_GetError());
+			handle_event(&state, &evt, &redraw, &will_quit);
+		}
+		while (SDL_PollEvent(&evt) != 0)
+			handle_event(&state, &evt, &redraw, &will_quit);
+
+		// Generator thread owns the pool and gdata, so it is
+		// stopped while the UI thread renders by itself
+		if (state.fused != was_fused) {
+			if (state.fused)
+				stop_generator(generator_thread, &state);
+			else
+				start_generator(&generator_thread, &state);
 		}
 
-		draw_ui(&state);
-        SDL_UpdateTexture(framebuffer, NULL, state.fb, WIN_WIDTH * sizeof(ARGB));
-        SDL_RenderCopy(renderer, framebuffer, NULL, NULL);
-        SDL_RenderPresent(renderer);
-
-		if (restart) {
-			pthread_cancel(generator_thread);
-			pthread_join(generator_thread, NULL);
-			pthread_create(
-				&generator_thread, 0, (void*(*)(void*)) generator_main, &state
-			);
+		if (!redraw || will_quit)
+			continue;
+		redraw = false;
+
+		if (state.fused) {
+			// Pixels go straight to the texture memory, no copy
+			ARGB *own_fb = state.fb;
+			void *pixels;
+			int pitch;
+			if (SDL_LockTexture(framebuffer, NULL, &pixels, &pitch) < 0)
+				DIE("Failed to lock framebuffer: %s", SDL_GetError());
+			state.fb = pixels;
+			state.fb_pitch = pitch / sizeof(ARGB);
+
+			render_fused(&state);
+			draw_ui(&state);
+
+			SDL_UnlockTexture(framebuffer);
+			state.fb = own_fb;
+			state.fb_pitch = WIN_WIDTH;
+		} else {
+			color_frame(&state);
+			draw_ui(&state);
+			SDL_UpdateTexture(framebuffer, NULL, state.fb, WIN_WIDTH * sizeof(ARGB));
 		}
+        SDL_RenderCopy(renderer, framebuffer, NULL, NULL);
 
-        SDL_Delay(16); // ~ 60 fps
+		// Waits for vsync, so redraws are paced by the display
+        SDL_RenderPresent(renderer);
 	}
 
-	pthread_cancel(generator_thread);
-	pthread_join(generator_thread, NULL);
+	if (!state.fused)
+		stop_generator(generator_thread, &state);
 	deinit_state(&state);
 
 	return 0;
@@ -7,22 +7,67 @@
 #include "common.h"
 #include "color/api.h"
 #include "gen/api.h"
+#include "render/api.h"
 #include <pthread.h>
 #include <stdbool.h>
 
 struct State {
-	ARGB *fb;
-	int *exit_steps_rendered;
-	int *exit_steps_ready;
+	ARGB *fb;               // locked texture in fused mode
+	int fb_pitch;           // pixels per row of fb
+	// Same format as gdata.exit_steps, and limits they were computed with
+	void *exit_steps_rendered;
+	void *exit_steps_ready;
+	int rendered_max_steps, ready_max_steps;
 	struct Mb_GeneratorData gdata;
+	// Frame with iteration limit raised by deepening, and orbits of
+	// pixels not escaped yet, for generator thread only. Caches get
+	// frames with VIEWER_MAX_STEPS, so deepening works on a copy.
+	void *exit_steps_deep;
+	struct Mb_Orbits orbits;
+	bool deepen;
+	int deep_steps, deep_target;    // limit of the last frame pushed, where it goes
 	struct {
-		float xc, yc, swidth;
+		struct Mb_Big xc, yc;
+		double swidth;
+		int zoom;           // swidth is base_swidth * SCALE_STEP^zoom
+		unsigned options;
 	} new_params;
+	// What the UI asked for when the frame began, for generator
+	// thread only, copied by `load_params`
+	struct {
+		int generator, renderer;
+		bool use_tile_cache;
+	} loaded;
+	double base_swidth;
 	bool shall_quit;
-	int generator, colorizer;
+	int generator, colorizer, renderer;
+	int active_generator;   // what `generator` was switched to on this zoom
+	struct Mb_Pool *pool;
+	struct Mb_Pool *color_pool;    // for UI thread, `pool` is busy with generator
+	struct Mb_Palette palette;
+	float color_ms;
+	bool fused;             // UI thread renders straight into the texture,
+	                        // generator thread is stopped
+	struct Mb_PanCache pan_cache;   // previous frame, for generator thread only
+	struct Mb_TileCache *tile_cache;   // NULL if disabled
+	struct Mb_TileStore *tile_store;   // NULL if not given
+	bool use_tile_cache;
+	struct Mb_TileCacheStats tile_stats;
 	pthread_mutex_t data_mutex;
+	// Generator thread sleeps on it when the frame is done,
+	// until `epoch` changes or it shall quit
+	pthread_cond_t params_changed;
 	float ms_per_frame;
 	bool has_fresh_data;
+	unsigned frame_event;   // SDL event type sent when the data is fresh
+
+	// Frame the generator thread computes is abandoned
+	// when this changes, see `Mb_GeneratorData::cancel`
+	_Atomic unsigned epoch;
+	// Input latency: time of the first input no frame answers yet,
+	// 0 if there is none, and the one the fresh frame answers
+	double input_ms, fresh_input_ms;
+	float latency_ms;       // from input to the frame on the screen
 };
 
 // Graphical routines